@@ -0,0 +1,310 @@
+// Microbenchmarks for the CPU cost of deko3d's recording and submission paths.
+// Runs on the host build (null GPU). Each result is printed as one JSON object per line:
+//   {"name":"cmdbuf.draw","param":0,"iterations":...,"ns_per_op":...,"ops_per_sec":...}
+// Benchmarks moving a payload also report "bytes_per_sec".
+// Usage: dkbench [--filter substring] [--min-time-ms N]
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "dk_image.h"
+#include "dk_image_descriptor.h"
+#include "dk_sampler_descriptor.h"
+#include "host_context.h"
+
+namespace
+{
+	constexpr uint32_t s_cmdMemSize = 32U << 20;
+	constexpr uint32_t s_dataMemSize = 4U << 20;
+	constexpr uint32_t s_codeMemSize = 0x10000;
+
+	struct Context : dkhost::Context
+	{
+		DkMemBlock imageMem;
+		DkImageLayout imageLayout;
+		DkImage image;
+		DkImageView imageView;
+		DkSampler sampler;
+		uint8_t payload[DK_UNIFORM_BUF_MAX_SIZE];
+	};
+
+	// Returns the ticks spent on the timed part of n operations
+	typedef uint64_t (*BenchFunc)(Context& ctx, uint32_t param, uint64_t n);
+
+	struct Benchmark
+	{
+		const char* name;
+		BenchFunc func;
+		uint32_t param;
+		uint32_t bytesPerOp; // 0 if not applicable
+	};
+
+	// Runs func in chunks of at most maxBatch operations, resetting the command buffer (untimed) in between
+	template <typename Func>
+	uint64_t recordBatched(Context& ctx, uint64_t n, uint64_t maxBatch, Func&& func)
+	{
+		uint64_t ticks = 0;
+		while (n)
+		{
+			uint64_t batch = n < maxBatch ? n : maxBatch;
+			uint64_t start = armGetSystemTick();
+			for (uint64_t i = 0; i < batch; i ++)
+				func(i);
+			ticks += armGetSystemTick() - start;
+			dkCmdBufClear(ctx.cmdBuf);
+			n -= batch;
+		}
+		return ticks;
+	}
+
+	uint64_t benchDraw(Context& ctx, uint32_t param, uint64_t n)
+	{
+		return recordBatched(ctx, n, 0x10000, [&](uint64_t i) {
+			dkCmdBufDraw(ctx.cmdBuf, DkPrimitive_Triangles, 3, 1, uint32_t(i), 0);
+		});
+	}
+
+	uint64_t benchDrawIndexed(Context& ctx, uint32_t param, uint64_t n)
+	{
+		return recordBatched(ctx, n, 0x10000, [&](uint64_t i) {
+			dkCmdBufDrawIndexed(ctx.cmdBuf, DkPrimitive_Triangles, 6, 1, uint32_t(i), 0, 0);
+		});
+	}
+
+	uint64_t benchBindTextures(Context& ctx, uint32_t param, uint64_t n)
+	{
+		DkResHandle handles[2][DK_NUM_TEXTURE_BINDINGS];
+		for (uint32_t i = 0; i < DK_NUM_TEXTURE_BINDINGS; i ++)
+		{
+			handles[0][i] = dkMakeTextureHandle(i, 0);
+			handles[1][i] = dkMakeTextureHandle(i+1, 1);
+		}
+		return recordBatched(ctx, n, 0x10000, [&](uint64_t i) {
+			dkCmdBufBindTextures(ctx.cmdBuf, DkStage_Fragment, 0, handles[i&1], param);
+		});
+	}
+
+	uint64_t benchBindUniformBuffers(Context& ctx, uint32_t param, uint64_t n)
+	{
+		DkGpuAddr base = dkMemBlockGetGpuAddr(ctx.dataMem);
+		DkBufExtents bufs[2][DK_NUM_UNIFORM_BUFS];
+		for (uint32_t i = 0; i < DK_NUM_UNIFORM_BUFS; i ++)
+		{
+			bufs[0][i] = { base + i*DK_UNIFORM_BUF_ALIGNMENT, DK_UNIFORM_BUF_ALIGNMENT };
+			bufs[1][i] = { base + (i+DK_NUM_UNIFORM_BUFS)*DK_UNIFORM_BUF_ALIGNMENT, DK_UNIFORM_BUF_ALIGNMENT };
+		}
+		return recordBatched(ctx, n, 0x10000, [&](uint64_t i) {
+			dkCmdBufBindUniformBuffers(ctx.cmdBuf, DkStage_Vertex, 0, bufs[i&1], param);
+		});
+	}
+
+	uint64_t benchBindShaders(Context& ctx, uint32_t param, uint64_t n)
+	{
+		DkShader const* pairs[2][2] = { { &ctx.shaders[0], &ctx.shaders[1] }, { &ctx.shaders[2], &ctx.shaders[3] } };
+		return recordBatched(ctx, n, 0x10000, [&](uint64_t i) {
+			dkCmdBufBindShaders(ctx.cmdBuf, DkStageFlag_GraphicsMask, pairs[i&1], 2);
+		});
+	}
+
+	uint64_t benchPushConstants(Context& ctx, uint32_t param, uint64_t n)
+	{
+		DkGpuAddr ubo = dkMemBlockGetGpuAddr(ctx.dataMem);
+		uint64_t maxBatch = (s_cmdMemSize / 2) / (param + 64);
+		return recordBatched(ctx, n, maxBatch, [&](uint64_t i) {
+			dkCmdBufPushConstants(ctx.cmdBuf, ubo, DK_UNIFORM_BUF_MAX_SIZE, 0, param, ctx.payload);
+		});
+	}
+
+	// Submits a command list that is nested param levels deep (each level calls the previous one)
+	uint64_t benchQueueSubmit(Context& ctx, uint32_t param, uint64_t n)
+	{
+		DkCmdList list = 0;
+		for (uint32_t level = 0; level < param; level ++)
+		{
+			if (list)
+				dkCmdBufCallList(ctx.cmdBuf, list);
+			dkCmdBufDraw(ctx.cmdBuf, DkPrimitive_Triangles, 3, 1, 0, 0);
+			list = dkCmdBufFinishList(ctx.cmdBuf);
+		}
+
+		uint64_t ticks = 0;
+		while (n)
+		{
+			uint64_t batch = n < 64 ? n : 64;
+			uint64_t start = armGetSystemTick();
+			for (uint64_t i = 0; i < batch; i ++)
+				dkQueueSubmitCommands(ctx.queue, list);
+			ticks += armGetSystemTick() - start;
+			dkQueueWaitIdle(ctx.queue);
+			n -= batch;
+		}
+
+		dkCmdBufClear(ctx.cmdBuf);
+		return ticks;
+	}
+
+	uint64_t benchImageInfo(Context& ctx, uint32_t param, uint64_t n)
+	{
+		dk::detail::ImageInfo info;
+		uint64_t start = armGetSystemTick();
+		for (uint64_t i = 0; i < n; i ++)
+		{
+			info.fromImageView(&ctx.imageView, dk::detail::ImageInfo::ColorRenderTarget);
+			__asm__ __volatile__("" :: "r"(&info) : "memory");
+		}
+		return armGetSystemTick() - start;
+	}
+
+	uint64_t benchCalcLevelOffset(Context& ctx, uint32_t param, uint64_t n)
+	{
+		uint64_t sum = 0;
+		uint64_t start = armGetSystemTick();
+		for (uint64_t i = 0; i < n; i ++)
+		{
+			sum += ctx.imageLayout.calcLevelOffset(i % (ctx.imageLayout.m_mipLevels + 1));
+			__asm__ __volatile__("" : "+r"(sum));
+		}
+		return armGetSystemTick() - start;
+	}
+
+	uint64_t benchImageDescriptor(Context& ctx, uint32_t param, uint64_t n)
+	{
+		DkImageDescriptor desc;
+		uint64_t start = armGetSystemTick();
+		for (uint64_t i = 0; i < n; i ++)
+		{
+			dkImageDescriptorInitialize(&desc, &ctx.imageView, false, false);
+			__asm__ __volatile__("" :: "r"(&desc) : "memory");
+		}
+		return armGetSystemTick() - start;
+	}
+
+	uint64_t benchSamplerDescriptor(Context& ctx, uint32_t param, uint64_t n)
+	{
+		DkSamplerDescriptor desc;
+		uint64_t start = armGetSystemTick();
+		for (uint64_t i = 0; i < n; i ++)
+		{
+			dkSamplerDescriptorInitialize(&desc, &ctx.sampler);
+			__asm__ __volatile__("" :: "r"(&desc) : "memory");
+		}
+		return armGetSystemTick() - start;
+	}
+
+	const Benchmark s_benchmarks[] =
+	{
+		{ "cmdbuf.draw",                 benchDraw,               0,     0 },
+		{ "cmdbuf.draw_indexed",         benchDrawIndexed,        0,     0 },
+		{ "cmdbuf.bind_textures",        benchBindTextures,       1,     0 },
+		{ "cmdbuf.bind_textures",        benchBindTextures,       8,     0 },
+		{ "cmdbuf.bind_textures",        benchBindTextures,       32,    0 },
+		{ "cmdbuf.bind_uniform_buffers", benchBindUniformBuffers, 1,     0 },
+		{ "cmdbuf.bind_uniform_buffers", benchBindUniformBuffers, 4,     0 },
+		{ "cmdbuf.bind_uniform_buffers", benchBindUniformBuffers, 14,    0 },
+		{ "cmdbuf.bind_shaders",         benchBindShaders,        0,     0 },
+		{ "cmdbuf.push_constants",       benchPushConstants,      16,    16 },
+		{ "cmdbuf.push_constants",       benchPushConstants,      256,   256 },
+		{ "cmdbuf.push_constants",       benchPushConstants,      4096,  4096 },
+		{ "cmdbuf.push_constants",       benchPushConstants,      65536, 65536 },
+		{ "queue.submit_commands",       benchQueueSubmit,        1,     0 },
+		{ "queue.submit_commands",       benchQueueSubmit,        4,     0 },
+		{ "queue.submit_commands",       benchQueueSubmit,        16,    0 },
+		{ "image.from_image_view",       benchImageInfo,          0,     0 },
+		{ "image.calc_level_offset",     benchCalcLevelOffset,    0,     0 },
+		{ "descriptor.image",            benchImageDescriptor,    0,     0 },
+		{ "descriptor.sampler",          benchSamplerDescriptor,  0,     0 },
+	};
+
+	void createImage(Context& ctx)
+	{
+		DkImageLayoutMaker maker;
+		dkImageLayoutMakerDefaults(&maker, ctx.device);
+		maker.flags = DkImageFlags_UsageRender | DkImageFlags_HwCompression;
+		maker.format = DkImageFormat_RGBA8_Unorm;
+		maker.dimensions[0] = 1280;
+		maker.dimensions[1] = 720;
+		maker.mipLevels = 11;
+		dkImageLayoutInitialize(&ctx.imageLayout, &maker);
+
+		uint32_t align = dkImageLayoutGetAlignment(&ctx.imageLayout);
+		uint64_t size = (dkImageLayoutGetSize(&ctx.imageLayout) + align - 1) &~ uint64_t(align - 1);
+		ctx.imageMem = dkhost::createMemBlock(ctx.device, size, DkMemBlockFlags_GpuCached | DkMemBlockFlags_Image);
+		dkImageInitialize(&ctx.image, &ctx.imageLayout, ctx.imageMem, 0);
+		dkImageViewDefaults(&ctx.imageView, &ctx.image);
+		ctx.imageView.mipLevelOffset = 2;
+		dkSamplerDefaults(&ctx.sampler);
+		ctx.sampler.minFilter = DkFilter_Linear;
+		ctx.sampler.magFilter = DkFilter_Linear;
+		ctx.sampler.mipFilter = DkMipFilter_Linear;
+		ctx.sampler.maxAnisotropy = 8.0f;
+	}
+
+	void initContext(Context& ctx)
+	{
+		dkhost::initContext(ctx, s_cmdMemSize, s_dataMemSize, s_codeMemSize);
+		createImage(ctx);
+		for (uint32_t i = 0; i < sizeof(ctx.payload); i ++)
+			ctx.payload[i] = uint8_t(i);
+	}
+
+	void destroyContext(Context& ctx)
+	{
+		dkQueueWaitIdle(ctx.queue);
+		dkMemBlockDestroy(ctx.imageMem);
+		dkhost::destroyContext(ctx);
+	}
+
+	void runBenchmark(Context& ctx, Benchmark const& b, uint64_t minTimeNs)
+	{
+		// Warm up, then grow the iteration count until the timed part takes long enough
+		b.func(ctx, b.param, 16);
+		uint64_t n = 16, ticks;
+		for (;;)
+		{
+			ticks = b.func(ctx, b.param, n);
+			uint64_t ns = armTicksToNs(ticks);
+			if (ns >= minTimeNs)
+				break;
+			uint64_t scale = ns ? (minTimeNs * 5 / 4) / ns + 1 : 16;
+			n *= scale > 16 ? 16 : scale < 2 ? 2 : scale;
+		}
+
+		double ns = double(armTicksToNs(ticks));
+		double nsPerOp = ns / double(n);
+		double opsPerSec = 1e9 / nsPerOp;
+		printf("{\"name\":\"%s\",\"param\":%u,\"iterations\":%lu,\"ns_per_op\":%.3f,\"ops_per_sec\":%.1f",
+			b.name, b.param, (unsigned long)n, nsPerOp, opsPerSec);
+		if (b.bytesPerOp)
+			printf(",\"bytes_per_sec\":%.1f", opsPerSec * b.bytesPerOp);
+		printf("}\n");
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const char* filter = nullptr;
+	uint64_t minTimeNs = 200000000; // 200 ms
+
+	for (int i = 1; i < argc; i ++)
+	{
+		if (strcmp(argv[i], "--filter") == 0 && i+1 < argc)
+			filter = argv[++i];
+		else if (strcmp(argv[i], "--min-time-ms") == 0 && i+1 < argc)
+			minTimeNs = strtoull(argv[++i], nullptr, 0) * 1000000;
+		else
+		{
+			fprintf(stderr, "Usage: %s [--filter substring] [--min-time-ms N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	static Context ctx;
+	initContext(ctx);
+
+	for (auto const& b : s_benchmarks)
+		if (!filter || strstr(b.name, filter))
+			runBenchmark(ctx, b, minTimeNs);
+
+	destroyContext(ctx);
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include <string.h>
+#include "host_context.h"
+#include "dksh.h"
+
+namespace
+{
+	// Builds a DKSH module containing two vertex and two fragment programs (the code is never executed)
+	void createShaders(dkhost::Context& ctx)
+	{
+		// The headers don't fit in a single aligned unit, so the control section takes two
+		constexpr uint32_t controlSize = 2*DK_SHADER_CODE_ALIGNMENT;
+		constexpr uint32_t codeSize = DK_SHADER_CODE_ALIGNMENT;
+		static_assert(sizeof(DkshHeader) + 4*sizeof(DkshProgramHeader) <= controlSize, "DKSH headers overflow the control section");
+
+		uint8_t* base = static_cast<uint8_t*>(dkMemBlockGetCpuAddr(ctx.codeMem));
+		memset(base, 0, controlSize + codeSize);
+
+		auto* hdr = reinterpret_cast<DkshHeader*>(base);
+		hdr->magic = DKSH_MAGIC;
+		hdr->header_sz = sizeof(DkshHeader);
+		hdr->control_sz = controlSize;
+		hdr->code_sz = codeSize;
+		hdr->programs_off = sizeof(DkshHeader);
+		hdr->num_programs = 4;
+
+		auto* progs = reinterpret_cast<DkshProgramHeader*>(base + hdr->programs_off);
+		for (uint32_t i = 0; i < 4; i ++)
+		{
+			progs[i].type = (i & 1) ? DkshProgramType_Fragment : DkshProgramType_Vertex;
+			progs[i].entrypoint = 0x80 * (i / 2);
+			progs[i].num_gprs = 8 + 8*i;
+		}
+
+		for (uint32_t i = 0; i < 4; i ++)
+		{
+			DkShaderMaker maker;
+			dkShaderMakerDefaults(&maker, ctx.codeMem, 0);
+			maker.programId = i;
+			dkShaderInitialize(&ctx.shaders[i], &maker);
+		}
+	}
+}
+
+DkMemBlock dkhost::createMemBlock(DkDevice device, uint32_t size, uint32_t flags)
+{
+	DkMemBlockMaker maker;
+	dkMemBlockMakerDefaults(&maker, device, size);
+	maker.flags = flags;
+	return dkMemBlockCreate(&maker);
+}
+
+void dkhost::initContext(Context& ctx, uint32_t cmdMemSize, uint32_t dataMemSize, uint32_t codeMemSize)
+{
+	DkDeviceMaker deviceMaker;
+	dkDeviceMakerDefaults(&deviceMaker);
+	ctx.device = dkDeviceCreate(&deviceMaker);
+
+	ctx.cmdMem = createMemBlock(ctx.device, cmdMemSize, DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+	ctx.dataMem = createMemBlock(ctx.device, dataMemSize, DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+	ctx.codeMem = createMemBlock(ctx.device, codeMemSize, DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached | DkMemBlockFlags_Code);
+
+	DkCmdBufMaker cmdBufMaker;
+	dkCmdBufMakerDefaults(&cmdBufMaker, ctx.device);
+	ctx.cmdBuf = dkCmdBufCreate(&cmdBufMaker);
+	dkCmdBufAddMemory(ctx.cmdBuf, ctx.cmdMem, 0, cmdMemSize);
+
+	DkQueueMaker queueMaker;
+	dkQueueMakerDefaults(&queueMaker, ctx.device);
+	queueMaker.flags = DkQueueFlags_Graphics;
+	ctx.queue = dkQueueCreate(&queueMaker);
+	dkQueueWaitIdle(ctx.queue);
+
+	createShaders(ctx);
+}
+
+void dkhost::destroyContext(Context& ctx)
+{
+	dkQueueDestroy(ctx.queue);
+	dkCmdBufDestroy(ctx.cmdBuf);
+	dkMemBlockDestroy(ctx.codeMem);
+	dkMemBlockDestroy(ctx.dataMem);
+	dkMemBlockDestroy(ctx.cmdMem);
+	dkDeviceDestroy(ctx.device);
+}
@@ -0,0 +1,24 @@
+#pragma once
+// Objects shared by the host tools (see bench/ and mmesim/): a device with a graphics queue,
+// a command buffer backed by its own memory block, data and code memory, and a set of shaders.
+#include "dk_shader.h"
+
+namespace dkhost
+{
+	struct Context
+	{
+		DkDevice device;
+		DkMemBlock cmdMem;
+		DkMemBlock dataMem;
+		DkMemBlock codeMem;
+		DkCmdBuf cmdBuf;
+		DkQueue queue;
+		DkShader shaders[4]; // two vertex + fragment pairs
+	};
+
+	DkMemBlock createMemBlock(DkDevice device, uint32_t size, uint32_t flags);
+
+	// Also waits for the queue to finish its initial submission (macro upload and engine setup)
+	void initContext(Context& ctx, uint32_t cmdMemSize, uint32_t dataMemSize, uint32_t codeMemSize);
+	void destroyContext(Context& ctx);
+}
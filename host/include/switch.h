@@ -0,0 +1,472 @@
+/**
+ * @file switch.h
+ * @brief Host replacement for the subset of libnx used by deko3d.
+ * @note This header is only used by the host build (see host/Makefile), which runs the library
+ *       on top of a null GPU so that its CPU overhead can be measured on ordinary machines.
+ *       Declarations mirror libnx; only what deko3d needs is provided.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+
+typedef u32 Handle;
+typedef u32 Result;
+typedef u64 iova_t;
+typedef void (*ThreadFunc)(void*);
+
+#define BIT(n) (1U<<(n))
+
+#define NX_INLINE __attribute__((always_inline)) static inline
+#define NX_CONSTEXPR NX_INLINE constexpr
+#define NX_PACKED __attribute__((packed))
+#define NX_IGNORE_ARG(x) (void)(x)
+
+//---------------------------------------------------------------------------------
+// Result codes
+//---------------------------------------------------------------------------------
+
+#define R_SUCCEEDED(res)   ((res)==0)
+#define R_FAILED(res)      ((res)!=0)
+#define R_MODULE(res)      ((res)&0x1FF)
+#define R_DESCRIPTION(res) (((res)>>9)&0x1FFF)
+#define MAKERESULT(module,description) \
+	((((module)&0x1FF)) | ((description)&0x1FFF)<<9)
+
+enum {
+	Module_Kernel       = 1,
+	Module_Libnx        = 345,
+	Module_LibnxNvidia  = 348,
+};
+
+enum {
+	KernelError_TimedOut = 117,
+};
+
+enum {
+	LibnxError_OutOfMemory       = 2,
+	LibnxError_NotInitialized    = 4,
+	LibnxError_NotFound          = 48,
+};
+
+enum {
+	LibnxNvidiaError_Unknown = 1,
+	LibnxNvidiaError_NotImplemented,
+	LibnxNvidiaError_NotSupported,
+	LibnxNvidiaError_NotInitialized,
+	LibnxNvidiaError_BadParameter,
+	LibnxNvidiaError_Timeout,
+	LibnxNvidiaError_InsufficientMemory,
+};
+
+//---------------------------------------------------------------------------------
+// Kernel, threads and synchronization
+//---------------------------------------------------------------------------------
+
+#define CUR_THREAD_HANDLE 0xFFFF8000
+
+typedef u32 Mutex;   ///< Futex word: 0 = unlocked, 1 = locked, 2 = locked with waiters
+typedef u32 CondVar; ///< Futex word, incremented on every wakeup
+
+typedef struct {
+	u64 handle;      ///< pthread_t of the thread
+	ThreadFunc entry;
+	void* arg;
+	size_t stack_sz;
+} Thread;
+
+Result svcGetThreadPriority(s32* priority, Handle handle);
+void svcSleepThread(s64 nano);
+
+NX_INLINE void mutexInit(Mutex* m) { *m = 0; }
+void mutexLock(Mutex* m);
+bool mutexTryLock(Mutex* m);
+void mutexUnlock(Mutex* m);
+
+NX_INLINE void condvarInit(CondVar* c) { *c = 0; }
+Result condvarWaitTimeout(CondVar* c, Mutex* m, u64 timeout);
+NX_INLINE Result condvarWait(CondVar* c, Mutex* m) { return condvarWaitTimeout(c, m, UINT64_MAX); }
+Result condvarWake(CondVar* c, int num);
+NX_INLINE Result condvarWakeOne(CondVar* c) { return condvarWake(c, 1); }
+NX_INLINE Result condvarWakeAll(CondVar* c) { return condvarWake(c, -1); }
+
+Result threadCreate(Thread* t, ThreadFunc entry, void* arg, void* stack_mem, size_t stack_sz, int prio, int cpuid);
+Result threadStart(Thread* t);
+Result threadWaitForExit(Thread* t);
+Result threadClose(Thread* t);
+
+//---------------------------------------------------------------------------------
+// Counter and cache
+//---------------------------------------------------------------------------------
+
+u64 armGetSystemTick(void); ///< Monotonic clock converted to 19.2 MHz ticks, as on the console
+NX_INLINE u64 armGetSystemTickFreq(void) { return 19200000; }
+NX_INLINE u64 armNsToTicks(u64 ns) { return (ns * 12) / 625; }
+NX_INLINE u64 armTicksToNs(u64 tick) { return (tick * 625) / 12; }
+void armDCacheFlush(void* addr, size_t size);
+
+//---------------------------------------------------------------------------------
+// Error reporting
+//---------------------------------------------------------------------------------
+
+typedef struct {
+	const char* dialog_message;
+	const char* fullscreen_message;
+	Result errorcode;
+} ErrorApplicationConfig;
+
+Result errorApplicationCreate(ErrorApplicationConfig* c, const char* dialog_message, const char* fullscreen_message);
+NX_INLINE void errorApplicationSetNumber(ErrorApplicationConfig* c, Result errorcode) { c->errorcode = errorcode; }
+Result errorApplicationShow(ErrorApplicationConfig* c);
+__attribute__((noreturn)) void diagAbortWithResult(Result res);
+
+//---------------------------------------------------------------------------------
+// Nvidia services
+//---------------------------------------------------------------------------------
+
+typedef enum {
+	NvKind_Pitch                  = 0x0,
+	NvKind_Z16                    = 0x1,
+	NvKind_Z16_2C                 = 0x2,
+	NvKind_Z16_MS2_2C             = 0x3,
+	NvKind_Z16_MS4_2C             = 0x4,
+	NvKind_Z16_MS8_2C             = 0x5,
+	NvKind_Z16_2Z                 = 0x6,
+	NvKind_Z16_MS2_2Z             = 0x7,
+	NvKind_Z16_MS4_2Z             = 0x8,
+	NvKind_Z16_MS8_2Z             = 0x9,
+	NvKind_S8Z24                  = 0x11,
+	NvKind_S8Z24_2CZ              = 0x13,
+	NvKind_S8Z24_MS2_2CZ          = 0x14,
+	NvKind_S8Z24_MS4_2CZ          = 0x15,
+	NvKind_S8Z24_MS8_2CZ          = 0x16,
+	NvKind_S8                     = 0x2a,
+	NvKind_S8_2S                  = 0x2b,
+	NvKind_Z24S8                  = 0x46,
+	NvKind_Z24S8_2CZ              = 0x48,
+	NvKind_Z24S8_MS2_2CZ          = 0x49,
+	NvKind_Z24S8_MS4_2CZ          = 0x4a,
+	NvKind_Z24S8_MS8_2CZ          = 0x4b,
+	NvKind_Generic_16BX2          = 0xfe,
+	NvKind_ZF32                   = 0x7b,
+	NvKind_ZF32_2CZ               = 0x7f,
+	NvKind_ZF32_MS2_2CZ           = 0x80,
+	NvKind_ZF32_MS4_2CZ           = 0x81,
+	NvKind_ZF32_MS8_2CZ           = 0x82,
+	NvKind_ZF32_X24S8             = 0xce,
+	NvKind_ZF32_X24S8_2CSZV       = 0xd3,
+	NvKind_ZF32_X24S8_MS2_2CSZV   = 0xd4,
+	NvKind_ZF32_X24S8_MS4_2CSZV   = 0xd5,
+	NvKind_ZF32_X24S8_MS8_2CSZV   = 0xd6,
+	NvKind_C32_2CRA               = 0xdb,
+	NvKind_C32_MS2_2CRA           = 0xe0,
+	NvKind_C32_MS4_2CBR           = 0xe2,
+	NvKind_C32_MS8_MS16_2CRA      = 0xe8,
+	NvKind_C64_2CRA               = 0xe9,
+	NvKind_C64_MS2_2CRA           = 0xee,
+	NvKind_C64_MS4_2CBR           = 0xf0,
+	NvKind_C64_MS8_MS16_2CRA      = 0xf6,
+	NvKind_C128_2CR               = 0xf8,
+	NvKind_C128_MS2_2CR           = 0xfa,
+	NvKind_C128_MS4_2CR           = 0xfb,
+	NvKind_C128_MS8_MS16_2CR      = 0xfc,
+} NvKind;
+
+// Only consumed by the display, so the values used on the host are arbitrary
+typedef enum {
+	NvColorFormat_R5G6B5 = 1,
+	NvColorFormat_A8B8G8R8,
+	NvColorFormat_X8B8G8R8,
+	NvColorFormat_A8R8G8B8,
+	NvColorFormat_Y8,
+	NvColorFormat_U8_V8,
+} NvColorFormat;
+
+typedef enum {
+	NvLayout_Pitch       = 1,
+	NvLayout_Tiled       = 2,
+	NvLayout_BlockLinear = 3,
+} NvLayout;
+
+typedef enum {
+	NvChannelPriority_Low    = 50,
+	NvChannelPriority_Medium = 100,
+	NvChannelPriority_High   = 94,
+} NvChannelPriority;
+
+typedef struct {
+	u32 id;
+	u32 value;
+} NvFence;
+
+typedef struct {
+	u32 num_fences;
+	NvFence fences[4];
+} NvMultiFence;
+
+typedef struct {
+	u32 handle;
+	u32 id;
+	u32 size;
+	void* cpu_addr;
+	NvKind kind;
+	bool has_init;
+	bool is_cpu_cacheable;
+} NvMap;
+
+typedef struct {
+	u32 page_size;
+	bool has_init;
+} NvAddressSpace;
+
+typedef struct {
+	u64 timestamp;
+	u32 info32;
+	u16 info16;
+	u16 status;
+} NvNotification;
+
+typedef struct {
+	u32 type;
+	u32 info[31];
+} NvError;
+
+#define GPFIFO_QUEUE_SIZE 0x800
+#define GPFIFO_ENTRY_NOT_MAIN    BIT(9)
+#define GPFIFO_ENTRY_NO_PREFETCH BIT(31)
+
+typedef struct {
+	union {
+		u64 desc;
+		u32 desc32[2];
+	};
+} nvioctl_gpfifo_entry;
+
+typedef struct {
+	bool has_init;
+	NvFence fence;
+	u32 fence_incr;
+	nvioctl_gpfifo_entry entries[GPFIFO_QUEUE_SIZE];
+	u32 num_entries;
+} NvGpuChannel;
+
+typedef struct {
+	u32 arch;
+	u32 impl;
+	u32 rev;
+	u32 num_gpc;
+	u64 L2_cache_size;
+	u64 on_board_video_memory_size;
+	u32 num_tpc_per_gpc;
+	u32 bus_type;
+	u32 big_page_size;
+	u32 compression_page_size;
+	u32 pde_coverage_bit_count;
+	u32 available_big_page_sizes;
+	u32 gpc_mask;
+	u32 sm_arch_sm_version;
+	u32 sm_arch_spa_version;
+	u32 sm_arch_warp_count;
+} nvioctl_gpu_characteristics;
+
+typedef struct {
+	u32 width_align_pixels;
+	u32 height_align_pixels;
+	u32 pixel_squares_by_aliquots;
+	u32 aliquot_total;
+	u32 region_byte_multiplier;
+	u32 region_header_size;
+	u32 subregion_header_size;
+	u32 subregion_width_align_pixels;
+	u32 subregion_height_align_pixels;
+	u32 subregion_count;
+} nvioctl_zcull_info;
+
+Result nvInitialize(void);
+void nvExit(void);
+
+Result nvGpuInit(void);
+void nvGpuExit(void);
+const nvioctl_gpu_characteristics* nvGpuGetCharacteristics(void);
+u32 nvGpuGetZcullCtxSize(void);
+const nvioctl_zcull_info* nvGpuGetZcullInfo(void);
+
+Result nvFenceInit(void);
+void nvFenceExit(void);
+Result nvFenceWait(NvFence* f, s32 timeout_us);
+
+NX_INLINE void nvMultiFenceCreate(NvMultiFence* mf, const NvFence* fence)
+{
+	mf->num_fences = 1;
+	mf->fences[0] = *fence;
+}
+
+Result nvMultiFenceWait(NvMultiFence* mf, s32 timeout_us);
+
+Result nvMapInit(void);
+void nvMapExit(void);
+Result nvMapCreate(NvMap* m, void* cpu_addr, u32 size, u32 align, NvKind kind, bool is_cpu_cacheable);
+void nvMapClose(NvMap* m);
+
+NX_INLINE u32 nvMapGetHandle(NvMap* m) { return m->handle; }
+NX_INLINE u32 nvMapGetId(NvMap* m) { return m->id; }
+NX_INLINE u32 nvMapGetSize(NvMap* m) { return m->size; }
+NX_INLINE void* nvMapGetCpuAddr(NvMap* m) { return m->cpu_addr; }
+
+Result nvAddressSpaceCreate(NvAddressSpace* a, u32 page_size);
+void nvAddressSpaceClose(NvAddressSpace* a);
+Result nvAddressSpaceAlloc(NvAddressSpace* a, bool sparse, u64 size, iova_t* iova_out);
+Result nvAddressSpaceFree(NvAddressSpace* a, iova_t iova, u64 size);
+Result nvAddressSpaceMap(NvAddressSpace* a, u32 nvmap_handle, bool is_gpu_cacheable, NvKind kind, iova_t* iova_out);
+Result nvAddressSpaceMapFixed(NvAddressSpace* a, u32 nvmap_handle, bool is_gpu_cacheable, NvKind kind, iova_t iova);
+Result nvAddressSpaceModify(NvAddressSpace* a, iova_t iova, u64 offset, u64 size, NvKind kind);
+Result nvAddressSpaceUnmap(NvAddressSpace* a, iova_t iova);
+
+Result nvGpuChannelCreate(NvGpuChannel* c, NvAddressSpace* as, NvChannelPriority prio);
+void nvGpuChannelClose(NvGpuChannel* c);
+Result nvGpuChannelZcullBind(NvGpuChannel* c, iova_t iova);
+Result nvGpuChannelAppendEntry(NvGpuChannel* c, iova_t start, size_t num_cmds, u32 flags, u32 flush_threshold);
+Result nvGpuChannelKickoff(NvGpuChannel* c);
+Result nvGpuChannelGetErrorNotification(NvGpuChannel* c, NvNotification* notif);
+Result nvGpuChannelGetErrorInfo(NvGpuChannel* c, NvError* error);
+
+NX_INLINE u32 nvGpuChannelGetSyncpointId(NvGpuChannel* c)
+{
+	return c->fence.id;
+}
+
+NX_INLINE void nvGpuChannelGetFence(NvGpuChannel* c, NvFence* fence_out)
+{
+	fence_out->id = c->fence.id;
+	fence_out->value = c->fence.value + c->fence_incr;
+}
+
+NX_INLINE void nvGpuChannelIncrFence(NvGpuChannel* c)
+{
+	++c->fence_incr;
+}
+
+//---------------------------------------------------------------------------------
+// Native window (no display is available on the host: every operation fails)
+//---------------------------------------------------------------------------------
+
+enum {
+	PIXEL_FORMAT_RGBA_8888 = 1,
+	PIXEL_FORMAT_RGBX_8888 = 2,
+	PIXEL_FORMAT_RGB_565   = 4,
+	PIXEL_FORMAT_BGRA_8888 = 5,
+	PIXEL_FORMAT_Y8        = 0x20203859,
+	PIXEL_FORMAT_Y16       = 0x20363159,
+};
+
+enum {
+	GRALLOC_USAGE_HW_TEXTURE  = 0x00000100,
+	GRALLOC_USAGE_HW_RENDER   = 0x00000200,
+	GRALLOC_USAGE_HW_COMPOSER = 0x00000800,
+};
+
+enum {
+	HAL_TRANSFORM_FLIP_H = BIT(0),
+	HAL_TRANSFORM_FLIP_V = BIT(1),
+};
+
+typedef struct {
+	u32 num_fds;
+	u32 num_ints;
+} NativeHandle;
+
+typedef struct {
+	u32 width;
+	u32 height;
+	NvColorFormat color_format;
+	NvLayout layout;
+	u32 pitch;
+	u32 unused;
+	u32 offset;
+	NvKind kind;
+	u32 block_height_log2;
+	u32 display_scan_format;
+	u32 second_field_offset;
+	u64 flags;
+	u64 size;
+	u32 unk[6];
+} NvSurface;
+
+typedef struct {
+	NativeHandle header;
+	s32 unk0;
+	s32 nvmap_id;
+	u32 unk2;
+	u32 magic;
+	u32 pid;
+	u32 type;
+	u32 usage;
+	u32 format;
+	u32 ext_format;
+	u32 stride;
+	u32 total_size;
+	u32 num_planes;
+	u32 unk12;
+	NvSurface planes[3];
+	u64 unused;
+} NvGraphicBuffer;
+
+typedef struct NWindow NWindow;
+
+bool nwindowIsValid(NWindow* nw);
+Result nwindowConfigureBuffer(NWindow* nw, s32 slot, NvGraphicBuffer* buf);
+void nwindowReleaseBuffers(NWindow* nw);
+Result nwindowDequeueBuffer(NWindow* nw, s32* out_slot, NvMultiFence* out_fence);
+Result nwindowQueueBuffer(NWindow* nw, s32 slot, const NvMultiFence* fence);
+Result nwindowSetCrop(NWindow* nw, s32 left, s32 top, s32 right, s32 bottom);
+Result nwindowSetTransform(NWindow* nw, u32 transform);
+Result nwindowSetSwapInterval(NWindow* nw, u32 swap_interval);
+
+//---------------------------------------------------------------------------------
+// Host extensions: inspection of the work submitted to the null GPU
+//---------------------------------------------------------------------------------
+
+/// Gpfifo entry as seen by the null GPU at kickoff time.
+typedef struct {
+	u32 syncpt_id;    ///< Syncpoint of the channel the entry was submitted to
+	u32 flags;        ///< GPFIFO_ENTRY_* flags
+	iova_t iova;      ///< GPU address of the command words
+	const u32* cmds;  ///< CPU address of the command words (NULL if the address isn't mapped)
+	u32 num_cmds;     ///< Number of command words
+} NvHostGpfifoEntry;
+
+typedef void (*NvHostGpfifoCallback)(void* userdata, const NvHostGpfifoEntry* entry);
+
+typedef struct {
+	u64 num_kickoffs;
+	u64 num_gpfifo_entries;
+	u64 num_cmd_words;
+	u64 num_semaphore_releases;
+	u64 num_reports;
+	u64 num_unmapped_accesses;
+} NvHostStats;
+
+/// Installs a callback that is invoked for every gpfifo entry that is kicked off (pass NULL to remove).
+/// @note The callback runs on the kicking off thread without the null GPU locked, before the entry is executed.
+/// Other channels may be kicked off while it runs, so it must synchronize any state it shares with other threads.
+void nvHostSetGpfifoCallback(NvHostGpfifoCallback callback, void* userdata);
+void nvHostGetStats(NvHostStats* out);
+void nvHostResetStats(void);
+
+#ifdef __cplusplus
+}
+#endif
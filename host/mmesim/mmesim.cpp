@@ -0,0 +1,788 @@
+// Simulator for the macros that deko3d runs on the 3D engine's macro engine (MME).
+// Runs on the host build (null GPU): every gpfifo entry submitted by a set of scenarios is fed
+// through a model of the 3D engine's method processing, which loads the macro code exactly like
+// the GPU does (see MmeMacro_SetupCmds) and executes each macro invocation with an interpreter
+// that counts what the macro does. Each invocation is printed as one JSON object per line:
+//   {"scenario":"draw","macro":"Draw","params":5,"fetched":5,"instructions":...,"method_writes":...}
+// --trace adds the method writes emitted by the macro, and --profile the number of times each
+// instruction was executed (indexed by instruction offset from the start of the macro).
+// The exit status is nonzero if any invocation misbehaved (e.g. fetched more parameters than
+// it was given, which would stall the GPU; or left parameters unconsumed).
+// Usage: dkmmesim [--filter substring] [--trace] [--profile]
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "host_context.h"
+#include "maxwell/helpers.h"
+#include "mme_macros.h"
+
+namespace
+{
+	constexpr unsigned s_numMethods = 0x1000; // 3D engine methods reachable by the MME
+	constexpr unsigned s_firstMacroMethod = 0xE00;
+	constexpr unsigned s_numMacros = (s_numMethods - s_firstMacroMethod) / 2;
+	constexpr unsigned s_instrRamSize = 0x800;
+	constexpr uint32_t s_maxSteps = 1U << 20; // per invocation, to catch runaway loops
+
+	constexpr uint32_t s_cmdMemSize = 1U << 20;
+	constexpr uint32_t s_dataMemSize = 0x10000;
+	constexpr uint32_t s_codeMemSize = 0x10000;
+
+	// Engine3D methods handled by the model (see source/maxwell/engine_3d.def)
+	enum : unsigned
+	{
+		MethodMmeInstructionRamPointer  = 0x045,
+		MethodMmeInstructionRamLoad     = 0x046,
+		MethodMmeStartAddressRamPointer = 0x047,
+		MethodMmeStartAddressRamLoad    = 0x048,
+		MethodMmeShadowRamControl       = 0x049,
+	};
+
+	enum ShadowRamMode : uint32_t
+	{
+		MethodTrack           = 0,
+		MethodTrackWithFilter = 1,
+		MethodPassthrough     = 2,
+		MethodReplay          = 3,
+	};
+
+	// MME instruction encoding
+	enum Operation : uint32_t
+	{
+		OpAlu                       = 0,
+		OpAddImmediate              = 1,
+		OpExtractInsert             = 2,
+		OpExtractShiftLeftImmediate = 3,
+		OpExtractShiftLeftRegister  = 4,
+		OpRead                      = 5,
+		OpBranch                    = 7,
+	};
+
+	enum ResultOperation : uint32_t
+	{
+		ResIgnoreAndFetch              = 0,
+		ResMove                        = 1,
+		ResMoveAndSetMethod            = 2,
+		ResFetchAndSend                = 3,
+		ResMoveAndSend                 = 4,
+		ResFetchAndSetMethod           = 5,
+		ResMoveAndSetMethodFetchAndSend = 6,
+		ResMoveAndSetMethodSend        = 7,
+	};
+
+	enum AluOperation : uint32_t
+	{
+		AluAdd                = 0,
+		AluAddWithCarry       = 1,
+		AluSubtract           = 2,
+		AluSubtractWithBorrow = 3,
+		AluXor                = 8,
+		AluOr                 = 9,
+		AluAnd                = 10,
+		AluAndNot             = 11,
+		AluNand               = 12,
+	};
+
+	struct Instruction
+	{
+		uint32_t raw;
+
+		uint32_t operation() const       { return raw & 0xF; }
+		uint32_t resultOperation() const { return (raw >> 4) & 7; }
+		bool branchIfNotZero() const     { return (raw >> 4) & 1; }
+		bool branchAnnul() const         { return (raw >> 5) & 1; }
+		bool isExit() const              { return (raw >> 7) & 1; }
+		uint32_t dst() const             { return (raw >> 8) & 7; }
+		uint32_t srcA() const            { return (raw >> 11) & 7; }
+		uint32_t srcB() const            { return (raw >> 14) & 7; }
+		int32_t immediate() const        { return int32_t(raw) >> 14; }
+		uint32_t aluOperation() const    { return (raw >> 17) & 0x1F; }
+		uint32_t bfSrcBit() const        { return (raw >> 17) & 0x1F; }
+		uint32_t bfMask() const          { return (1U << ((raw >> 22) & 0x1F)) - 1; }
+		uint32_t bfDstBit() const        { return (raw >> 27) & 0x1F; }
+	};
+
+	struct MethodWrite
+	{
+		uint32_t method;
+		uint32_t value;
+	};
+
+	struct Invocation
+	{
+		unsigned macroId;
+		uint32_t startAddr;
+		std::vector<uint32_t> params;
+		uint32_t numFetched;
+		uint32_t numInstructions;
+		uint32_t numDelaySlots;
+		uint32_t numReads;
+		uint32_t numBranches;
+		uint32_t numBranchesTaken;
+		std::vector<MethodWrite> writes;
+		std::vector<uint32_t> profile; // executions per instruction, relative to startAddr
+		const char* error;
+	};
+
+	typedef void (*InvocationCallback)(Invocation const& inv);
+
+	// Models the method processing of one channel's 3D engine, including the MME and its shadow RAM
+	class Engine3D
+	{
+		InvocationCallback m_callback;
+
+		uint32_t m_instrRam[s_instrRamSize];
+		uint32_t m_startAddrRam[s_numMacros];
+		uint32_t m_shadow[s_numMethods]; // what the macros read
+		uint32_t m_instrRamPtr;
+		uint32_t m_startAddrRamPtr;
+		uint32_t m_shadowMode;
+
+		// Command stream decoding state (the data of a command may span several gpfifo entries)
+		uint32_t m_cmdMode;
+		uint32_t m_cmdSubchannel;
+		uint32_t m_cmdMethod;
+		uint32_t m_cmdCount;
+
+		// Macro invocation in progress (it runs once all its parameters are known)
+		bool m_pending;
+		Invocation m_inv;
+
+		// Interpreter state
+		uint32_t m_regs[8];
+		uint32_t m_regsWritten;
+		bool m_carry;
+		uint32_t m_methodAddr;
+		uint32_t m_methodIncr;
+		uint32_t m_pc;
+		uint32_t m_jumpTarget;
+		bool m_hasJump;
+
+		void writeMethod(uint32_t method, uint32_t value)
+		{
+			switch (method)
+			{
+				case MethodMmeInstructionRamPointer:
+					m_instrRamPtr = value;
+					break;
+				case MethodMmeInstructionRamLoad:
+					m_instrRam[m_instrRamPtr++ % s_instrRamSize] = value;
+					break;
+				case MethodMmeStartAddressRamPointer:
+					m_startAddrRamPtr = value;
+					break;
+				case MethodMmeStartAddressRamLoad:
+					m_startAddrRam[m_startAddrRamPtr++ % s_numMacros] = value;
+					break;
+				case MethodMmeShadowRamControl:
+					m_shadowMode = value & 3;
+					break;
+				default:
+					break;
+			}
+
+			if (m_shadowMode == MethodTrack || m_shadowMode == MethodTrackWithFilter)
+				m_shadow[method % s_numMethods] = value;
+		}
+
+		void processMethod(uint32_t subchannel, uint32_t method, uint32_t value)
+		{
+			if (subchannel != maxwell::Subchannel3D)
+				return;
+
+			if (method >= s_firstMacroMethod && method < s_numMethods)
+			{
+				unsigned macroId = (method - s_firstMacroMethod) / 2;
+				if (!(method & 1))
+				{
+					flush();
+					m_pending = true;
+					m_inv = Invocation{};
+					m_inv.macroId = macroId;
+					m_inv.params.push_back(value);
+				}
+				else if (m_pending && m_inv.macroId == macroId)
+					m_inv.params.push_back(value);
+				return;
+			}
+
+			flush();
+			writeMethod(method, value);
+		}
+
+		void fail(const char* error)
+		{
+			if (!m_inv.error)
+				m_inv.error = error;
+		}
+
+		uint32_t getReg(uint32_t id)
+		{
+			if (!(m_regsWritten & (1U << id)))
+				fail("uninitialized_register");
+			return m_regs[id];
+		}
+
+		void setReg(uint32_t id, uint32_t value)
+		{
+			if (id)
+			{
+				m_regs[id] = value;
+				m_regsWritten |= 1U << id;
+			}
+		}
+
+		uint32_t fetchParam()
+		{
+			if (m_inv.numFetched >= m_inv.params.size())
+			{
+				fail("param_underflow"); // the GPU would wait forever for this parameter
+				return 0;
+			}
+			return m_inv.params[m_inv.numFetched++];
+		}
+
+		void setMethodAddr(uint32_t value)
+		{
+			m_methodAddr = value & 0xFFF;
+			m_methodIncr = (value >> 12) & 0x3F;
+		}
+
+		void send(uint32_t value)
+		{
+			m_inv.writes.push_back({ m_methodAddr, value });
+			if (m_methodAddr >= s_firstMacroMethod)
+				fail("macro_method_write");
+			else
+				writeMethod(m_methodAddr, value);
+			m_methodAddr = (m_methodAddr + m_methodIncr) & 0xFFF;
+		}
+
+		uint32_t alu(uint32_t op, uint32_t a, uint32_t b)
+		{
+			uint64_t res;
+			switch (op)
+			{
+				case AluAdd:
+					res = uint64_t(a) + b;
+					m_carry = res >> 32;
+					return uint32_t(res);
+				case AluAddWithCarry:
+					res = uint64_t(a) + b + (m_carry ? 1 : 0);
+					m_carry = res >> 32;
+					return uint32_t(res);
+				case AluSubtract:
+					res = uint64_t(a) - b;
+					m_carry = res < (uint64_t(1) << 32);
+					return uint32_t(res);
+				case AluSubtractWithBorrow:
+					res = uint64_t(a) - b - (m_carry ? 0 : 1);
+					m_carry = res < (uint64_t(1) << 32);
+					return uint32_t(res);
+				case AluXor:    return a ^ b;
+				case AluOr:     return a | b;
+				case AluAnd:    return a & b;
+				case AluAndNot: return a &~ b;
+				case AluNand:   return ~(a & b);
+				default:
+					fail("invalid_alu_operation");
+					return 0;
+			}
+		}
+
+		void processResult(uint32_t op, uint32_t dst, uint32_t result)
+		{
+			switch (op)
+			{
+				case ResIgnoreAndFetch:
+					setReg(dst, fetchParam());
+					break;
+				case ResMove:
+					setReg(dst, result);
+					break;
+				case ResMoveAndSetMethod:
+					setReg(dst, result);
+					setMethodAddr(result);
+					break;
+				case ResFetchAndSend:
+					setReg(dst, fetchParam());
+					send(result);
+					break;
+				case ResMoveAndSend:
+					setReg(dst, result);
+					send(result);
+					break;
+				case ResFetchAndSetMethod:
+					setReg(dst, fetchParam());
+					setMethodAddr(result);
+					break;
+				case ResMoveAndSetMethodFetchAndSend:
+					setReg(dst, result);
+					setMethodAddr(result);
+					send(fetchParam());
+					break;
+				case ResMoveAndSetMethodSend:
+					setReg(dst, result);
+					setMethodAddr(result);
+					send((result >> 12) & 0x3F);
+					break;
+			}
+		}
+
+		// Executes one instruction, returns false when the macro exits
+		bool step(bool isDelaySlot)
+		{
+			uint32_t addr = m_pc;
+			Instruction insn{m_instrRam[addr % s_instrRamSize]};
+			uint32_t offset = addr - m_inv.startAddr;
+			if (offset >= m_inv.profile.size())
+				m_inv.profile.resize(offset+1);
+			m_inv.profile[offset] ++;
+			m_inv.numInstructions ++;
+			if (isDelaySlot)
+				m_inv.numDelaySlots ++;
+
+			m_pc ++;
+			if (m_hasJump)
+			{
+				m_pc = m_jumpTarget;
+				m_hasJump = false;
+			}
+
+			switch (insn.operation())
+			{
+				case OpAlu:
+					processResult(insn.resultOperation(), insn.dst(), alu(insn.aluOperation(), getReg(insn.srcA()), getReg(insn.srcB())));
+					break;
+				case OpAddImmediate:
+					processResult(insn.resultOperation(), insn.dst(), getReg(insn.srcA()) + insn.immediate());
+					break;
+				case OpExtractInsert:
+				{
+					uint32_t dst = getReg(insn.srcA()) &~ (insn.bfMask() << insn.bfDstBit());
+					uint32_t src = (getReg(insn.srcB()) >> insn.bfSrcBit()) & insn.bfMask();
+					processResult(insn.resultOperation(), insn.dst(), dst | (src << insn.bfDstBit()));
+					break;
+				}
+				case OpExtractShiftLeftImmediate:
+				{
+					uint32_t shift = getReg(insn.srcA());
+					uint32_t src = getReg(insn.srcB());
+					processResult(insn.resultOperation(), insn.dst(), ((src >> shift) & insn.bfMask()) << insn.bfDstBit());
+					break;
+				}
+				case OpExtractShiftLeftRegister:
+				{
+					uint32_t shift = getReg(insn.srcA());
+					uint32_t src = getReg(insn.srcB());
+					processResult(insn.resultOperation(), insn.dst(), ((src >> insn.bfSrcBit()) & insn.bfMask()) << shift);
+					break;
+				}
+				case OpRead:
+					m_inv.numReads ++;
+					processResult(insn.resultOperation(), insn.dst(), m_shadow[(getReg(insn.srcA()) + insn.immediate()) % s_numMethods]);
+					break;
+				case OpBranch:
+				{
+					if (isDelaySlot)
+					{
+						fail("branch_in_delay_slot");
+						return false;
+					}
+
+					m_inv.numBranches ++;
+					bool taken = (getReg(insn.srcA()) != 0) == insn.branchIfNotZero();
+					if (taken)
+					{
+						m_inv.numBranchesTaken ++;
+						if (insn.branchAnnul())
+						{
+							m_pc = addr + insn.immediate();
+							return true;
+						}
+
+						// A taken branch cancels the exit flag of the branch instruction itself
+						m_jumpTarget = addr + insn.immediate();
+						m_hasJump = true;
+						return step(true);
+					}
+					break;
+				}
+				default:
+					fail("invalid_operation");
+					return false;
+			}
+
+			// The exit flag has no effect inside a delay slot
+			if (insn.isExit() && !isDelaySlot)
+			{
+				step(true);
+				return false;
+			}
+
+			return true;
+		}
+
+		void execute()
+		{
+			m_inv.startAddr = m_startAddrRam[m_inv.macroId];
+			memset(m_regs, 0, sizeof(m_regs));
+			m_regs[1] = fetchParam();
+			m_regsWritten = (1U << 0) | (1U << 1);
+			m_carry = false;
+			m_methodAddr = 0;
+			m_methodIncr = 0;
+			m_pc = m_inv.startAddr;
+			m_hasJump = false;
+
+			while (!m_inv.error && step(false))
+			{
+				if (m_inv.numInstructions >= s_maxSteps)
+					fail("step_limit");
+			}
+
+			if (!m_inv.error && m_inv.numFetched != m_inv.params.size())
+				fail("unused_params"); // the leftover parameters would be consumed by the next macro
+		}
+
+	public:
+		Engine3D(InvocationCallback callback) :
+			m_callback{callback}, m_instrRam{}, m_startAddrRam{}, m_shadow{},
+			m_instrRamPtr{}, m_startAddrRamPtr{}, m_shadowMode{MethodTrack},
+			m_cmdMode{}, m_cmdSubchannel{}, m_cmdMethod{}, m_cmdCount{}, m_pending{} { }
+
+		void feed(const uint32_t* cmds, uint32_t numCmds)
+		{
+			for (uint32_t i = 0; i < numCmds; i ++)
+			{
+				uint32_t word = cmds[i];
+				if (m_cmdCount)
+				{
+					processMethod(m_cmdSubchannel, m_cmdMethod, word);
+					m_cmdCount --;
+					if (m_cmdMode == maxwell::Increasing)
+						m_cmdMethod ++;
+					else if (m_cmdMode == maxwell::IncreaseOnce)
+					{
+						m_cmdMethod ++;
+						m_cmdMode = maxwell::NonIncreasing;
+					}
+					continue;
+				}
+
+				uint32_t mode = word >> 29;
+				uint32_t subchannel = (word >> 13) & 7;
+				uint32_t method = word & 0x1FFF;
+				uint32_t arg = (word >> 16) & 0x1FFF;
+				switch (mode)
+				{
+					case maxwell::Increasing:
+					case maxwell::NonIncreasing:
+					case maxwell::IncreaseOnce:
+						m_cmdMode = mode;
+						m_cmdSubchannel = subchannel;
+						m_cmdMethod = method;
+						m_cmdCount = arg;
+						break;
+					case maxwell::Inline:
+						processMethod(subchannel, method, arg);
+						break;
+					default: // not generated by deko3d
+						break;
+				}
+			}
+		}
+
+		// Runs the macro invocation in progress, if any
+		void flush()
+		{
+			if (!m_pending)
+				return;
+			m_pending = false;
+			execute();
+			m_callback(m_inv);
+		}
+	};
+
+	using dkhost::Context;
+
+	typedef void (*ScenarioFunc)(Context& ctx);
+
+	struct Scenario
+	{
+		const char* name;
+		ScenarioFunc func;
+	};
+
+	const char* g_scenario = "queue_init";
+	const char* g_filter;
+	bool g_trace;
+	bool g_profile;
+	bool g_failed;
+	std::map<uint32_t, Engine3D> g_engines; // indexed by syncpoint, i.e. one per channel
+
+	const struct { const char* name; unsigned method; } s_macroNames[] =
+	{
+#define MACRO(_name) { #_name, MmeMacro##_name }
+		MACRO(ClearColor),
+		MACRO(ClearDepthStencil),
+		MACRO(ConditionalZcullInvalidate),
+		MACRO(Draw),
+		MACRO(DrawIndexed),
+		MACRO(MultiDraw),
+		MACRO(MultiDrawIndexed),
+		MACRO(DrawIndirectCount),
+		MACRO(DrawIndexedIndirectCount),
+		MACRO(WriteHardwareReg),
+		MACRO(SelectDriverConstbuf),
+		MACRO(BindProgram),
+		MACRO(BindColorBlendEnableState),
+		MACRO(BindColorWriteMasks),
+		MACRO(BindDepthStencilState),
+		MACRO(SetStencilCullCriteria),
+		MACRO(UpdateConservativeRaster),
+		MACRO(FillRegisters),
+#undef MACRO
+	};
+
+	void printInvocation(Invocation const& inv)
+	{
+		if (inv.error)
+			g_failed = true;
+		if (g_filter && !strstr(g_scenario, g_filter))
+			return;
+
+		unsigned method = s_firstMacroMethod + 2*inv.macroId;
+		const char* name = nullptr;
+		for (auto const& m : s_macroNames)
+			if (m.method == method)
+				name = m.name;
+
+		printf("{\"scenario\":\"%s\",\"macro\":", g_scenario);
+		if (name)
+			printf("\"%s\"", name);
+		else
+			printf("\"0x%03X\"", method);
+		printf(",\"params\":%u,\"fetched\":%u,\"instructions\":%u,\"delay_slots\":%u,\"branches\":%u,\"branches_taken\":%u,\"reads\":%u,\"method_writes\":%u",
+			unsigned(inv.params.size()), inv.numFetched, inv.numInstructions, inv.numDelaySlots,
+			inv.numBranches, inv.numBranchesTaken, inv.numReads, unsigned(inv.writes.size()));
+		if (inv.error)
+			printf(",\"error\":\"%s\"", inv.error);
+		if (g_trace)
+		{
+			printf(",\"writes\":[");
+			for (size_t i = 0; i < inv.writes.size(); i ++)
+				printf("%s[\"0x%03X\",\"0x%08X\"]", i ? "," : "", inv.writes[i].method, inv.writes[i].value);
+			printf("]");
+		}
+		if (g_profile)
+		{
+			printf(",\"profile\":[");
+			for (size_t i = 0; i < inv.profile.size(); i ++)
+				printf("%s%u", i ? "," : "", inv.profile[i]);
+			printf("]");
+		}
+		printf("}\n");
+	}
+
+	void gpfifoCallback(void* userdata, const NvHostGpfifoEntry* entry)
+	{
+		if (!entry->cmds)
+			return;
+		auto it = g_engines.try_emplace(entry->syncpt_id, printInvocation).first;
+		it->second.feed(entry->cmds, entry->num_cmds);
+	}
+
+	void flushEngines()
+	{
+		for (auto& it : g_engines)
+			it.second.flush();
+	}
+
+	//-----------------------------------------------------------------------------
+	// Scenarios
+	//-----------------------------------------------------------------------------
+
+	void scenarioDraw(Context& ctx)
+	{
+		dkCmdBufDraw(ctx.cmdBuf, DkPrimitive_Triangles, 3, 1, 0, 0);
+	}
+
+	void scenarioDrawBaseInstance(Context& ctx)
+	{
+		dkCmdBufDraw(ctx.cmdBuf, DkPrimitive_Triangles, 3, 1, 0, 7);
+	}
+
+	void scenarioDrawInstanced(Context& ctx)
+	{
+		dkCmdBufDraw(ctx.cmdBuf, DkPrimitive_Triangles, 3, 4, 0, 0);
+	}
+
+	void scenarioDrawIndexed(Context& ctx)
+	{
+		dkCmdBufDrawIndexed(ctx.cmdBuf, DkPrimitive_Triangles, 6, 1, 0, 0, 0);
+	}
+
+	void scenarioDrawIndexedBaseVertexInstance(Context& ctx)
+	{
+		dkCmdBufDrawIndexed(ctx.cmdBuf, DkPrimitive_Triangles, 6, 1, 0, 100, 7);
+	}
+
+	void scenarioDrawIndexedInstanced(Context& ctx)
+	{
+		dkCmdBufDrawIndexed(ctx.cmdBuf, DkPrimitive_Triangles, 6, 4, 0, 0, 0);
+	}
+
+	void scenarioMultiDraw(Context& ctx)
+	{
+		DkDrawIndirectData draws[8];
+		for (uint32_t i = 0; i < 8; i ++)
+			draws[i] = DkDrawIndirectData{ 3, i % 3, 3*i, i };
+		dkCmdBufMultiDraw(ctx.cmdBuf, DkPrimitive_Triangles, draws, 8);
+	}
+
+	void scenarioMultiDrawIndexed(Context& ctx)
+	{
+		DkDrawIndexedIndirectData draws[8];
+		for (uint32_t i = 0; i < 8; i ++)
+			draws[i] = DkDrawIndexedIndirectData{ 6, i % 3, 6*i, int32_t(4*i), i };
+		dkCmdBufMultiDrawIndexed(ctx.cmdBuf, DkPrimitive_Triangles, draws, 8);
+	}
+
+	void scenarioDrawIndirect(Context& ctx)
+	{
+		auto* data = static_cast<DkDrawIndirectData*>(dkMemBlockGetCpuAddr(ctx.dataMem));
+		data[0] = DkDrawIndirectData{ 3, 2, 0, 1 };
+		dkCmdBufDrawIndirect(ctx.cmdBuf, DkPrimitive_Triangles, dkMemBlockGetGpuAddr(ctx.dataMem));
+	}
+
+	void scenarioDrawIndirectCount(Context& ctx)
+	{
+		auto* count = static_cast<uint32_t*>(dkMemBlockGetCpuAddr(ctx.dataMem));
+		auto* data = reinterpret_cast<DkDrawIndirectData*>(count + 4);
+		*count = 5;
+		for (uint32_t i = 0; i < 8; i ++)
+			data[i] = DkDrawIndirectData{ 3, 1 + i % 2, 3*i, 0 };
+
+		DkGpuAddr addr = dkMemBlockGetGpuAddr(ctx.dataMem);
+		dkCmdBufDrawIndirectCount(ctx.cmdBuf, DkPrimitive_Triangles, addr + 16, sizeof(DkDrawIndirectData), addr, 8);
+	}
+
+	void scenarioBindShaders(Context& ctx)
+	{
+		DkShader const* pairs[2][2] = { { &ctx.shaders[0], &ctx.shaders[1] }, { &ctx.shaders[2], &ctx.shaders[3] } };
+		dkCmdBufBindShaders(ctx.cmdBuf, DkStageFlag_GraphicsMask, pairs[0], 2);
+		dkCmdBufBindShaders(ctx.cmdBuf, DkStageFlag_GraphicsMask, pairs[1], 2);
+	}
+
+	void scenarioBindShadersSame(Context& ctx)
+	{
+		// The second bind reloads the same programs, which takes the fast path in BindProgram
+		DkShader const* pair[2] = { &ctx.shaders[0], &ctx.shaders[1] };
+		dkCmdBufBindShaders(ctx.cmdBuf, DkStageFlag_GraphicsMask, pair, 2);
+		dkCmdBufBindShaders(ctx.cmdBuf, DkStageFlag_GraphicsMask, pair, 2);
+	}
+
+	void scenarioColorState(Context& ctx)
+	{
+		DkColorState state;
+		dkColorStateDefaults(&state);
+		state.blendEnableMask = 0x05;
+		dkCmdBufBindColorState(ctx.cmdBuf, &state);
+	}
+
+	void scenarioColorWriteState(Context& ctx)
+	{
+		DkColorWriteState state;
+		dkColorWriteStateDefaults(&state);
+		dkColorWriteStateSetMask(&state, 1, DkColorMask_R | DkColorMask_A);
+		dkCmdBufBindColorWriteState(ctx.cmdBuf, &state);
+	}
+
+	void scenarioDepthStencilState(Context& ctx)
+	{
+		DkDepthStencilState state;
+		dkDepthStencilStateDefaults(&state);
+		state.stencilTestEnable = 1;
+		dkCmdBufBindDepthStencilState(ctx.cmdBuf, &state);
+	}
+
+	void scenarioClear(Context& ctx)
+	{
+		const float color[4] = { 0.0f, 0.5f, 1.0f, 1.0f };
+		dkCmdBufClearColor(ctx.cmdBuf, 0, DkColorMask_RGBA, color);
+		dkCmdBufClearDepthStencil(ctx.cmdBuf, true, 1.0f, 0xFF, 0);
+	}
+
+	const Scenario s_scenarios[] =
+	{
+		{ "draw",                                scenarioDraw                          },
+		{ "draw.base_instance",                  scenarioDrawBaseInstance              },
+		{ "draw.instanced",                      scenarioDrawInstanced                 },
+		{ "draw_indexed",                        scenarioDrawIndexed                   },
+		{ "draw_indexed.base_vertex_instance",   scenarioDrawIndexedBaseVertexInstance },
+		{ "draw_indexed.instanced",              scenarioDrawIndexedInstanced          },
+		{ "multi_draw",                          scenarioMultiDraw                     },
+		{ "multi_draw_indexed",                  scenarioMultiDrawIndexed              },
+		{ "draw_indirect",                       scenarioDrawIndirect                  },
+		{ "draw_indirect_count",                 scenarioDrawIndirectCount             },
+		{ "bind_shaders",                        scenarioBindShaders                   },
+		{ "bind_shaders.same",                   scenarioBindShadersSame               },
+		{ "color_state",                         scenarioColorState                    },
+		{ "color_write_state",                   scenarioColorWriteState               },
+		{ "depth_stencil_state",                 scenarioDepthStencilState             },
+		{ "clear",                               scenarioClear                         },
+	};
+
+	void initContext(Context& ctx)
+	{
+		// The queue uploads the macros and initializes the 3D engine state as part of its first submission
+		dkhost::initContext(ctx, s_cmdMemSize, s_dataMemSize, s_codeMemSize);
+		flushEngines();
+	}
+
+	void runScenario(Context& ctx, Scenario const& s)
+	{
+		g_scenario = s.name;
+		s.func(ctx);
+		dkQueueSubmitCommands(ctx.queue, dkCmdBufFinishList(ctx.cmdBuf));
+		dkQueueWaitIdle(ctx.queue);
+		flushEngines();
+		dkCmdBufClear(ctx.cmdBuf);
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i ++)
+	{
+		if (strcmp(argv[i], "--filter") == 0 && i+1 < argc)
+			g_filter = argv[++i];
+		else if (strcmp(argv[i], "--trace") == 0)
+			g_trace = true;
+		else if (strcmp(argv[i], "--profile") == 0)
+			g_profile = true;
+		else
+		{
+			fprintf(stderr, "Usage: %s [--filter substring] [--trace] [--profile]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	nvHostSetGpfifoCallback(gpfifoCallback, nullptr);
+
+	static Context ctx;
+	initContext(ctx);
+
+	for (auto const& s : s_scenarios)
+		if (!g_filter || strstr(s.name, g_filter))
+			runScenario(ctx, s);
+
+	dkhost::destroyContext(ctx);
+	nvHostSetGpfifoCallback(nullptr, nullptr);
+	return g_failed ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+// Host implementation of the kernel, threading and error reporting parts of libnx used by deko3d.
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <switch.h>
+
+extern "C" u32 __nx_applet_exit_mode;
+u32 __nx_applet_exit_mode;
+
+static_assert(sizeof(pthread_t) <= sizeof(u64), "pthread_t must fit in Thread::handle");
+
+namespace
+{
+	long futex(u32* addr, int op, u32 val, const struct timespec* timeout = nullptr)
+	{
+		return syscall(SYS_futex, addr, op | FUTEX_PRIVATE_FLAG, val, timeout, nullptr, 0);
+	}
+
+	struct timespec nsToTimespec(u64 ns)
+	{
+		struct timespec ts;
+		ts.tv_sec = ns / 1000000000UL;
+		ts.tv_nsec = ns % 1000000000UL;
+		return ts;
+	}
+
+	void* threadEntry(void* arg)
+	{
+		Thread* t = static_cast<Thread*>(arg);
+		t->entry(t->arg);
+		return nullptr;
+	}
+}
+
+Result svcGetThreadPriority(s32* priority, Handle handle)
+{
+	*priority = 0x2C; // default priority of the main thread on the console
+	return 0;
+}
+
+void svcSleepThread(s64 nano)
+{
+	// Zero and negative values are yield requests
+	if (nano <= 0)
+	{
+		sched_yield();
+		return;
+	}
+
+	struct timespec ts = nsToTimespec(nano);
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+// Mutex states: 0 = unlocked, 1 = locked, 2 = locked with (possible) waiters
+void mutexLock(Mutex* m)
+{
+	u32 state = 0;
+	if (__atomic_compare_exchange_n(m, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+
+	if (state != 2)
+		state = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+	while (state != 0)
+	{
+		futex(m, FUTEX_WAIT, 2);
+		state = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+bool mutexTryLock(Mutex* m)
+{
+	u32 state = 0;
+	return __atomic_compare_exchange_n(m, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutexUnlock(Mutex* m)
+{
+	if (__atomic_exchange_n(m, 0, __ATOMIC_RELEASE) == 2)
+		futex(m, FUTEX_WAKE, 1);
+}
+
+Result condvarWaitTimeout(CondVar* c, Mutex* m, u64 timeout)
+{
+	// The sequence number is sampled while the mutex is held, so a wakeup issued after the
+	// mutex is released below makes the futex wait return immediately.
+	u32 seq = __atomic_load_n(c, __ATOMIC_RELAXED);
+	mutexUnlock(m);
+
+	long res;
+	if (timeout == UINT64_MAX)
+		res = futex(c, FUTEX_WAIT, seq);
+	else
+	{
+		struct timespec ts = nsToTimespec(timeout);
+		res = futex(c, FUTEX_WAIT, seq, &ts);
+	}
+	bool timedOut = res != 0 && errno == ETIMEDOUT;
+
+	mutexLock(m);
+	return timedOut ? MAKERESULT(Module_Kernel, KernelError_TimedOut) : 0;
+}
+
+Result condvarWake(CondVar* c, int num)
+{
+	__atomic_add_fetch(c, 1, __ATOMIC_RELEASE);
+	futex(c, FUTEX_WAKE, num > 0 ? num : INT_MAX);
+	return 0;
+}
+
+Result threadCreate(Thread* t, ThreadFunc entry, void* arg, void* stack_mem, size_t stack_sz, int prio, int cpuid)
+{
+	// Priority and core affinity are left to the host scheduler
+	if (stack_mem)
+		return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+	t->handle = 0;
+	t->entry = entry;
+	t->arg = arg;
+	t->stack_sz = stack_sz < size_t(PTHREAD_STACK_MIN) ? size_t(PTHREAD_STACK_MIN) : stack_sz;
+	return 0;
+}
+
+Result threadStart(Thread* t)
+{
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, t->stack_sz);
+
+	pthread_t thread;
+	int res = pthread_create(&thread, &attr, threadEntry, t);
+	pthread_attr_destroy(&attr);
+	if (res != 0)
+		return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+	t->handle = (u64)thread;
+	return 0;
+}
+
+Result threadWaitForExit(Thread* t)
+{
+	if (!t->handle || pthread_join((pthread_t)t->handle, nullptr) != 0)
+		return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+	t->handle = 0;
+	return 0;
+}
+
+Result threadClose(Thread* t)
+{
+	// Threads are joined by threadWaitForExit, so there is nothing left to release here
+	return 0;
+}
+
+u64 armGetSystemTick(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return armNsToTicks(ts.tv_sec * 1000000000UL + ts.tv_nsec);
+}
+
+void armDCacheFlush(void* addr, size_t size)
+{
+	// The null GPU reads memory through the CPU caches
+}
+
+Result errorApplicationCreate(ErrorApplicationConfig* c, const char* dialog_message, const char* fullscreen_message)
+{
+	c->dialog_message = dialog_message;
+	c->fullscreen_message = fullscreen_message;
+	c->errorcode = 0;
+	return 0;
+}
+
+Result errorApplicationShow(ErrorApplicationConfig* c)
+{
+	fprintf(stderr, "[error %u] %s: %s\n", c->errorcode, c->dialog_message, c->fullscreen_message);
+	return 0;
+}
+
+void diagAbortWithResult(Result res)
+{
+	fprintf(stderr, "aborted with result 0x%x (module %u, description %u)\n", res, R_MODULE(res), R_DESCRIPTION(res));
+	abort();
+}
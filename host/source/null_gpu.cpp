@@ -0,0 +1,568 @@
+// Null GPU implementing the libnx Nvidia services used by deko3d on the host.
+// Memory blocks are mapped into a simulated GPU address space, and work submitted to a channel
+// is retired as soon as it is kicked off: the command stream is scanned for semaphore releases
+// and report writes (which are performed immediately), and the channel's syncpoint is advanced.
+// Everything else (draws, dispatches, copies...) is ignored.
+#include <string.h>
+#include <map>
+#include <switch.h>
+
+namespace
+{
+	constexpr u32 s_maxNvMaps = 0x10000;
+	constexpr u32 s_numSyncpoints = 192;
+	constexpr u32 s_firstChannelSyncpoint = 16;
+	constexpr iova_t s_addrSpaceBase = iova_t{1} << 32; // keep 0 and the low 4 GiB unused
+	constexpr iova_t s_addrSpaceEnd = iova_t{1} << 40;
+
+	struct NvMapEntry
+	{
+		void* cpuAddr;
+		u32 size;
+	};
+
+	struct Mapping
+	{
+		u8* cpuAddr;
+		u64 size;
+	};
+
+	// Shadowed methods needed to perform semaphore operations
+	struct ChannelState
+	{
+		bool used;
+		u32 semaphore[3];     // Gpfifo SemaphoreOffset (high, low), SemaphorePayload
+		u32 report[2][3];     // 3D/compute SetReportSemaphoreOffset (high, low), SetReportSemaphorePayload
+	};
+
+	Mutex g_mutex;
+	CondVar g_syncptCondVar;
+	NvMapEntry g_nvMaps[s_maxNvMaps];
+	u32 g_nextNvMap = 1;
+	std::map<iova_t, Mapping> g_mappings;
+	iova_t g_nextIova = s_addrSpaceBase;
+	u32 g_syncpoints[s_numSyncpoints];
+	ChannelState g_channels[s_numSyncpoints];
+	NvHostGpfifoCallback g_gpfifoCallback;
+	void* g_gpfifoCallbackUserData;
+	NvHostStats g_stats;
+
+	// Representative of the Tegra X1 (GM20B); only the fields consumed by deko3d are filled in
+	const nvioctl_gpu_characteristics s_gpuCharacteristics =
+	{
+		.arch = 0x120,
+		.impl = 0xb,
+		.num_gpc = 1,
+		.num_tpc_per_gpc = 2,
+		.sm_arch_sm_version = 0x503,
+		.sm_arch_warp_count = 128,
+	};
+
+	// Representative values, only used by deko3d to size zcull storage
+	const nvioctl_zcull_info s_zcullInfo =
+	{
+		.width_align_pixels = 0x20,
+		.height_align_pixels = 0x20,
+		.pixel_squares_by_aliquots = 0x400,
+		.aliquot_total = 0x800,
+		.region_byte_multiplier = 0x20,
+		.region_header_size = 0xc0,
+		.subregion_header_size = 0x2c0,
+		.subregion_width_align_pixels = 0x20,
+		.subregion_height_align_pixels = 0x40,
+		.subregion_count = 0x10,
+	};
+
+	class Lock
+	{
+	public:
+		Lock() { mutexLock(&g_mutex); }
+		~Lock() { mutexUnlock(&g_mutex); }
+	};
+
+	constexpr Result resultBadParameter()
+	{
+		return MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_BadParameter);
+	}
+
+	// Must be called with the lock held
+	u8* translate(iova_t iova, u64 size)
+	{
+		auto it = g_mappings.upper_bound(iova);
+		if (it != g_mappings.begin())
+		{
+			--it;
+			if (iova + size <= it->first + it->second.size && it->second.cpuAddr)
+				return it->second.cpuAddr + (iova - it->first);
+		}
+		g_stats.num_unmapped_accesses ++;
+		return nullptr;
+	}
+
+	iova_t allocIova(u64 size, u32 pageSize)
+	{
+		iova_t iova = (g_nextIova + pageSize - 1) &~ iova_t(pageSize - 1);
+		if (iova + size > s_addrSpaceEnd)
+			return 0;
+		g_nextIova = iova + size;
+		return iova;
+	}
+
+	u64 getGpuTimestamp()
+	{
+		// The GPU timer runs at 32 times the frequency of the system counter (614.4 MHz)
+		return armGetSystemTick() * 32;
+	}
+
+	u32 applyReduction(u32 op, u32 cur, u32 value)
+	{
+		switch (op)
+		{
+			default:
+			case 0: return cur + value;               // Add
+			case 1: return cur < value ? cur : value; // Min
+			case 2: return cur > value ? cur : value; // Max
+			case 3: return cur >= value ? 0 : cur+1;  // Inc
+			case 4: return (cur == 0 || cur > value) ? value : cur-1; // Dec
+			case 5: return cur & value;               // And
+			case 6: return cur | value;               // Or
+			case 7: return cur ^ value;               // Xor
+		}
+	}
+
+	void writeSemaphore(iova_t iova, u32 payload, bool oneWord, bool reduce, u32 reduceOp)
+	{
+		u8* p = translate(iova, oneWord ? 4 : 16);
+		if (!p)
+			return;
+
+		u32* word = reinterpret_cast<u32*>(p);
+		if (reduce)
+			payload = applyReduction(reduceOp, __atomic_load_n(word, __ATOMIC_RELAXED), payload);
+		if (!oneWord)
+		{
+			__atomic_store_n(&word[1], 0, __ATOMIC_RELAXED);
+			__atomic_store_n(reinterpret_cast<u64*>(p + 8), getGpuTimestamp(), __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(word, payload, __ATOMIC_RELEASE);
+		g_stats.num_semaphore_releases ++;
+	}
+
+	void writeReport(iova_t iova, bool oneWord)
+	{
+		// Counters never advance on the null GPU, so only the timestamp carries information
+		u8* p = translate(iova, oneWord ? 4 : 16);
+		if (!p)
+			return;
+
+		if (oneWord)
+			__atomic_store_n(reinterpret_cast<u32*>(p), 0, __ATOMIC_RELEASE);
+		else
+		{
+			__atomic_store_n(reinterpret_cast<u64*>(p + 8), getGpuTimestamp(), __ATOMIC_RELAXED);
+			__atomic_store_n(reinterpret_cast<u64*>(p), 0, __ATOMIC_RELEASE);
+		}
+		g_stats.num_reports ++;
+	}
+
+	constexpr iova_t makeIova(u32 high, u32 low)
+	{
+		return (iova_t(high) << 32) | low;
+	}
+
+	// Method numbers and fields below are those found in source/maxwell/engine_*.def
+	void executeMethod(ChannelState& ch, u32 subchannel, u32 method, u32 value)
+	{
+		if (method >= 0x004 && method <= 0x006)
+			ch.semaphore[method - 0x004] = value;
+		else if (method == 0x007) // Gpfifo Semaphore
+		{
+			u32 op = value & 0x1F;
+			bool oneWord = (value >> 24) & 1;
+			if (op == 2) // Release
+				writeSemaphore(makeIova(ch.semaphore[0], ch.semaphore[1]), ch.semaphore[2], oneWord, false, 0);
+			else if (op == 16) // Reduction
+			{
+				static constexpr u32 s_reductionOps[] = { 1, 2, 7, 5, 6, 0, 3, 4 }; // Gpfifo order -> 3D order
+				writeSemaphore(makeIova(ch.semaphore[0], ch.semaphore[1]), ch.semaphore[2], true, true, s_reductionOps[(value >> 27) & 7]);
+			}
+			// Acquires are always considered satisfied
+		}
+		else if (subchannel <= 1 && method >= 0x6C0 && method <= 0x6C2) // 3D/compute
+			ch.report[subchannel][method - 0x6C0] = value;
+		else if (subchannel <= 1 && method == 0x6C3) // SetReportSemaphore
+		{
+			u32* regs = ch.report[subchannel];
+			iova_t iova = makeIova(regs[0], regs[1]);
+			u32 op = value & 3;
+			bool oneWord = (value >> 28) & 1;
+			if (op == 0) // Release
+				writeSemaphore(iova, regs[2], oneWord, (value >> 3) & 1, (value >> 9) & 7);
+			else if (op == 2) // ReportOnly
+				writeReport(iova, oneWord);
+		}
+	}
+
+	void executeCommands(ChannelState& ch, const u32* cmds, u32 numCmds)
+	{
+		for (u32 i = 0; i < numCmds; )
+		{
+			u32 header = cmds[i++];
+			u32 method = header & 0x1FFF;
+			u32 subchannel = (header >> 13) & 7;
+			u32 arg = (header >> 16) & 0x1FFF;
+			switch (header >> 29)
+			{
+				case 1: // Increasing
+					for (u32 j = 0; j < arg && i < numCmds; j ++)
+						executeMethod(ch, subchannel, method + j, cmds[i++]);
+					break;
+				case 3: // NonIncreasing
+					for (u32 j = 0; j < arg && i < numCmds; j ++)
+						executeMethod(ch, subchannel, method, cmds[i++]);
+					break;
+				case 4: // Inline
+					executeMethod(ch, subchannel, method, arg);
+					break;
+				case 5: // IncreaseOnce
+					for (u32 j = 0; j < arg && i < numCmds; j ++)
+						executeMethod(ch, subchannel, method + (j ? 1 : 0), cmds[i++]);
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	bool syncpointReached(NvFence const& fence)
+	{
+		if (fence.id >= s_numSyncpoints)
+			return true;
+		return s32(__atomic_load_n(&g_syncpoints[fence.id], __ATOMIC_ACQUIRE) - fence.value) >= 0;
+	}
+}
+
+Result nvInitialize(void) { return 0; }
+void nvExit(void) { }
+Result nvGpuInit(void) { return 0; }
+void nvGpuExit(void) { }
+Result nvFenceInit(void) { return 0; }
+void nvFenceExit(void) { }
+Result nvMapInit(void) { return 0; }
+void nvMapExit(void) { }
+
+const nvioctl_gpu_characteristics* nvGpuGetCharacteristics(void)
+{
+	return &s_gpuCharacteristics;
+}
+
+u32 nvGpuGetZcullCtxSize(void)
+{
+	return 0x2000;
+}
+
+const nvioctl_zcull_info* nvGpuGetZcullInfo(void)
+{
+	return &s_zcullInfo;
+}
+
+Result nvFenceWait(NvFence* f, s32 timeout_us)
+{
+	if (syncpointReached(*f))
+		return 0;
+	if (timeout_us == 0)
+		return MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Timeout);
+
+	// The syncpoint can only advance when another thread kicks off work
+	Lock lock;
+	u64 deadline = timeout_us > 0 ? armGetSystemTick() + armNsToTicks(u64(timeout_us) * 1000) : UINT64_MAX;
+	while (!syncpointReached(*f))
+	{
+		u64 now = armGetSystemTick();
+		if (now >= deadline)
+			return MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Timeout);
+		condvarWaitTimeout(&g_syncptCondVar, &g_mutex, deadline == UINT64_MAX ? UINT64_MAX : armTicksToNs(deadline - now));
+	}
+	return 0;
+}
+
+Result nvMultiFenceWait(NvMultiFence* mf, s32 timeout_us)
+{
+	for (u32 i = 0; i < mf->num_fences; i ++)
+	{
+		Result res = nvFenceWait(&mf->fences[i], timeout_us);
+		if (R_FAILED(res))
+			return res;
+	}
+	return 0;
+}
+
+Result nvMapCreate(NvMap* m, void* cpu_addr, u32 size, u32 align, NvKind kind, bool is_cpu_cacheable)
+{
+	Lock lock;
+
+	u32 handle = 0;
+	for (u32 i = 0; i < s_maxNvMaps && !handle; i ++)
+	{
+		u32 candidate = (g_nextNvMap + i) % s_maxNvMaps;
+		if (candidate && !g_nvMaps[candidate].size)
+			handle = candidate;
+	}
+	if (!handle)
+		return MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_InsufficientMemory);
+
+	g_nvMaps[handle] = { cpu_addr, size };
+	g_nextNvMap = handle + 1;
+
+	m->handle = handle;
+	m->id = handle;
+	m->size = size;
+	m->cpu_addr = cpu_addr;
+	m->kind = kind;
+	m->has_init = true;
+	m->is_cpu_cacheable = is_cpu_cacheable;
+	return 0;
+}
+
+void nvMapClose(NvMap* m)
+{
+	Lock lock;
+	if (m->handle < s_maxNvMaps)
+		g_nvMaps[m->handle] = {};
+	*m = {};
+}
+
+Result nvAddressSpaceCreate(NvAddressSpace* a, u32 page_size)
+{
+	a->page_size = page_size;
+	a->has_init = true;
+	return 0;
+}
+
+void nvAddressSpaceClose(NvAddressSpace* a)
+{
+	a->has_init = false;
+}
+
+Result nvAddressSpaceAlloc(NvAddressSpace* a, bool sparse, u64 size, iova_t* iova_out)
+{
+	Lock lock;
+	iova_t iova = allocIova(size, a->page_size);
+	if (!iova)
+		return MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_InsufficientMemory);
+
+	// Reserved ranges have no backing memory until fixed mappings are created within them
+	*iova_out = iova;
+	return 0;
+}
+
+Result nvAddressSpaceFree(NvAddressSpace* a, iova_t iova, u64 size)
+{
+	// Address space is never reused, so that stale GPU addresses always fault
+	return 0;
+}
+
+Result nvAddressSpaceMap(NvAddressSpace* a, u32 nvmap_handle, bool is_gpu_cacheable, NvKind kind, iova_t* iova_out)
+{
+	Lock lock;
+	if (!nvmap_handle || nvmap_handle >= s_maxNvMaps || !g_nvMaps[nvmap_handle].size)
+		return resultBadParameter();
+
+	NvMapEntry const& map = g_nvMaps[nvmap_handle];
+	iova_t iova = allocIova(map.size, a->page_size);
+	if (!iova)
+		return MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_InsufficientMemory);
+
+	g_mappings[iova] = { static_cast<u8*>(map.cpuAddr), map.size };
+	*iova_out = iova;
+	return 0;
+}
+
+Result nvAddressSpaceMapFixed(NvAddressSpace* a, u32 nvmap_handle, bool is_gpu_cacheable, NvKind kind, iova_t iova)
+{
+	Lock lock;
+	if (!nvmap_handle || nvmap_handle >= s_maxNvMaps || !g_nvMaps[nvmap_handle].size)
+		return resultBadParameter();
+
+	NvMapEntry const& map = g_nvMaps[nvmap_handle];
+	g_mappings[iova] = { static_cast<u8*>(map.cpuAddr), map.size };
+	return 0;
+}
+
+Result nvAddressSpaceModify(NvAddressSpace* a, iova_t iova, u64 offset, u64 size, NvKind kind)
+{
+	// Kinds only matter to the memory controller, which the null GPU doesn't model
+	Lock lock;
+	return g_mappings.count(iova) ? 0 : resultBadParameter();
+}
+
+Result nvAddressSpaceUnmap(NvAddressSpace* a, iova_t iova)
+{
+	Lock lock;
+	return g_mappings.erase(iova) ? 0 : resultBadParameter();
+}
+
+Result nvGpuChannelCreate(NvGpuChannel* c, NvAddressSpace* as, NvChannelPriority prio)
+{
+	Lock lock;
+
+	u32 id;
+	for (id = s_firstChannelSyncpoint; id < s_numSyncpoints && g_channels[id].used; id ++);
+	if (id >= s_numSyncpoints)
+		return MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_InsufficientMemory);
+
+	g_channels[id] = {};
+	g_channels[id].used = true;
+
+	memset(c, 0, sizeof(*c));
+	c->has_init = true;
+	c->fence.id = id;
+	c->fence.value = __atomic_load_n(&g_syncpoints[id], __ATOMIC_RELAXED);
+	return 0;
+}
+
+void nvGpuChannelClose(NvGpuChannel* c)
+{
+	if (!c->has_init)
+		return;
+
+	Lock lock;
+	g_channels[c->fence.id].used = false;
+	c->has_init = false;
+}
+
+Result nvGpuChannelZcullBind(NvGpuChannel* c, iova_t iova)
+{
+	return 0;
+}
+
+Result nvGpuChannelAppendEntry(NvGpuChannel* c, iova_t start, size_t num_cmds, u32 flags, u32 flush_threshold)
+{
+	if (flush_threshold >= GPFIFO_QUEUE_SIZE)
+		return resultBadParameter();
+
+	if (c->num_entries >= GPFIFO_QUEUE_SIZE - flush_threshold)
+	{
+		Result res = nvGpuChannelKickoff(c);
+		if (R_FAILED(res))
+			return res;
+	}
+
+	nvioctl_gpfifo_entry& entry = c->entries[c->num_entries++];
+	entry.desc = start;
+	entry.desc32[1] |= flags | (num_cmds << 10);
+	return 0;
+}
+
+Result nvGpuChannelKickoff(NvGpuChannel* c)
+{
+	if (!c->num_entries && !c->fence_incr)
+		return 0;
+
+	Lock lock;
+	ChannelState& ch = g_channels[c->fence.id];
+	for (u32 i = 0; i < c->num_entries; i ++)
+	{
+		nvioctl_gpfifo_entry const& entry = c->entries[i];
+		NvHostGpfifoEntry ent;
+		ent.syncpt_id = c->fence.id;
+		ent.flags = entry.desc32[1] & (GPFIFO_ENTRY_NOT_MAIN | GPFIFO_ENTRY_NO_PREFETCH);
+		ent.iova = entry.desc & ((iova_t{1} << 40) - 1);
+		ent.num_cmds = (entry.desc32[1] >> 10) & 0x1FFFFF;
+		ent.cmds = reinterpret_cast<const u32*>(translate(ent.iova, ent.num_cmds*4));
+
+		// The callback runs unlocked, so that it is free to call other nv* functions
+		if (NvHostGpfifoCallback callback = g_gpfifoCallback)
+		{
+			void* userdata = g_gpfifoCallbackUserData;
+			mutexUnlock(&g_mutex);
+			callback(userdata, &ent);
+			mutexLock(&g_mutex);
+		}
+		if (ent.cmds)
+			executeCommands(ch, ent.cmds, ent.num_cmds);
+
+		g_stats.num_cmd_words += ent.num_cmds;
+	}
+
+	g_stats.num_kickoffs ++;
+	g_stats.num_gpfifo_entries += c->num_entries;
+	c->num_entries = 0;
+
+	// All submitted work is complete
+	c->fence.value += c->fence_incr;
+	c->fence_incr = 0;
+	__atomic_store_n(&g_syncpoints[c->fence.id], c->fence.value, __ATOMIC_RELEASE);
+	condvarWakeAll(&g_syncptCondVar);
+	return 0;
+}
+
+Result nvGpuChannelGetErrorNotification(NvGpuChannel* c, NvNotification* notif)
+{
+	memset(notif, 0, sizeof(*notif));
+	return 0;
+}
+
+Result nvGpuChannelGetErrorInfo(NvGpuChannel* c, NvError* error)
+{
+	memset(error, 0, sizeof(*error));
+	return 0;
+}
+
+bool nwindowIsValid(NWindow* nw)
+{
+	return false;
+}
+
+Result nwindowConfigureBuffer(NWindow* nw, s32 slot, NvGraphicBuffer* buf)
+{
+	return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+}
+
+void nwindowReleaseBuffers(NWindow* nw)
+{
+}
+
+Result nwindowDequeueBuffer(NWindow* nw, s32* out_slot, NvMultiFence* out_fence)
+{
+	return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+}
+
+Result nwindowQueueBuffer(NWindow* nw, s32 slot, const NvMultiFence* fence)
+{
+	return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+}
+
+Result nwindowSetCrop(NWindow* nw, s32 left, s32 top, s32 right, s32 bottom)
+{
+	return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+}
+
+Result nwindowSetTransform(NWindow* nw, u32 transform)
+{
+	return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+}
+
+Result nwindowSetSwapInterval(NWindow* nw, u32 swap_interval)
+{
+	return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+}
+
+void nvHostSetGpfifoCallback(NvHostGpfifoCallback callback, void* userdata)
+{
+	Lock lock;
+	g_gpfifoCallback = callback;
+	g_gpfifoCallbackUserData = userdata;
+}
+
+void nvHostGetStats(NvHostStats* out)
+{
+	Lock lock;
+	*out = g_stats;
+}
+
+void nvHostResetStats(void)
+{
+	Lock lock;
+	g_stats = {};
+}
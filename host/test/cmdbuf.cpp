@@ -0,0 +1,333 @@
+// Checks command buffer recording features against the command words that reach the null GPU:
+// command capture and replay must produce the same gpfifo entries as recording directly, and
+// redundant state filtering must not corrupt the commands following indirect draws, lists
+// calling each other too deeply must be rejected when the call is recorded, and command templates
+// must relocate addresses wherever they appear.
+// Prints one line per failed check and exits with a non-zero status if there were any.
+// Usage: dktest_cmdbuf
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <vector>
+#include "host_context.h"
+
+namespace
+{
+	struct Entry
+	{
+		DkGpuAddr iova;
+		std::vector<uint32_t> cmds;
+	};
+
+	// Capture records (see CmdBuf::CaptureRecord): submission mode 6, magic 0x0DC0 in the method field
+	bool isCaptureRecord(uint32_t header)
+	{
+		return (header >> 29) == 6 && (header & 0x1FFE) == 0x0DC0;
+	}
+
+	unsigned s_numFailures;
+	jmp_buf s_errorJmp;
+	DkResult s_error;
+	std::vector<Entry> s_entries;
+	DkGpuAddr s_cmdMemBase, s_cmdMemEnd, s_filterMemBase, s_filterMemEnd, s_indirect;
+
+	void check(bool cond, const char* what)
+	{
+		if (!cond)
+		{
+			printf("FAILED: %s\n", what);
+			s_numFailures ++;
+		}
+	}
+
+	// Errors are fatal, so the library never gets control back after raising one
+	void debugCallback(void* userData, const char* context, DkResult result, const char* message)
+	{
+		if (result == DkResult_Success)
+			return;
+		s_error = result;
+		longjmp(s_errorJmp, 1);
+	}
+
+	// Errors are raised through the debug callback of the device the object belongs to
+	DkDevice createCheckedDevice()
+	{
+		DkDeviceMaker maker;
+		dkDeviceMakerDefaults(&maker);
+		maker.cbDebug = debugCallback;
+		return dkDeviceCreate(&maker);
+	}
+
+	// Only entries pointing to command buffer memory or to indirect data are kept,
+	// the queue's own entries (fences, setup) are not part of what is being checked
+	void gpfifoCallback(void* userdata, const NvHostGpfifoEntry* entry)
+	{
+		bool isCmdMem = (entry->iova >= s_cmdMemBase && entry->iova < s_cmdMemEnd) ||
+			(entry->iova >= s_filterMemBase && entry->iova < s_filterMemEnd);
+		bool isIndirect = entry->iova >= s_indirect && entry->iova < s_indirect + 0x1000;
+		if (!isCmdMem && !isIndirect)
+			return;
+
+		Entry& e = s_entries.emplace_back();
+		e.iova = entry->iova;
+		if (isCmdMem && entry->cmds)
+			e.cmds.assign(entry->cmds, entry->cmds + entry->num_cmds);
+		else
+			e.cmds.resize(entry->num_cmds);
+	}
+
+	template <typename T>
+	std::vector<Entry> submit(dkhost::Context& ctx, DkCmdBuf cmdBuf, T&& record)
+	{
+		s_entries.clear();
+		record();
+		DkCmdList list = dkCmdBufFinishList(cmdBuf);
+		dkQueueSubmitCommands(ctx.queue, list);
+		dkQueueWaitIdle(ctx.queue);
+		dkCmdBufClear(cmdBuf);
+		return std::move(s_entries);
+	}
+
+	template <typename T>
+	std::vector<Entry> submit(dkhost::Context& ctx, T&& record)
+	{
+		return submit(ctx, ctx.cmdBuf, record);
+	}
+
+	size_t countWords(std::vector<Entry> const& entries)
+	{
+		size_t numWords = 0;
+		for (auto const& e : entries)
+			numWords += e.cmds.size();
+		return numWords;
+	}
+
+	bool sameEntries(std::vector<Entry> const& a, std::vector<Entry> const& b)
+	{
+		if (a.size() != b.size())
+			return false;
+		for (size_t i = 0; i < a.size(); i ++)
+		{
+			bool isIndirect = a[i].iova >= s_indirect && a[i].iova < s_indirect + 0x1000;
+			if (a[i].cmds != b[i].cmds || (isIndirect && a[i].iova != b[i].iova))
+				return false;
+		}
+		return true;
+	}
+
+	void recordIndirectDraws(DkCmdBuf cmdBuf)
+	{
+		dkCmdBufDraw(cmdBuf, DkPrimitive_Triangles, 3, 1, 0, 0);
+		dkCmdBufDrawIndirect(cmdBuf, DkPrimitive_Triangles, s_indirect);
+		dkCmdBufDrawIndirect(cmdBuf, DkPrimitive_Points, s_indirect + sizeof(DkDrawIndirectData));
+		dkCmdBufDraw(cmdBuf, DkPrimitive_Lines, 2, 1, 0, 0);
+	}
+
+	void testCaptureReplay(dkhost::Context& ctx)
+	{
+		auto direct = submit(ctx, [&]{ recordIndirectDraws(ctx.cmdBuf); });
+		check(direct.size() >= 3, "indirect draws are split into several entries");
+
+		// Capturing drops the memory of the command buffer, so a separate one is used
+		DkCmdBufMaker maker;
+		dkCmdBufMakerDefaults(&maker, ctx.device);
+		DkCmdBuf captureBuf = dkCmdBufCreate(&maker);
+
+		static uint32_t storage[1024];
+		dkCmdBufBeginCaptureCmds(captureBuf, storage, 1024);
+		recordIndirectDraws(captureBuf);
+		uint32_t numWords = dkCmdBufEndCaptureCmds(captureBuf);
+		check(numWords && isCaptureRecord(storage[0]), "capture of indirect draws starts with a record");
+
+		auto replayed = submit(ctx, [&]{ dkCmdBufReplayCmds(ctx.cmdBuf, storage, numWords); });
+		check(sameEntries(direct, replayed), "replayed indirect draws match the directly recorded ones");
+
+		// Replaying twice in the same list repeats the whole sequence, raw entries included
+		auto twice = submit(ctx, [&]{ recordIndirectDraws(ctx.cmdBuf); recordIndirectDraws(ctx.cmdBuf); });
+		auto replayedTwice = submit(ctx, [&]{
+			dkCmdBufReplayCmds(ctx.cmdBuf, storage, numWords);
+			dkCmdBufReplayCmds(ctx.cmdBuf, storage, numWords);
+		});
+		check(sameEntries(twice, replayedTwice), "indirect draws replayed twice match the directly recorded ones");
+
+		// Captures made of plain commands are left as is
+		dkCmdBufBeginCaptureCmds(captureBuf, storage, 1024);
+		dkCmdBufDraw(captureBuf, DkPrimitive_Triangles, 3, 1, 0, 0);
+		numWords = dkCmdBufEndCaptureCmds(captureBuf);
+		check(numWords && !isCaptureRecord(storage[0]), "capture without records only holds plain commands");
+
+		dkCmdBufDestroy(captureBuf);
+	}
+
+	void recordIndirectThenState(DkCmdBuf cmdBuf)
+	{
+		DkViewport viewport = { 0.0f, 0.0f, 1280.0f, 720.0f, 0.0f, 1.0f };
+		dkCmdBufDrawIndirect(cmdBuf, DkPrimitive_Triangles, s_indirect);
+		dkCmdBufSetViewports(cmdBuf, 0, &viewport, 1);
+		dkCmdBufSetDepthBias(cmdBuf, 1.0f, 0.0f, 2.0f);
+		dkCmdBufDraw(cmdBuf, DkPrimitive_Triangles, 3, 1, 0, 0);
+		dkCmdBufDrawIndirect(cmdBuf, DkPrimitive_Points, s_indirect + sizeof(DkDrawIndirectData));
+		dkCmdBufSetPointSize(cmdBuf, 4.0f);
+		dkCmdBufSetLineWidth(cmdBuf, 2.0f);
+		dkCmdBufDraw(cmdBuf, DkPrimitive_Lines, 2, 1, 0, 0);
+	}
+
+	void testFilterAfterIndirect(dkhost::Context& ctx)
+	{
+		DkMemBlock filterMem = dkhost::createMemBlock(ctx.device, 0x10000, DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+		s_filterMemBase = dkMemBlockGetGpuAddr(filterMem);
+		s_filterMemEnd = s_filterMemBase + 0x10000;
+
+		DkCmdBufMaker maker;
+		dkCmdBufMakerDefaults(&maker, ctx.device);
+		maker.flags = DkCmdBufFlags_FilterRedundantState;
+		DkCmdBuf filterBuf = dkCmdBufCreate(&maker);
+		dkCmdBufAddMemory(filterBuf, filterMem, 0, 0x10000);
+
+		// Nothing in this sequence is redundant, so filtering must leave it unchanged
+		auto plain = submit(ctx, [&]{ recordIndirectThenState(ctx.cmdBuf); });
+		auto filtered = submit(ctx, filterBuf, [&]{ recordIndirectThenState(filterBuf); });
+		check(sameEntries(plain, filtered), "state written after indirect draws is not corrupted by filtering");
+
+		// Filtering still works once the indirect draw is over
+		auto repeated = submit(ctx, filterBuf, [&]{
+			dkCmdBufDrawIndirect(filterBuf, DkPrimitive_Triangles, s_indirect);
+			dkCmdBufSetDepthBias(filterBuf, 1.0f, 0.0f, 2.0f);
+			dkCmdBufSetDepthBias(filterBuf, 1.0f, 0.0f, 2.0f);
+			dkCmdBufDraw(filterBuf, DkPrimitive_Triangles, 3, 1, 0, 0);
+		});
+		auto single = submit(ctx, filterBuf, [&]{
+			dkCmdBufDrawIndirect(filterBuf, DkPrimitive_Triangles, s_indirect);
+			dkCmdBufSetDepthBias(filterBuf, 1.0f, 0.0f, 2.0f);
+			dkCmdBufDraw(filterBuf, DkPrimitive_Triangles, 3, 1, 0, 0);
+		});
+		check(countWords(repeated) == countWords(single), "redundant state after an indirect draw is filtered");
+
+		dkCmdBufDestroy(filterBuf);
+		dkMemBlockDestroy(filterMem);
+	}
+
+	// Builds a chain of lists, each one calling the previous one
+	DkCmdList recordCallChain(DkCmdBuf cmdBuf, unsigned depth)
+	{
+		DkCmdList list = 0;
+		for (unsigned i = 0; i <= depth; i ++)
+		{
+			dkCmdBufDraw(cmdBuf, DkPrimitive_Triangles, 3, 1, 0, 0);
+			if (list)
+				dkCmdBufCallList(cmdBuf, list);
+			list = dkCmdBufFinishList(cmdBuf);
+		}
+		return list;
+	}
+
+	void testCallDepth(dkhost::Context& ctx)
+	{
+		auto entries = submit(ctx, [&]{
+			DkCmdList list = recordCallChain(ctx.cmdBuf, DK_MAX_CMD_LIST_CALL_DEPTH-1);
+			dkCmdBufCallList(ctx.cmdBuf, list);
+		});
+		check(entries.size() == DK_MAX_CMD_LIST_CALL_DEPTH, "lists nested up to the maximum depth are submitted");
+
+		DkDevice device = createCheckedDevice();
+		DkMemBlock cmdMem = dkhost::createMemBlock(device, 0x10000, DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+		DkCmdBufMaker maker;
+		dkCmdBufMakerDefaults(&maker, device);
+		DkCmdBuf cmdBuf = dkCmdBufCreate(&maker);
+		dkCmdBufAddMemory(cmdBuf, cmdMem, 0, 0x10000);
+
+		DkCmdList list = recordCallChain(cmdBuf, DK_MAX_CMD_LIST_CALL_DEPTH);
+		s_error = DkResult_Success;
+		if (!setjmp(s_errorJmp))
+			dkCmdBufCallList(cmdBuf, list);
+		check(s_error == DkResult_BadInput, "calling a list nested at the maximum depth is rejected");
+		check(!dkCmdBufFinishList(cmdBuf), "rejected calls are not recorded");
+
+		dkCmdBufDestroy(cmdBuf);
+		dkMemBlockDestroy(cmdMem);
+		dkDeviceDestroy(device);
+	}
+
+	void recordBufferBindings(DkCmdBuf cmdBuf, DkGpuAddr storageAddr, DkGpuAddr uniformAddr)
+	{
+		DkBufExtents storage = { storageAddr, 0x100 };
+		dkCmdBufBindStorageBuffers(cmdBuf, DkStage_Fragment, 0, &storage, 1);
+		dkCmdBufBindUniformBuffer(cmdBuf, DkStage_Fragment, 0, uniformAddr, 0x100);
+	}
+
+	void testTemplateAddresses(dkhost::Context& ctx)
+	{
+		// Storage buffer addresses are copied as DkBufExtents (low word first), uniform buffer
+		// addresses are written to methods (high word first)
+		constexpr DkGpuAddr storagePlaceholder = 0x12CAFE0000ULL, uniformPlaceholder = 0x34BEEF0000ULL;
+		DkCmdBufMaker cmdBufMaker;
+		dkCmdBufMakerDefaults(&cmdBufMaker, ctx.device);
+		DkCmdBuf captureBuf = dkCmdBufCreate(&cmdBufMaker);
+		static uint32_t storage[256];
+		dkCmdBufBeginCaptureCmds(captureBuf, storage, 256);
+		recordBufferBindings(captureBuf, storagePlaceholder, uniformPlaceholder);
+		uint32_t numWords = dkCmdBufEndCaptureCmds(captureBuf);
+		dkCmdBufDestroy(captureBuf);
+
+		DkCmdTemplateSlot slots[] =
+		{
+			{ storagePlaceholder, DkCmdTemplateSlotType_Iova },
+			{ uniformPlaceholder, DkCmdTemplateSlotType_Iova },
+		};
+		DkCmdTemplateMaker maker;
+		dkCmdTemplateMakerDefaults(&maker, ctx.device, storage, numWords);
+		maker.pSlots = slots;
+		maker.numSlots = 2;
+		DkCmdTemplate tmpl = dkCmdTemplateCreate(&maker);
+		check(dkCmdTemplateGetNumRelocs(tmpl) == 2, "addresses are found in both word orders");
+
+		DkGpuAddr storageAddr = s_indirect + 0x1000, uniformAddr = s_indirect + 0x2000;
+		uint64_t values[] = { storageAddr, uniformAddr };
+		auto direct = submit(ctx, [&]{ recordBufferBindings(ctx.cmdBuf, storageAddr, uniformAddr); });
+		auto instantiated = submit(ctx, [&]{ dkCmdTemplateInstantiate(tmpl, ctx.cmdBuf, values, 2); });
+		check(sameEntries(direct, instantiated), "instantiated template matches the directly recorded commands");
+		dkCmdTemplateDestroy(tmpl);
+
+		// An address placeholder that is nowhere to be found is an error
+		DkDevice device = createCheckedDevice();
+		DkCmdTemplateSlot missing = { 0x56F00D0000ULL, DkCmdTemplateSlotType_Iova };
+		dkCmdTemplateMakerDefaults(&maker, device, storage, numWords);
+		maker.pSlots = &missing;
+		maker.numSlots = 1;
+		s_error = DkResult_Success;
+		if (!setjmp(s_errorJmp))
+			dkCmdTemplateCreate(&maker);
+		check(s_error == DkResult_BadInput, "templates with missing address placeholders are rejected");
+		dkDeviceDestroy(device);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	static dkhost::Context ctx;
+	dkhost::initContext(ctx, 0x10000, 0x10000, 0x10000);
+	s_cmdMemBase = dkMemBlockGetGpuAddr(ctx.cmdMem);
+	s_cmdMemEnd = s_cmdMemBase + 0x10000;
+	s_indirect = dkMemBlockGetGpuAddr(ctx.dataMem);
+
+	auto* draws = static_cast<DkDrawIndirectData*>(dkMemBlockGetCpuAddr(ctx.dataMem));
+	draws[0] = DkDrawIndirectData{ 3, 1, 0, 0 };
+	draws[1] = DkDrawIndirectData{ 4, 2, 0, 0 };
+
+	nvHostSetGpfifoCallback(gpfifoCallback, nullptr);
+	testCaptureReplay(ctx);
+	testFilterAfterIndirect(ctx);
+	testCallDepth(ctx);
+	testTemplateAddresses(ctx);
+	nvHostSetGpfifoCallback(nullptr, nullptr);
+
+	dkhost::destroyContext(ctx);
+
+	if (s_numFailures)
+	{
+		printf("%u checks failed\n", s_numFailures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
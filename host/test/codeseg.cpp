@@ -0,0 +1,108 @@
+// Checks the best-fit allocation and free extent coalescing of the code segment manager.
+// Runs on the host build, where nvAddressSpaceAlloc hands out a segment from the null GPU.
+// Prints one line per failed check and exits with a non-zero status if there were any.
+// Usage: dktest_codeseg
+#include <stdio.h>
+#include "dk_device.h"
+
+using namespace dk::detail;
+
+namespace
+{
+	constexpr uint32_t s_pageSize = 0x10000; // big page size, the allocation granularity
+	constexpr uint64_t s_segmentSize = 0x100000000UL;
+
+	unsigned s_numFailures;
+
+	void check(bool cond, const char* what)
+	{
+		if (!cond)
+		{
+			printf("FAILED: %s\n", what);
+			s_numFailures ++;
+		}
+	}
+
+	void checkStats(DkDevice device, uint64_t freeSize, uint64_t largestFreeSize, uint32_t numFreeExtents, const char* what)
+	{
+		DkCodeSegStats stats;
+		dkDeviceGetCodeSegStats(device, &stats);
+		if (stats.freeSize != freeSize || stats.largestFreeSize != largestFreeSize || stats.numFreeExtents != numFreeExtents)
+		{
+			printf("FAILED: %s (free 0x%llx largest 0x%llx extents %u, expected 0x%llx 0x%llx %u)\n", what,
+				(unsigned long long)stats.freeSize, (unsigned long long)stats.largestFreeSize, stats.numFreeExtents,
+				(unsigned long long)freeSize, (unsigned long long)largestFreeSize, numFreeExtents);
+			s_numFailures ++;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	DkDeviceMaker maker;
+	dkDeviceMakerDefaults(&maker);
+	DkDevice device = dkDeviceCreate(&maker);
+	CodeSegMgr& seg = device->getCodeSeg();
+	checkStats(device, s_segmentSize, s_segmentSize, 1, "initial state");
+
+	// Lay out A(1) B(3) C(1) D(2) E(1) pages back to back from the start of the segment
+	DkGpuAddr a, b, c, d, e;
+	check(seg.allocSpace(1*s_pageSize, a), "alloc A");
+	check(seg.allocSpace(3*s_pageSize, b), "alloc B");
+	check(seg.allocSpace(1*s_pageSize, c), "alloc C");
+	check(seg.allocSpace(2*s_pageSize - 0x100, d), "alloc D (rounded up to whole pages)");
+	check(seg.allocSpace(1*s_pageSize, e), "alloc E");
+	check(a == seg.getBase() && b == a + 1*s_pageSize && c == a + 4*s_pageSize &&
+		d == a + 5*s_pageSize && e == a + 7*s_pageSize, "allocations are contiguous");
+
+	uint64_t tail = s_segmentSize - 8*s_pageSize;
+	checkStats(device, tail, tail, 1, "after allocating A-E");
+
+	// Punch a 3-page hole at B and a 2-page hole at D
+	seg.freeSpace(b, 3*s_pageSize);
+	seg.freeSpace(d, 2*s_pageSize);
+	checkStats(device, tail + 5*s_pageSize, tail, 3, "after freeing B and D");
+
+	// Best fit: 2 pages go into D's hole (exact match) even though B's hole comes first
+	DkGpuAddr f, g;
+	check(seg.allocSpace(2*s_pageSize, f), "alloc F");
+	check(f == d, "F takes the exact fit at D");
+	checkStats(device, tail + 3*s_pageSize, tail, 2, "after allocating F");
+
+	// Best fit: 1 page goes into B's hole rather than the much larger tail
+	check(seg.allocSpace(1*s_pageSize, g), "alloc G");
+	check(g == b, "G takes the smallest fit at B");
+	checkStats(device, tail + 2*s_pageSize, tail, 2, "after allocating G");
+
+	// Coalescing with the following extent only: A joins the rest of B's hole
+	seg.freeSpace(a, 1*s_pageSize);
+	seg.freeSpace(g, 1*s_pageSize);
+	checkStats(device, tail + 4*s_pageSize, tail, 2, "after freeing A and G");
+
+	// Coalescing with the preceding extent only
+	seg.freeSpace(c, 1*s_pageSize);
+	seg.freeSpace(f, 2*s_pageSize);
+	checkStats(device, tail + 7*s_pageSize, tail, 2, "after freeing C and F");
+
+	// Coalescing with both neighbours restores a single extent covering the whole segment
+	seg.freeSpace(e, 1*s_pageSize);
+	checkStats(device, s_segmentSize, s_segmentSize, 1, "after freeing everything");
+
+	// A freed extent with no free neighbours gets its own node
+	check(seg.allocSpace(1*s_pageSize, a) && seg.allocSpace(1*s_pageSize, b) && seg.allocSpace(1*s_pageSize, c), "alloc A-C again");
+	seg.freeSpace(b, 1*s_pageSize);
+	checkStats(device, s_segmentSize - 2*s_pageSize, s_segmentSize - 3*s_pageSize, 2, "after freeing the middle extent");
+	seg.freeSpace(a, 1*s_pageSize);
+	seg.freeSpace(c, 1*s_pageSize);
+	checkStats(device, s_segmentSize, s_segmentSize, 1, "after freeing A-C again");
+
+	dkDeviceDestroy(device);
+
+	if (s_numFailures)
+	{
+		printf("%u checks failed\n", s_numFailures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -75,7 +75,9 @@ DK_DECL_HANDLE(Device);
 DK_DECL_HANDLE(MemBlock);
 DK_DECL_OPAQUE(Fence, 8, 64);
 DK_DECL_OPAQUE(Variable, 8, 16);
+DK_DECL_OPAQUE(QueryPool, 8, 32);
 DK_DECL_HANDLE(CmdBuf);
+DK_DECL_HANDLE(CmdMemPool);
 DK_DECL_HANDLE(Queue);
 DK_DECL_OPAQUE(Shader, 8, 128);
 DK_DECL_OPAQUE(ImageLayout, 8, 128);
@@ -83,6 +85,8 @@ DK_DECL_OPAQUE(Image, 8, 128);
 DK_DECL_OPAQUE(ImageDescriptor, 4, 32);
 DK_DECL_OPAQUE(SamplerDescriptor, 4, 32);
 DK_DECL_HANDLE(Swapchain);
+DK_DECL_HANDLE(PipelineState);
+DK_DECL_HANDLE(CmdTemplate);
 
 #undef DK_DECL_HANDLE
 #undef DK_DECL_OPAQUE
@@ -110,6 +114,8 @@ typedef void (*DkDebugFunc)(void* userData, const char* context, DkResult result
 typedef DkResult (*DkAllocFunc)(void* userData, size_t alignment, size_t size, void** out);
 typedef void (*DkFreeFunc)(void* userData, void* mem);
 typedef void (*DkCmdBufAddMemFunc)(void* userData, DkCmdBuf cmdbuf, size_t minReqSize);
+typedef void (*DkFenceCallbackFunc)(void* userData);
+typedef void (*DkTraceWriteFunc)(void* userData, const char* data, size_t size);
 
 enum
 {
@@ -137,9 +143,17 @@ DK_CONSTEXPR void dkDeviceMakerDefaults(DkDeviceMaker* maker)
 	maker->flags = DkDeviceFlags_DepthZeroToOne | DkDeviceFlags_OriginUpperLeft;
 }
 
+typedef struct DkCodeSegStats
+{
+	uint64_t freeSize;        // free bytes in the segment used by code memory blocks
+	uint64_t largestFreeSize; // size of the largest free extent (i.e. the largest code memory block that can still be created)
+	uint32_t numFreeExtents;  // number of free extents, a measure of fragmentation
+} DkCodeSegStats;
+
 #define DK_MEMBLOCK_ALIGNMENT 0x1000
 #define DK_CMDMEM_ALIGNMENT 4
 #define DK_QUEUE_MIN_CMDMEM_SIZE 0x10000
+#define DK_CMDMEMPOOL_DEFAULT_CHUNK_SIZE 0x4000
 #define DK_PER_WARP_SCRATCH_MEM_ALIGNMENT 0x200
 #define DK_NUM_UNIFORM_BUFS 16
 #define DK_NUM_STORAGE_BUFS 16
@@ -148,6 +162,7 @@ DK_CONSTEXPR void dkDeviceMakerDefaults(DkDeviceMaker* maker)
 #define DK_UNIFORM_BUF_ALIGNMENT 0x100
 #define DK_UNIFORM_BUF_MAX_SIZE 0x10000
 #define DK_DEFAULT_MAX_COMPUTE_CONCURRENT_JOBS 128
+#define DK_DEFAULT_MAX_QUEUED_GPFIFO_ENTRIES 64
 #define DK_SHADER_CODE_ALIGNMENT 0x100
 #define DK_SHADER_CODE_UNUSABLE_SIZE 0x400
 #define DK_IMAGE_DESCRIPTOR_ALIGNMENT 0x20
@@ -159,6 +174,11 @@ DK_CONSTEXPR void dkDeviceMakerDefaults(DkDeviceMaker* maker)
 #define DK_MAX_VERTEX_BUFFERS 16
 #define DK_IMAGE_LINEAR_STRIDE_ALIGNMENT 32
 
+// Maximum nesting depth of dkCmdBufCallList calls in a list passed to dkQueueSubmitCommands or
+// dkCmdBufFlattenList. Lists nested more deeply are rejected as a whole, before any of their
+// commands are submitted or flattened.
+#define DK_MAX_CMD_LIST_CALL_DEPTH 32
+
 enum
 {
 	DkMemAccess_None = 0U,
@@ -221,11 +241,40 @@ typedef enum DkPipelinePos
 	DkPipelinePos_Bottom     = 2,
 } DkPipelinePos;
 
+typedef enum DkQueryType
+{
+	DkQueryType_Timestamp     = 0, // one value per query: GPU time in nanoseconds (dkCmdBufWriteTimestamp)
+	DkQueryType_SamplesPassed = 1, // one value per query: samples passing the depth/stencil tests (dkCmdBufBeginQuery/EndQuery)
+	DkQueryType_ZcullStats    = 2, // four values per query: zcull statistics counters (dkCmdBufBeginQuery/EndQuery)
+} DkQueryType;
+
+// GPU timestamps are counted in ticks of a 614.4 MHz clock
+static inline uint64_t dkGpuTicksToNs(uint64_t ticks)
+{
+	return (ticks / 384) * 625 + (ticks % 384) * 625 / 384;
+}
+
+enum
+{
+	DkCmdBufFlags_FilterRedundantState = 1U << 0, // Drops 3D state writes whose value matches the last one recorded in the same command list.
+	DkCmdBufFlags_EnableStats          = 1U << 1, // Keeps the counters returned by dkCmdBufGetStats.
+};
+
+typedef struct DkCmdBufStats
+{
+	uint64_t numCmdWords;               // command words written
+	uint64_t numCtrlBytes;              // control memory bytes written
+	uint64_t numGpfifoEntries;          // gpfifo entries appended (including coalesced ones)
+	uint64_t numCoalescedGpfifoEntries; // gpfifo entries merged into the previous one
+} DkCmdBufStats;
+
 typedef struct DkCmdBufMaker
 {
 	DkDevice device;
 	void* userData;
 	DkCmdBufAddMemFunc cbAddMem;
+	uint32_t flags;
+	DkCmdMemPool cmdMemPool; // if set, command memory is obtained from the pool (userData/cbAddMem are ignored)
 } DkCmdBufMaker;
 
 DK_CONSTEXPR void dkCmdBufMakerDefaults(DkCmdBufMaker* maker, DkDevice device)
@@ -233,6 +282,8 @@ DK_CONSTEXPR void dkCmdBufMakerDefaults(DkCmdBufMaker* maker, DkDevice device)
 	maker->device = device;
 	maker->userData = NULL;
 	maker->cbAddMem = NULL;
+	maker->flags = 0;
+	maker->cmdMemPool = NULL;
 }
 
 enum
@@ -245,6 +296,29 @@ enum
 	DkQueueFlags_PrioMask     = 3U << 2,
 	DkQueueFlags_EnableZcull  = 0U << 4,
 	DkQueueFlags_DisableZcull = 1U << 4,
+
+	// Allows dkQueueSubmitCommands, dkQueueWaitFence, dkQueueSignalFence and dkCmdMemPoolSignalFence to
+	// be called from any thread. These operations are queued up and processed in order (per calling
+	// thread; operations from different threads are ordered by the time they were queued) by the next
+	// call to any other queue function, such as dkQueueFlush. Fences passed to dkQueueSignalFence are
+	// pending until then (as are the fences signaled by dkCmdMemPoolSignalFence, which the pool owns);
+	// waiting on a pending fence first waits for it to be processed. The fence object passed to
+	// dkQueueSignalFence is written to at that point, so it must stay alive (and must not be moved)
+	// until the queue has processed the operation. Fences passed to dkQueueWaitFence are copied
+	// (unless they are still pending, in which case the above applies). The same goes for pending
+	// fences passed to dkFenceOnComplete, which are only read once the queue has processed them.
+	DkQueueFlags_ThreadSafeSubmit = 1U << 5,
+
+	// Implies DkQueueFlags_ThreadSafeSubmit. dkQueueFlush hands the work over to a per-queue worker
+	// thread (which also takes care of any waits for GPU progress) and returns immediately.
+	DkQueueFlags_BackgroundKickoff = 1U << 6,
+
+	// Adjusts the flush threshold and the size of fence slices at runtime, based on how often the
+	// queue needs to wait for the GPU (see dkQueueGetAdaptiveFlushStats)
+	DkQueueFlags_AdaptiveFlush = 1U << 7,
+
+	// Keeps the counters returned by dkQueueGetStats
+	DkQueueFlags_EnableStats = 1U << 8,
 };
 
 typedef struct DkQueueMaker
@@ -255,6 +329,8 @@ typedef struct DkQueueMaker
 	uint32_t flushThreshold;
 	uint32_t perWarpScratchMemorySize;
 	uint32_t maxConcurrentComputeJobs;
+	uint32_t maxQueuedGpfifoEntries;
+	int32_t workerCpuId; // core used by the DkQueueFlags_BackgroundKickoff worker thread (-2 = process default)
 } DkQueueMaker;
 
 DK_CONSTEXPR void dkQueueMakerDefaults(DkQueueMaker* maker, DkDevice device)
@@ -267,8 +343,54 @@ DK_CONSTEXPR void dkQueueMakerDefaults(DkQueueMaker* maker, DkDevice device)
 	maker->flushThreshold = DK_QUEUE_MIN_CMDMEM_SIZE/8;
 	maker->perWarpScratchMemorySize = 4*DK_PER_WARP_SCRATCH_MEM_ALIGNMENT;
 	maker->maxConcurrentComputeJobs = DK_DEFAULT_MAX_COMPUTE_CONCURRENT_JOBS;
+	maker->maxQueuedGpfifoEntries = DK_DEFAULT_MAX_QUEUED_GPFIFO_ENTRIES;
+	maker->workerCpuId = -2;
 }
 
+typedef struct DkQueueAdaptiveFlushStats
+{
+	uint32_t flushThreshold;        // current flush threshold
+	uint32_t perFenceSliceSize;     // current amount of command memory covered by each internal fence
+	uint32_t numMemoryStalls;       // flushes after which the queue had to wait for command memory
+	uint32_t numFenceRingStalls;    // flushes after which the queue had to wait for a free fence slice
+	uint32_t numThresholdIncreases;
+	uint32_t numThresholdDecreases;
+	uint32_t numSliceIncreases;
+	uint32_t numSliceDecreases;
+} DkQueueAdaptiveFlushStats;
+
+typedef struct DkQueueStats
+{
+	uint64_t numCmdWords;               // command words written by the queue itself
+	uint64_t numGpfifoEntries;          // entries appended to the GPU channel
+	uint64_t numCoalescedGpfifoEntries; // internal entries merged into the previous one instead of being appended
+	uint64_t numFlushes;
+	uint64_t numKickoffs;
+	uint64_t fenceRingWaitNs;           // time spent blocked waiting for a free internal fence
+	uint64_t cmdMemWaitNs;              // time spent blocked waiting for command memory
+	uint32_t maxInFlightCmdMem;         // high-water mark of command memory in use by the GPU
+	uint32_t numComputeJobRingWraps;    // times reusing compute job slots had to wait for their previous jobs to complete
+	uint64_t numComputeJobWords;        // compute job (QMD + driver constbuf) words uploaded by dispatches
+	uint32_t numComputeJobRelaunches;   // dispatches that launched the previous compute job again instead of uploading it
+} DkQueueStats;
+
+// Each queue has a timeline: a 64-bit value that is incremented every time the queue signals
+// (dkQueueSignalTimeline or dkQueueSignalFence), and which is reached once the GPU has
+// processed all work submitted before the corresponding signal. dkWaitTimelines can only wait
+// for values that have already been signaled: passing a value the queue hasn't signaled yet
+// makes it fail right away with DkResult_Fail, it does not wait for the signal to happen.
+typedef struct DkTimelinePoint
+{
+	DkQueue queue;
+	uint64_t value;
+} DkTimelinePoint;
+
+typedef enum DkTimelineWait
+{
+	DkTimelineWait_All = 0, // wait until all points are reached
+	DkTimelineWait_Any = 1, // wait until at least one point is reached
+} DkTimelineWait;
+
 typedef struct DkShaderMaker
 {
 	DkMemBlock codeMem;
@@ -1198,12 +1320,88 @@ DK_CONSTEXPR void dkSwapchainMakerDefaults(DkSwapchainMaker* maker, DkDevice dev
 	maker->numImages = numImages;
 }
 
+typedef struct DkPipelineStateMaker
+{
+	DkDevice device;
+	DkRasterizerState const* rasterizer;
+	DkMultisampleState const* multisample;
+	DkColorState const* color;
+	DkColorWriteState const* colorWrite;
+	DkBlendState const* pBlendStates;
+	uint32_t numBlendStates;
+	DkDepthStencilState const* depthStencil;
+} DkPipelineStateMaker;
+
+DK_CONSTEXPR void dkPipelineStateMakerDefaults(DkPipelineStateMaker* maker, DkDevice device)
+{
+	maker->device = device;
+	maker->rasterizer = NULL;
+	maker->multisample = NULL;
+	maker->color = NULL;
+	maker->colorWrite = NULL;
+	maker->pBlendStates = NULL;
+	maker->numBlendStates = 0;
+	maker->depthStencil = NULL;
+}
+
+typedef enum DkCmdTemplateSlotType
+{
+	DkCmdTemplateSlotType_Value = 0, // 32-bit value written as a single command word
+	DkCmdTemplateSlotType_Iova  = 1, // GPU address written as a pair of command words, (high, low) or (low, high) as in DkBufExtents
+} DkCmdTemplateSlotType;
+
+typedef struct DkCmdTemplateSlot
+{
+	uint64_t placeholder; // Value used in place of the actual one while recording the commands (must occur only once, and addresses must occur)
+	DkCmdTemplateSlotType type;
+} DkCmdTemplateSlot;
+
+typedef struct DkCmdTemplateMaker
+{
+	DkDevice device;
+	const uint32_t* words;
+	uint32_t numWords;
+	DkCmdTemplateSlot const* pSlots;
+	uint32_t numSlots;
+} DkCmdTemplateMaker;
+
+DK_CONSTEXPR void dkCmdTemplateMakerDefaults(DkCmdTemplateMaker* maker, DkDevice device, const uint32_t* words, uint32_t numWords)
+{
+	maker->device = device;
+	maker->words = words;
+	maker->numWords = numWords;
+	maker->pSlots = NULL;
+	maker->numSlots = 0;
+}
+
+typedef struct DkCmdMemPoolMaker
+{
+	DkDevice device;
+	uint32_t size;
+	uint32_t chunkSize;
+} DkCmdMemPoolMaker;
+
+DK_CONSTEXPR void dkCmdMemPoolMakerDefaults(DkCmdMemPoolMaker* maker, DkDevice device, uint32_t size)
+{
+	maker->device = device;
+	maker->size = size;
+	maker->chunkSize = DK_CMDMEMPOOL_DEFAULT_CHUNK_SIZE;
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Each thread recording trace events gets its own ring holding its most recent 4096 events.
+// Rings are kept until the process exits, even if their thread is gone: only the first 32
+// threads to record events are traced, events from any further threads are dropped.
+void dkTraceSetEnabled(bool enable);
+void dkTraceClear(void);
+void dkTraceExportJson(DkTraceWriteFunc func, void* userData);
+
 DkDevice dkDeviceCreate(DkDeviceMaker const* maker);
 void dkDeviceDestroy(DkDevice obj);
+void dkDeviceGetCodeSegStats(DkDevice obj, DkCodeSegStats* stats);
 
 DkMemBlock dkMemBlockCreate(DkMemBlockMaker const* maker);
 void dkMemBlockDestroy(DkMemBlock obj);
@@ -1213,15 +1411,22 @@ uint32_t dkMemBlockGetSize(DkMemBlock obj);
 DkResult dkMemBlockFlushCpuCache(DkMemBlock obj, uint32_t offset, uint32_t size);
 
 DkResult dkFenceWait(DkFence* obj, int64_t timeout_ns);
+void dkFenceOnComplete(DkFence* obj, DkDevice device, DkFenceCallbackFunc callback, void* userData);
 
 void dkVariableInitialize(DkVariable* obj, DkMemBlock mem, uint32_t offset);
 uint32_t dkVariableRead(DkVariable const* obj);
 void dkVariableSignal(DkVariable const* obj, DkVarOp op, uint32_t value);
 
+uint32_t dkQueryPoolCalcSize(DkQueryType type, uint32_t numQueries);
+void dkQueryPoolInitialize(DkQueryPool* obj, DkMemBlock mem, uint32_t offset, DkQueryType type, uint32_t numQueries);
+void dkQueryPoolReset(DkQueryPool const* obj, uint32_t first, uint32_t count);
+bool dkQueryPoolGetResults(DkQueryPool const* obj, uint32_t first, uint32_t count, uint64_t results[]);
+
 DkCmdBuf dkCmdBufCreate(DkCmdBufMaker const* maker);
 void dkCmdBufDestroy(DkCmdBuf obj);
 void dkCmdBufAddMemory(DkCmdBuf obj, DkMemBlock mem, uint32_t offset, uint32_t size);
 DkCmdList dkCmdBufFinishList(DkCmdBuf obj);
+DkCmdList dkCmdBufFlattenList(DkCmdBuf obj, DkCmdList list);
 void dkCmdBufClear(DkCmdBuf obj);
 void dkCmdBufBeginCaptureCmds(DkCmdBuf obj, uint32_t* storage, uint32_t max_words);
 uint32_t dkCmdBufEndCaptureCmds(DkCmdBuf obj);
@@ -1229,8 +1434,13 @@ void dkCmdBufReplayCmds(DkCmdBuf obj, const uint32_t* words, uint32_t num_words)
 void dkCmdBufCallList(DkCmdBuf obj, DkCmdList list);
 void dkCmdBufWaitFence(DkCmdBuf obj, DkFence* fence);
 void dkCmdBufSignalFence(DkCmdBuf obj, DkFence* fence, bool flush);
+uint64_t dkCmdBufGetElidedWordCount(DkCmdBuf obj);
+void dkCmdBufGetStats(DkCmdBuf obj, DkCmdBufStats* stats);
 void dkCmdBufWaitVariable(DkCmdBuf obj, DkVariable const* var, DkVarCompareOp op, uint32_t value);
 void dkCmdBufSignalVariable(DkCmdBuf obj, DkVariable const* var, DkVarOp op, uint32_t value, DkPipelinePos pos);
+void dkCmdBufWriteTimestamp(DkCmdBuf obj, DkQueryPool const* pool, uint32_t index, DkPipelinePos pos);
+void dkCmdBufBeginQuery(DkCmdBuf obj, DkQueryPool const* pool, uint32_t index);
+void dkCmdBufEndQuery(DkCmdBuf obj, DkQueryPool const* pool, uint32_t index);
 void dkCmdBufBarrier(DkCmdBuf obj, DkBarrier mode, uint32_t invalidateFlags);
 void dkCmdBufBindShaders(DkCmdBuf obj, uint32_t stageMask, DkShader const* const shaders[], uint32_t numShaders);
 void dkCmdBufBindUniformBuffers(DkCmdBuf obj, DkStage stage, uint32_t firstId, DkBufExtents const buffers[], uint32_t numBuffers);
@@ -1246,6 +1456,7 @@ void dkCmdBufBindColorState(DkCmdBuf obj, DkColorState const* state);
 void dkCmdBufBindColorWriteState(DkCmdBuf obj, DkColorWriteState const* state);
 void dkCmdBufBindBlendStates(DkCmdBuf obj, uint32_t firstId, DkBlendState const states[], uint32_t numStates);
 void dkCmdBufBindDepthStencilState(DkCmdBuf obj, DkDepthStencilState const* state);
+void dkCmdBufBindPipelineState(DkCmdBuf obj, DkPipelineState state);
 void dkCmdBufBindVtxAttribState(DkCmdBuf obj, DkVtxAttribState const attribs[], uint32_t numAttribs);
 void dkCmdBufBindVtxBufferState(DkCmdBuf obj, DkVtxBufferState const buffers[], uint32_t numBuffers);
 void dkCmdBufBindVtxBuffers(DkCmdBuf obj, uint32_t firstId, DkBufExtents const buffers[], uint32_t numBuffers);
@@ -1282,6 +1493,10 @@ void dkCmdBufDraw(DkCmdBuf obj, DkPrimitive prim, uint32_t vertexCount, uint32_t
 void dkCmdBufDrawIndirect(DkCmdBuf obj, DkPrimitive prim, DkGpuAddr indirect);
 void dkCmdBufDrawIndexed(DkCmdBuf obj, DkPrimitive prim, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance);
 void dkCmdBufDrawIndexedIndirect(DkCmdBuf obj, DkPrimitive prim, DkGpuAddr indirect);
+void dkCmdBufMultiDraw(DkCmdBuf obj, DkPrimitive prim, DkDrawIndirectData const draws[], uint32_t numDraws);
+void dkCmdBufMultiDrawIndexed(DkCmdBuf obj, DkPrimitive prim, DkDrawIndexedIndirectData const draws[], uint32_t numDraws);
+void dkCmdBufDrawIndirectCount(DkCmdBuf obj, DkPrimitive prim, DkGpuAddr indirect, uint32_t stride, DkGpuAddr countAddr, uint32_t maxDrawCount);
+void dkCmdBufDrawIndexedIndirectCount(DkCmdBuf obj, DkPrimitive prim, DkGpuAddr indirect, uint32_t stride, DkGpuAddr countAddr, uint32_t maxDrawCount);
 void dkCmdBufDispatchCompute(DkCmdBuf obj, uint32_t numGroupsX, uint32_t numGroupsY, uint32_t numGroupsZ);
 void dkCmdBufDispatchComputeIndirect(DkCmdBuf obj, DkGpuAddr indirect);
 void dkCmdBufPushConstants(DkCmdBuf obj, DkGpuAddr uboAddr, uint32_t uboSize, uint32_t offset, uint32_t size, const void* data);
@@ -1301,6 +1516,11 @@ void dkQueueSignalFence(DkQueue obj, DkFence* fence, bool flush);
 void dkQueueSubmitCommands(DkQueue obj, DkCmdList cmds);
 void dkQueueFlush(DkQueue obj);
 void dkQueueWaitIdle(DkQueue obj);
+void dkQueueGetAdaptiveFlushStats(DkQueue obj, DkQueueAdaptiveFlushStats* stats);
+void dkQueueGetStats(DkQueue obj, DkQueueStats* stats);
+uint64_t dkQueueSignalTimeline(DkQueue obj, bool flush);
+uint64_t dkQueueGetCompletedValue(DkQueue obj);
+DkResult dkWaitTimelines(DkTimelinePoint const points[], uint32_t numPoints, DkTimelineWait mode, int64_t timeout_ns);
 int dkQueueAcquireImage(DkQueue obj, DkSwapchain swapchain);
 void dkQueuePresentImage(DkQueue obj, DkSwapchain swapchain, int imageSlot);
 
@@ -1327,6 +1547,18 @@ void dkSwapchainAcquireImage(DkSwapchain obj, int* imageSlot, DkFence* fence);
 void dkSwapchainSetCrop(DkSwapchain obj, int32_t left, int32_t top, int32_t right, int32_t bottom);
 void dkSwapchainSetSwapInterval(DkSwapchain obj, uint32_t interval);
 
+DkPipelineState dkPipelineStateCreate(DkPipelineStateMaker const* maker);
+void dkPipelineStateDestroy(DkPipelineState obj);
+
+DkCmdTemplate dkCmdTemplateCreate(DkCmdTemplateMaker const* maker);
+void dkCmdTemplateDestroy(DkCmdTemplate obj);
+uint32_t dkCmdTemplateGetNumRelocs(DkCmdTemplate obj);
+void dkCmdTemplateInstantiate(DkCmdTemplate obj, DkCmdBuf cmdBuf, uint64_t const slotValues[], uint32_t numSlotValues);
+
+DkCmdMemPool dkCmdMemPoolCreate(DkCmdMemPoolMaker const* maker);
+void dkCmdMemPoolDestroy(DkCmdMemPool obj);
+void dkCmdMemPoolSignalFence(DkCmdMemPool obj, DkQueue queue, bool flush);
+
 static inline void dkCmdBufBindUniformBuffer(DkCmdBuf obj, DkStage stage, uint32_t id, DkGpuAddr bufAddr, uint32_t bufSize)
 {
 	DkBufExtents ext = { bufAddr, bufSize };
@@ -149,6 +149,7 @@ namespace dk
 	struct Device : public detail::Handle<::DkDevice>
 	{
 		DK_HANDLE_COMMON_MEMBERS(Device);
+		void getCodeSegStats(DkCodeSegStats& stats);
 	};
 
 	struct MemBlock : public detail::Handle<::DkMemBlock>
@@ -164,6 +165,7 @@ namespace dk
 	{
 		DK_OPAQUE_COMMON_MEMBERS(Fence);
 		DkResult wait(int64_t timeout_ns = -1);
+		void onComplete(DkDevice device, DkFenceCallbackFunc callback, void* userData);
 	};
 
 	struct Variable : public detail::Opaque<::DkVariable>
@@ -174,11 +176,21 @@ namespace dk
 		void signal(DkVarOp op, uint32_t value) const;
 	};
 
+	struct QueryPool : public detail::Opaque<::DkQueryPool>
+	{
+		DK_OPAQUE_COMMON_MEMBERS(QueryPool);
+		static uint32_t calcSize(DkQueryType type, uint32_t numQueries);
+		void initialize(DkMemBlock mem, uint32_t offset, DkQueryType type, uint32_t numQueries);
+		void reset(uint32_t first, uint32_t count) const;
+		bool getResults(uint32_t first, uint32_t count, uint64_t results[]) const;
+	};
+
 	struct CmdBuf : public detail::Handle<::DkCmdBuf>
 	{
 		DK_HANDLE_COMMON_MEMBERS(CmdBuf);
 		void addMemory(DkMemBlock mem, uint32_t offset, uint32_t size);
 		DkCmdList finishList();
+		DkCmdList flattenList(DkCmdList list);
 		void clear();
 		void beginCaptureCmds(uint32_t* storage, uint32_t max_words);
 		uint32_t endCaptureCmds();
@@ -186,8 +198,13 @@ namespace dk
 		void callList(DkCmdList list);
 		void waitFence(DkFence& fence);
 		void signalFence(DkFence& fence, bool flush = false);
+		uint64_t getElidedWordCount();
+		void getStats(DkCmdBufStats& stats);
 		void waitVariable(DkVariable const& var, DkVarCompareOp op, uint32_t value);
 		void signalVariable(DkVariable const& var, DkVarOp op, uint32_t value, DkPipelinePos pos = DkPipelinePos_Bottom);
+		void writeTimestamp(DkQueryPool const& pool, uint32_t index, DkPipelinePos pos = DkPipelinePos_Bottom);
+		void beginQuery(DkQueryPool const& pool, uint32_t index);
+		void endQuery(DkQueryPool const& pool, uint32_t index);
 		void barrier(DkBarrier mode, uint32_t invalidateFlags);
 		void bindShaders(uint32_t stageMask, detail::ArrayProxy<DkShader const* const> shaders);
 		void bindUniformBuffer(DkStage stage, uint32_t id, DkGpuAddr bufAddr, uint32_t bufSize);
@@ -205,6 +222,7 @@ namespace dk
 		void bindColorWriteState(DkColorWriteState const& state);
 		void bindBlendStates(uint32_t id, detail::ArrayProxy<DkBlendState const> states);
 		void bindDepthStencilState(DkDepthStencilState const& state);
+		void bindPipelineState(DkPipelineState state);
 		void bindVtxAttribState(detail::ArrayProxy<DkVtxAttribState const> attribs);
 		void bindVtxBufferState(detail::ArrayProxy<DkVtxBufferState const> buffers);
 		void bindVtxBuffer(uint32_t id, DkGpuAddr bufAddr, uint32_t bufSize);
@@ -243,6 +261,10 @@ namespace dk
 		void drawIndirect(DkPrimitive prim, DkGpuAddr indirect);
 		void drawIndexed(DkPrimitive prim, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance);
 		void drawIndexedIndirect(DkPrimitive prim, DkGpuAddr indirect);
+		void multiDraw(DkPrimitive prim, detail::ArrayProxy<DkDrawIndirectData const> draws);
+		void multiDrawIndexed(DkPrimitive prim, detail::ArrayProxy<DkDrawIndexedIndirectData const> draws);
+		void drawIndirectCount(DkPrimitive prim, DkGpuAddr indirect, uint32_t stride, DkGpuAddr countAddr, uint32_t maxDrawCount);
+		void drawIndexedIndirectCount(DkPrimitive prim, DkGpuAddr indirect, uint32_t stride, DkGpuAddr countAddr, uint32_t maxDrawCount);
 		void dispatchCompute(uint32_t numGroupsX, uint32_t numGroupsY, uint32_t numGroupsZ);
 		void dispatchComputeIndirect(DkGpuAddr indirect);
 		void pushConstants(DkGpuAddr uboAddr, uint32_t uboSize, uint32_t offset, uint32_t size, const void* data);
@@ -264,6 +286,11 @@ namespace dk
 		void submitCommands(DkCmdList cmds);
 		void flush();
 		void waitIdle();
+		void getAdaptiveFlushStats(DkQueueAdaptiveFlushStats& stats);
+		void getStats(DkQueueStats& stats);
+		uint64_t signalTimeline(bool flush = false);
+		uint64_t getCompletedValue();
+		static DkResult waitTimelines(detail::ArrayProxy<DkTimelinePoint const> points, DkTimelineWait mode = DkTimelineWait_All, int64_t timeout_ns = -1);
 		int acquireImage(DkSwapchain swapchain);
 		void presentImage(DkSwapchain swapchain, int imageSlot);
 	};
@@ -298,6 +325,24 @@ namespace dk
 		void setSwapInterval(uint32_t interval);
 	};
 
+	struct PipelineState : public detail::Handle<::DkPipelineState>
+	{
+		DK_HANDLE_COMMON_MEMBERS(PipelineState);
+	};
+
+	struct CmdTemplate : public detail::Handle<::DkCmdTemplate>
+	{
+		DK_HANDLE_COMMON_MEMBERS(CmdTemplate);
+		uint32_t getNumRelocs();
+		void instantiate(DkCmdBuf cmdBuf, detail::ArrayProxy<uint64_t const> slotValues);
+	};
+
+	struct CmdMemPool : public detail::Handle<::DkCmdMemPool>
+	{
+		DK_HANDLE_COMMON_MEMBERS(CmdMemPool);
+		void signalFence(DkQueue queue, bool flush = false);
+	};
+
 	struct DeviceMaker : public ::DkDeviceMaker
 	{
 		DeviceMaker() noexcept : DkDeviceMaker{} { ::dkDeviceMakerDefaults(this); }
@@ -326,6 +371,8 @@ namespace dk
 		CmdBufMaker(DkDevice device) noexcept : DkCmdBufMaker{} { ::dkCmdBufMakerDefaults(this, device); }
 		CmdBufMaker& setUserData(void* userData) noexcept { this->userData = userData; return *this; }
 		CmdBufMaker& setCbAddMem(DkCmdBufAddMemFunc cbAddMem) noexcept { this->cbAddMem = cbAddMem; return *this; }
+		CmdBufMaker& setFlags(uint32_t flags) noexcept { this->flags = flags; return *this; }
+		CmdBufMaker& setCmdMemPool(DkCmdMemPool cmdMemPool) noexcept { this->cmdMemPool = cmdMemPool; return *this; }
 		CmdBuf create() const;
 	};
 
@@ -337,6 +384,8 @@ namespace dk
 		QueueMaker& setFlushThreshold(uint32_t flushThreshold) noexcept { this->flushThreshold = flushThreshold; return *this; }
 		QueueMaker& setPerWarpScratchMemorySize(uint32_t perWarpScratchMemorySize) noexcept { this->perWarpScratchMemorySize = perWarpScratchMemorySize; return *this; }
 		QueueMaker& setMaxConcurrentComputeJobs(uint32_t maxConcurrentComputeJobs) noexcept { this->maxConcurrentComputeJobs = maxConcurrentComputeJobs; return *this; }
+		QueueMaker& setMaxQueuedGpfifoEntries(uint32_t maxQueuedGpfifoEntries) noexcept { this->maxQueuedGpfifoEntries = maxQueuedGpfifoEntries; return *this; }
+		QueueMaker& setWorkerCpuId(int32_t workerCpuId) noexcept { this->workerCpuId = workerCpuId; return *this; }
 		Queue create() const;
 	};
 
@@ -554,6 +603,32 @@ namespace dk
 		Swapchain create() const;
 	};
 
+	struct PipelineStateMaker : public ::DkPipelineStateMaker
+	{
+		PipelineStateMaker(DkDevice device) noexcept : DkPipelineStateMaker{} { ::dkPipelineStateMakerDefaults(this, device); }
+		PipelineStateMaker& setRasterizerState(DkRasterizerState const* state) noexcept { this->rasterizer = state; return *this; }
+		PipelineStateMaker& setMultisampleState(DkMultisampleState const* state) noexcept { this->multisample = state; return *this; }
+		PipelineStateMaker& setColorState(DkColorState const* state) noexcept { this->color = state; return *this; }
+		PipelineStateMaker& setColorWriteState(DkColorWriteState const* state) noexcept { this->colorWrite = state; return *this; }
+		PipelineStateMaker& setBlendStates(DkBlendState const states[], uint32_t numStates) noexcept { this->pBlendStates = states; this->numBlendStates = numStates; return *this; }
+		PipelineStateMaker& setDepthStencilState(DkDepthStencilState const* state) noexcept { this->depthStencil = state; return *this; }
+		PipelineState create() const;
+	};
+
+	struct CmdTemplateMaker : public ::DkCmdTemplateMaker
+	{
+		CmdTemplateMaker(DkDevice device, const uint32_t* words, uint32_t numWords) noexcept : DkCmdTemplateMaker{} { ::dkCmdTemplateMakerDefaults(this, device, words, numWords); }
+		CmdTemplateMaker& setSlots(DkCmdTemplateSlot const slots[], uint32_t numSlots) noexcept { this->pSlots = slots; this->numSlots = numSlots; return *this; }
+		CmdTemplate create() const;
+	};
+
+	struct CmdMemPoolMaker : public ::DkCmdMemPoolMaker
+	{
+		CmdMemPoolMaker(DkDevice device, uint32_t size) noexcept : DkCmdMemPoolMaker{} { ::dkCmdMemPoolMakerDefaults(this, device, size); }
+		CmdMemPoolMaker& setChunkSize(uint32_t chunkSize) noexcept { this->chunkSize = chunkSize; return *this; }
+		CmdMemPool create() const;
+	};
+
 	inline Device DeviceMaker::create() const
 	{
 		return Device{::dkDeviceCreate(this)};
@@ -565,6 +640,11 @@ namespace dk
 		_clear();
 	}
 
+	inline void Device::getCodeSegStats(DkCodeSegStats& stats)
+	{
+		::dkDeviceGetCodeSegStats(*this, &stats);
+	}
+
 	inline MemBlock MemBlockMaker::create() const
 	{
 		return MemBlock{::dkMemBlockCreate(this)};
@@ -601,6 +681,11 @@ namespace dk
 		return ::dkFenceWait(this, timeout_ns);
 	}
 
+	inline void Fence::onComplete(DkDevice device, DkFenceCallbackFunc callback, void* userData)
+	{
+		::dkFenceOnComplete(this, device, callback, userData);
+	}
+
 	inline void Variable::initialize(DkMemBlock mem, uint32_t offset)
 	{
 		::dkVariableInitialize(this, mem, offset);
@@ -616,6 +701,26 @@ namespace dk
 		::dkVariableSignal(this, op, value);
 	}
 
+	inline uint32_t QueryPool::calcSize(DkQueryType type, uint32_t numQueries)
+	{
+		return ::dkQueryPoolCalcSize(type, numQueries);
+	}
+
+	inline void QueryPool::initialize(DkMemBlock mem, uint32_t offset, DkQueryType type, uint32_t numQueries)
+	{
+		::dkQueryPoolInitialize(this, mem, offset, type, numQueries);
+	}
+
+	inline void QueryPool::reset(uint32_t first, uint32_t count) const
+	{
+		::dkQueryPoolReset(this, first, count);
+	}
+
+	inline bool QueryPool::getResults(uint32_t first, uint32_t count, uint64_t results[]) const
+	{
+		return ::dkQueryPoolGetResults(this, first, count, results);
+	}
+
 	inline CmdBuf CmdBufMaker::create() const
 	{
 		return CmdBuf{::dkCmdBufCreate(this)};
@@ -637,6 +742,11 @@ namespace dk
 		return ::dkCmdBufFinishList(*this);
 	}
 
+	inline DkCmdList CmdBuf::flattenList(DkCmdList list)
+	{
+		return ::dkCmdBufFlattenList(*this, list);
+	}
+
 	inline void CmdBuf::clear()
 	{
 		::dkCmdBufClear(*this);
@@ -672,6 +782,16 @@ namespace dk
 		return ::dkCmdBufSignalFence(*this, &fence, flush);
 	}
 
+	inline uint64_t CmdBuf::getElidedWordCount()
+	{
+		return ::dkCmdBufGetElidedWordCount(*this);
+	}
+
+	inline void CmdBuf::getStats(DkCmdBufStats& stats)
+	{
+		::dkCmdBufGetStats(*this, &stats);
+	}
+
 	inline void CmdBuf::waitVariable(DkVariable const& var, DkVarCompareOp op, uint32_t value)
 	{
 		::dkCmdBufWaitVariable(*this, &var, op, value);
@@ -682,6 +802,21 @@ namespace dk
 		::dkCmdBufSignalVariable(*this, &var, op, value, pos);
 	}
 
+	inline void CmdBuf::writeTimestamp(DkQueryPool const& pool, uint32_t index, DkPipelinePos pos)
+	{
+		::dkCmdBufWriteTimestamp(*this, &pool, index, pos);
+	}
+
+	inline void CmdBuf::beginQuery(DkQueryPool const& pool, uint32_t index)
+	{
+		::dkCmdBufBeginQuery(*this, &pool, index);
+	}
+
+	inline void CmdBuf::endQuery(DkQueryPool const& pool, uint32_t index)
+	{
+		::dkCmdBufEndQuery(*this, &pool, index);
+	}
+
 	inline void CmdBuf::barrier(DkBarrier mode, uint32_t invalidateFlags)
 	{
 		::dkCmdBufBarrier(*this, mode, invalidateFlags);
@@ -767,6 +902,11 @@ namespace dk
 		::dkCmdBufBindDepthStencilState(*this, &state);
 	}
 
+	inline void CmdBuf::bindPipelineState(DkPipelineState state)
+	{
+		::dkCmdBufBindPipelineState(*this, state);
+	}
+
 	inline void CmdBuf::bindVtxAttribState(detail::ArrayProxy<DkVtxAttribState const> attribs)
 	{
 		::dkCmdBufBindVtxAttribState(*this, attribs.data(), attribs.size());
@@ -960,6 +1100,26 @@ namespace dk
 		::dkCmdBufDrawIndexedIndirect(*this, prim, indirect);
 	}
 
+	inline void CmdBuf::multiDraw(DkPrimitive prim, detail::ArrayProxy<DkDrawIndirectData const> draws)
+	{
+		::dkCmdBufMultiDraw(*this, prim, draws.data(), draws.size());
+	}
+
+	inline void CmdBuf::multiDrawIndexed(DkPrimitive prim, detail::ArrayProxy<DkDrawIndexedIndirectData const> draws)
+	{
+		::dkCmdBufMultiDrawIndexed(*this, prim, draws.data(), draws.size());
+	}
+
+	inline void CmdBuf::drawIndirectCount(DkPrimitive prim, DkGpuAddr indirect, uint32_t stride, DkGpuAddr countAddr, uint32_t maxDrawCount)
+	{
+		::dkCmdBufDrawIndirectCount(*this, prim, indirect, stride, countAddr, maxDrawCount);
+	}
+
+	inline void CmdBuf::drawIndexedIndirectCount(DkPrimitive prim, DkGpuAddr indirect, uint32_t stride, DkGpuAddr countAddr, uint32_t maxDrawCount)
+	{
+		::dkCmdBufDrawIndexedIndirectCount(*this, prim, indirect, stride, countAddr, maxDrawCount);
+	}
+
 	inline void CmdBuf::dispatchCompute(uint32_t numGroupsX, uint32_t numGroupsY, uint32_t numGroupsZ)
 	{
 		::dkCmdBufDispatchCompute(*this, numGroupsX, numGroupsY, numGroupsZ);
@@ -1051,6 +1211,31 @@ namespace dk
 		::dkQueueWaitIdle(*this);
 	}
 
+	inline void Queue::getAdaptiveFlushStats(DkQueueAdaptiveFlushStats& stats)
+	{
+		::dkQueueGetAdaptiveFlushStats(*this, &stats);
+	}
+
+	inline void Queue::getStats(DkQueueStats& stats)
+	{
+		::dkQueueGetStats(*this, &stats);
+	}
+
+	inline uint64_t Queue::signalTimeline(bool flush)
+	{
+		return ::dkQueueSignalTimeline(*this, flush);
+	}
+
+	inline uint64_t Queue::getCompletedValue()
+	{
+		return ::dkQueueGetCompletedValue(*this);
+	}
+
+	inline DkResult Queue::waitTimelines(detail::ArrayProxy<DkTimelinePoint const> points, DkTimelineWait mode, int64_t timeout_ns)
+	{
+		return ::dkWaitTimelines(points.data(), points.size(), mode, timeout_ns);
+	}
+
 	inline int Queue::acquireImage(DkSwapchain swapchain)
 	{
 		return ::dkQueueAcquireImage(*this, swapchain);
@@ -1148,9 +1333,60 @@ namespace dk
 		::dkSwapchainSetSwapInterval(*this, interval);
 	}
 
+	inline PipelineState PipelineStateMaker::create() const
+	{
+		return PipelineState{::dkPipelineStateCreate(this)};
+	}
+
+	inline void PipelineState::destroy()
+	{
+		::dkPipelineStateDestroy(*this);
+		_clear();
+	}
+
+	inline CmdTemplate CmdTemplateMaker::create() const
+	{
+		return CmdTemplate{::dkCmdTemplateCreate(this)};
+	}
+
+	inline void CmdTemplate::destroy()
+	{
+		::dkCmdTemplateDestroy(*this);
+		_clear();
+	}
+
+	inline uint32_t CmdTemplate::getNumRelocs()
+	{
+		return ::dkCmdTemplateGetNumRelocs(*this);
+	}
+
+	inline void CmdTemplate::instantiate(DkCmdBuf cmdBuf, detail::ArrayProxy<uint64_t const> slotValues)
+	{
+		::dkCmdTemplateInstantiate(*this, cmdBuf, slotValues.data(), slotValues.size());
+	}
+
+	inline CmdMemPool CmdMemPoolMaker::create() const
+	{
+		return CmdMemPool{::dkCmdMemPoolCreate(this)};
+	}
+
+	inline void CmdMemPool::destroy()
+	{
+		::dkCmdMemPoolDestroy(*this);
+		_clear();
+	}
+
+	inline void CmdMemPool::signalFence(DkQueue queue, bool flush)
+	{
+		::dkCmdMemPoolSignalFence(*this, queue, flush);
+	}
+
 	using UniqueDevice = detail::UniqueHandle<Device>;
 	using UniqueMemBlock = detail::UniqueHandle<MemBlock>;
 	using UniqueCmdBuf = detail::UniqueHandle<CmdBuf>;
 	using UniqueQueue = detail::UniqueHandle<Queue>;
 	using UniqueSwapchain = detail::UniqueHandle<Swapchain>;
+	using UniquePipelineState = detail::UniqueHandle<PipelineState>;
+	using UniqueCmdTemplate = detail::UniqueHandle<CmdTemplate>;
+	using UniqueCmdMemPool = detail::UniqueHandle<CmdMemPool>;
 }
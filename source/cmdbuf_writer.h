@@ -36,6 +36,9 @@ namespace dk::detail
 		{
 			if (m_dirty)
 			{
+				// Commands written since the last flush start at the cmdbuf's current position
+				if (m_cmdBuf->m_stateShadow)
+					m_pos = m_cmdBuf->filterStateCmds(m_cmdBuf->m_cmdPos, m_pos);
 				m_cmdBuf->m_cmdPos = m_pos;
 				if (doInvalidate)
 					invalidate();
@@ -53,21 +56,30 @@ namespace dk::detail
 
 		void split(uint32_t flags = CtrlCmdGpfifoEntry::AutoKick)
 		{
-			flush();
+			// Signing off may write capture records, so the position needs to be refetched afterwards
+			flush(true);
 			m_cmdBuf->signOffGpfifoEntry(flags);
 		}
 
+		CtrlCmdHeader* addCtrl(size_t size)
+		{
+			split();
+			return m_cmdBuf->appendCtrlCmd(size);
+		}
+
 		template <typename T>
 		T* addCtrl()
 		{
-			split();
-			return static_cast<T*>(m_cmdBuf->appendCtrlCmd(sizeof(T)));
+			return static_cast<T*>(addCtrl(sizeof(T)));
 		}
 
 		void addRaw(DkGpuAddr iova, uint32_t numCmds, uint32_t flags)
 		{
 			split();
 			m_cmdBuf->appendRawGpfifoEntry(iova, numCmds, flags);
+
+			// Raw entries may write any state
+			m_cmdBuf->invalidateStateShadow(true);
 		}
 
 		void addRawData(const void* data, uint32_t size)
@@ -37,17 +37,23 @@ bool CodeSegMgr::allocSpace(uint32_t size, DkGpuAddr& out_addr)
 	uint32_t numPages = (size + bigPageSize - 1) / bigPageSize;
 	MutexHolder m{m_mutex};
 
-	// Find a node in the list with enough space.
-	Node *node;
-	for (node = m_nodeList.m_next; node != &m_nodeList; node = node->m_next)
-		if (node->m_numPages >= numPages)
-			break;
+	// Find the smallest node in the list with enough space (best fit).
+	// In case of a tie the node with the lowest offset wins, since the list is sorted.
+	Node *node = nullptr;
+	for (Node *pos = m_nodeList.m_next; pos != &m_nodeList; pos = pos->m_next)
+	{
+		if (pos->m_numPages < numPages || (node && pos->m_numPages >= node->m_numPages))
+			continue;
+		node = pos;
+		if (node->m_numPages == numPages)
+			break; // Can't do any better than an exact match
+	}
 
-	// Bail out if we reached the end of the list before finding a suitable node.
-	if (node == &m_nodeList)
+	// Bail out if there is no suitable node.
+	if (!node)
 		return false;
 
-	out_addr = m_segmentIova + bigPageSize*node->m_offset;
+	out_addr = m_segmentIova + uint64_t(bigPageSize)*node->m_offset;
 	if (node->m_numPages == numPages)
 	{
 		// Sizes match exactly, so remove and free this node
@@ -67,9 +73,67 @@ bool CodeSegMgr::allocSpace(uint32_t size, DkGpuAddr& out_addr)
 void CodeSegMgr::freeSpace(DkGpuAddr addr, uint32_t size) noexcept
 {
 	uint32_t bigPageSize = getDevice()->getGpuInfo().bigPageSize;
+	uint32_t offset = (addr - m_segmentIova) / bigPageSize;
 	uint32_t numPages = (size + bigPageSize - 1) / bigPageSize;
 	MutexHolder m{m_mutex};
-	// TODO
-	(void)bigPageSize;
-	(void)numPages;
+
+	// Find the first node past the freed extent, and the node preceding it.
+	Node *next;
+	for (next = m_nodeList.m_next; next != &m_nodeList; next = next->m_next)
+		if (next->m_offset > offset)
+			break;
+	Node *prev = next->m_prev;
+
+	bool mergePrev = prev != &m_nodeList && (prev->m_offset + prev->m_numPages) == offset;
+	bool mergeNext = next != &m_nodeList && (offset + numPages) == next->m_offset;
+
+	if (mergePrev && mergeNext)
+	{
+		// The freed extent fills the gap between both neighbours, so join all three
+		prev->m_numPages += numPages + next->m_numPages;
+		unlinkNode(next);
+		freeNode(next);
+	}
+	else if (mergePrev)
+	{
+		// Grow the preceding node
+		prev->m_numPages += numPages;
+	}
+	else if (mergeNext)
+	{
+		// Extend the following node downwards
+		next->m_offset    = offset;
+		next->m_numPages += numPages;
+	}
+	else
+	{
+		// Insert a new node in between
+		Node *node = allocNode();
+		if (!node)
+		{
+			// Out of memory - the best we can do is leaking the space
+			DK_WARNING("unable to reclaim code segment space (offset 0x%x, %u pages)", offset, numPages);
+			return;
+		}
+
+		node->m_offset   = offset;
+		node->m_numPages = numPages;
+		linkNode(node, prev);
+	}
+}
+
+void CodeSegMgr::getStats(DkCodeSegStats& out) noexcept
+{
+	uint32_t bigPageSize = getDevice()->getGpuInfo().bigPageSize;
+	MutexHolder m{m_mutex};
+
+	out = {};
+	for (Node *pos = m_nodeList.m_next; pos != &m_nodeList; pos = pos->m_next)
+	{
+		uint64_t extentSize = uint64_t(bigPageSize)*pos->m_numPages;
+		out.freeSize += extentSize;
+		if (extentSize > out.largestFreeSize)
+			out.largestFreeSize = extentSize;
+		out.numFreeExtents ++;
+	}
 }
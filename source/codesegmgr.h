@@ -5,6 +5,7 @@ namespace dk::detail
 {
 	class CodeSegMgr : public ObjBase
 	{
+		// Free extents, sorted by offset and never adjacent to each other
 		struct Node
 		{
 			uint32_t m_offset;
@@ -21,6 +22,9 @@ namespace dk::detail
 
 		Node* allocNode()
 		{
+			// Reuse the embedded root node if it is not currently in the list
+			if (!m_root.m_numPages)
+				return &m_root;
 			return (Node*)allocMem(sizeof(Node));
 		}
 
@@ -28,6 +32,8 @@ namespace dk::detail
 		{
 			if (node != &m_root)
 				freeMem(node);
+			else
+				m_root.m_numPages = 0;
 		}
 
 		void linkNode(Node* node, Node* after = nullptr)
@@ -56,6 +62,7 @@ namespace dk::detail
 
 		bool allocSpace(uint32_t size, DkGpuAddr& out_addr) noexcept;
 		void freeSpace(DkGpuAddr addr, uint32_t size) noexcept;
+		void getStats(DkCodeSegStats& out) noexcept;
 
 		constexpr DkGpuAddr getBase() const noexcept { return m_segmentIova; }
 		constexpr uint32_t calcOffset(DkGpuAddr addr) const noexcept
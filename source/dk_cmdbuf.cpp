@@ -1,5 +1,6 @@
 #include "dk_cmdbuf.h"
 #include "dk_memblock.h"
+#include "dk_cmdmempool.h"
 #include "cmdbuf_writer.h"
 
 using namespace maxwell;
@@ -10,11 +11,18 @@ CmdBuf::~CmdBuf()
 	if (m_hasFlushFunc)
 		return;
 
+	if (m_memPool)
+		m_memPool->detach(this);
+
 	// Make sure all used chunks get transferred to the free list
 	clear();
+	freeCtrlChunks(m_ctrlChunkFree);
+}
 
+void CmdBuf::freeCtrlChunks(CtrlMemChunk* list)
+{
 	CtrlMemChunk *cur, *next;
-	for (cur = m_ctrlChunkFree; cur; cur = next)
+	for (cur = list; cur; cur = next)
 	{
 		next = cur->m_next;
 		freeMem(cur);
@@ -32,11 +40,29 @@ void CmdBuf::addMemory(DkMemBlock mem, uint32_t offset, uint32_t size)
 	m_cmdEnd = m_cmdStart + size / sizeof(CmdWord) - m_numReservedWords;
 }
 
+void CmdBuf::releaseMemory()
+{
+	signOffGpfifoEntry();
+	m_cmdChunkStartIova = 0;
+	m_cmdStartIova = 0;
+	m_cmdChunkStart = nullptr;
+	m_cmdStart = nullptr;
+	m_cmdPos = nullptr;
+	m_cmdEnd = nullptr;
+}
+
 DkCmdList CmdBuf::finishList()
 {
 	// Sign off any remaining GPU commands
 	signOffGpfifoEntry();
 
+	// The next list may be submitted after other lists that modify state
+	invalidateStateShadow();
+
+	// Pool chunks used by the list can now be covered by the pool's next fence
+	if (m_memPool)
+		m_memPool->finishList(this);
+
 	// Retrieve the beginning of the control command list
 	// If nothing was ever recorded then we just return a null list
 	DkCmdList list = DkCmdList(m_ctrlStart);
@@ -48,9 +74,13 @@ DkCmdList CmdBuf::finishList()
 	retCmd->type = CtrlCmdHeader::Return;
 	m_ctrlPos = retCmd+1;
 
+	// Store the nesting depth of the list in its first command, for lists calling this one
+	static_cast<CtrlCmdHeader*>(m_ctrlStart)->callDepth = m_ctrlCallDepth;
+
 	// Reset internal variables
 	m_ctrlGpfifo = nullptr;
 	m_ctrlStart = nullptr;
+	m_ctrlCallDepth = 0;
 
 	// If we've used up all available control memory in this chunk, just clear it out and move on
 	if (m_ctrlPos >= m_ctrlEnd)
@@ -62,13 +92,107 @@ DkCmdList CmdBuf::finishList()
 	return list;
 }
 
+bool CmdBuf::addListCall(DkCmdList list)
+{
+	// Nesting depth is checked while recording, so that submitting lists doesn't need to walk them
+	unsigned depth = list ? 1 + GetCtrlListCallDepth(list) : 0;
+	if (depth > s_maxCtrlCallDepth)
+	{
+		DK_ERROR(DkResult_BadInput, "command list calls nested too deeply");
+		return false;
+	}
+	if (depth > m_ctrlCallDepth)
+		m_ctrlCallDepth = depth;
+	return true;
+}
+
+DkCmdList CmdBuf::flattenList(DkCmdList list)
+{
+	// Walk the list the same way as Queue::submitCommands does, inlining all jumps and calls.
+	// Gpfifo entries get appended one by one, which merges them into as few GpfifoList commands
+	// as possible (and coalesces adjacent entries).
+	if (!CheckCtrlCallDepth(reinterpret_cast<CtrlCmdHeader const*>(list)))
+	{
+		DK_ERROR(DkResult_BadInput, "command list calls nested too deeply");
+		return 0;
+	}
+
+	CtrlCmdHeader const* callStack[s_maxCtrlCallDepth];
+	unsigned callDepth = 0;
+
+	CtrlCmdHeader const *cur, *next;
+	for (cur = reinterpret_cast<CtrlCmdHeader*>(list); cur; cur = next)
+	{
+		switch (cur->type)
+		{
+			default:
+			case CtrlCmdHeader::Return:
+				next = callDepth ? callStack[--callDepth] : nullptr;
+				break;
+			case CtrlCmdHeader::Jump:
+			case CtrlCmdHeader::Call:
+			{
+				auto* cmd = static_cast<CtrlCmdJumpCall const*>(cur);
+				next = cmd->ptr;
+				if (cur->type == CtrlCmdHeader::Call)
+				{
+					if (!next)
+						next = cmd+1;
+					else
+						callStack[callDepth++] = cmd+1; // depth checked above
+				}
+				break;
+			}
+			case CtrlCmdHeader::GpfifoList:
+			{
+				auto* entries = reinterpret_cast<CtrlCmdGpfifoEntry const*>(cur+1);
+				for (uint32_t i = 0; i < cur->arg; i ++)
+					if (!appendRawGpfifoEntry(entries[i].iova, entries[i].numCmds, entries[i].flags))
+						return 0;
+				next = reinterpret_cast<CtrlCmdHeader const*>(entries+cur->arg);
+				break;
+			}
+			case CtrlCmdHeader::WaitFence:
+			case CtrlCmdHeader::SignalFence:
+			case CtrlCmdHeader::ComputeBindShader ... CtrlCmdHeader::ComputeDispatchIndirect:
+			{
+				size_t size = GetCtrlCmdSize(cur);
+				CtrlCmdHeader* cmd = appendCtrlCmd(size);
+				if (!cmd)
+					return 0;
+				memcpy(cmd, cur, size);
+				next = reinterpret_cast<CtrlCmdHeader const*>((char const*)cur + size);
+				break;
+			}
+		}
+	}
+
+	return finishList();
+}
+
 void CmdBuf::clear()
 {
-	// Transfer all used chunks into the free list
 	if (m_ctrlChunkCur)
 	{
-		m_ctrlChunkCur->m_next = m_ctrlChunkFree;
-		m_ctrlChunkFree = m_ctrlChunkCur;
+		if (!m_ctrlChunkCur->m_next)
+		{
+			// A single chunk was used - transfer it into the free list, and make sure it is picked up again
+			m_ctrlNextChunkSize = m_ctrlChunkCur->m_size;
+			m_ctrlChunkCur->m_next = m_ctrlChunkFree;
+			m_ctrlChunkFree = m_ctrlChunkCur;
+		}
+		else
+		{
+			// Several chunks were needed - release them all in bulk (along with any free chunks), and size
+			// the next chunk after the observed usage so that subsequent recordings fit in contiguous memory
+			size_t totalSize = 0;
+			for (CtrlMemChunk* cur = m_ctrlChunkCur; cur; cur = cur->m_next)
+				totalSize += cur->m_size;
+			freeCtrlChunks(m_ctrlChunkCur);
+			freeCtrlChunks(m_ctrlChunkFree);
+			m_ctrlChunkFree = nullptr;
+			m_ctrlNextChunkSize = totalSize;
+		}
 		m_ctrlChunkCur = nullptr;
 	}
 
@@ -77,14 +201,19 @@ void CmdBuf::clear()
 	m_ctrlStart = nullptr;
 	m_ctrlPos = nullptr;
 	m_ctrlEnd = nullptr;
+	m_ctrlCallDepth = 0;
 
-	// Reset command memory back to the beginning of the chunk added by the last addMemory call
-	if (m_cmdChunkStart)
+	// Reset command memory back to the beginning of the chunk added by the last addMemory call.
+	// Pool memory is never rewound, since earlier commands in the chunk may still be in flight;
+	// instead, the chunk is reclaimed along with the rest of the memory covered by a pool fence.
+	if (m_cmdChunkStart && !m_memPool)
 	{
 		m_cmdStartIova = m_cmdChunkStartIova;
 		m_cmdStart = m_cmdChunkStart;
 		m_cmdPos = m_cmdChunkStart;
 	}
+
+	invalidateStateShadow(true);
 }
 
 void CmdBuf::beginCapture(uint32_t* storage, uint32_t max_words)
@@ -92,24 +221,150 @@ void CmdBuf::beginCapture(uint32_t* storage, uint32_t max_words)
 	clear();
 
 	m_isCapturing = true;
-	m_cmdChunkStart = nullptr;
-	m_cmdStart = (CmdWord*)storage;
+	m_cmdChunkStart = (CmdWord*)storage;
+	m_cmdStart = m_cmdChunkStart;
 	m_cmdPos = m_cmdStart;
 	m_cmdEnd = m_cmdPos + max_words;
+	m_captureRunSize = nullptr;
+
+	// The Start record carries the size of the first run (it is removed again if no other record follows)
+	if (max_words >= 2)
+		appendCaptureRecord(CaptureRecord::Start, 0);
 }
 
 uint32_t CmdBuf::endCapture()
 {
-	uint32_t ret = m_cmdPos - m_cmdStart;
+	uint32_t ret = m_cmdPos - m_cmdChunkStart;
+
+	if (m_captureRunSize)
+	{
+		*m_captureRunSize = m_cmdPos - m_cmdStart;
+
+		// Plain commands are left as is, so that they can also be used without replaying them
+		if (m_captureRunSize == &m_cmdChunkStart[1].i)
+		{
+			memmove(m_cmdChunkStart, m_cmdChunkStart+2, (ret-2)*sizeof(CmdWord));
+			ret -= 2;
+		}
+		m_captureRunSize = nullptr;
+	}
 
 	m_isCapturing = false;
+	m_cmdChunkStart = nullptr;
 	m_cmdStart = nullptr;
 	m_cmdPos = nullptr;
 	m_cmdEnd = nullptr;
 
+	// Captured commands can be replayed anywhere, so they must not depend on later ones (or vice versa)
+	invalidateStateShadow(true);
+
 	return ret;
 }
 
+void* CmdBuf::appendCaptureRecord(uint32_t type, size_t size)
+{
+	// Payloads are written in place by the caller and may contain 64-bit fields,
+	// so they are aligned to 8 bytes by inserting a padding word if needed
+	uint32_t numWords = (size + sizeof(CmdWord) - 1) / sizeof(CmdWord);
+	uint32_t padding = numWords && ((uintptr_t)(m_cmdPos+2) & 7) ? 1 : 0;
+	if ((m_cmdPos + 2 + padding + numWords) > m_cmdEnd)
+	{
+		DK_ERROR(DkResult_BadState, "out of capture memory");
+		return nullptr;
+	}
+
+	// Close the run of plain commands following the previous record
+	if (m_captureRunSize)
+		*m_captureRunSize = m_cmdPos - m_cmdStart;
+
+	m_cmdPos->i = MakeCmdHeader(SubmissionMode(CaptureRecord::s_mode), 1 + padding + numWords, type, CaptureRecord::s_magic | padding);
+	m_cmdPos[1].i = 0;
+	m_captureRunSize = &m_cmdPos[1].i;
+	if (padding)
+		m_cmdPos[2].i = 0;
+
+	void* ret = m_cmdPos + 2 + padding;
+	m_cmdPos += 2 + padding + numWords;
+	m_cmdStart = m_cmdPos;
+	return ret;
+}
+
+void CmdBuf::replay(const uint32_t* words, uint32_t numWords)
+{
+	CmdBufWriter w{this};
+
+	auto copyRun = [&](const uint32_t* run, uint32_t size)
+	{
+		if (size)
+		{
+			w.reserve(size);
+			w.addRawData(run, size*sizeof(uint32_t));
+		}
+	};
+
+	// Captures without records are plain commands
+	if (!numWords || !CaptureRecord::isRecord(words[0]))
+	{
+		copyRun(words, numWords);
+		return;
+	}
+
+	// Otherwise the capture alternates between records and the runs of plain commands following them
+	for (uint32_t pos = 0; pos < numWords; )
+	{
+		uint32_t header = words[pos];
+		uint32_t arg = (header >> 16) & 0x1FFF;
+		uint32_t padding = header & 1;
+		if (!CaptureRecord::isRecord(header) || arg < 1 + padding || arg >= numWords - pos || words[pos+1] > numWords - pos - 1 - arg)
+		{
+			DK_ERROR(DkResult_BadInput, "malformed command capture");
+			return;
+		}
+
+		uint32_t runSize = words[pos+1];
+		const uint32_t* payload = &words[pos + 2 + padding];
+		uint32_t payloadSize = (arg - 1 - padding)*sizeof(uint32_t);
+		switch ((header >> 13) & 7)
+		{
+			case CaptureRecord::Split:
+				w.split(payload[0]);
+				break;
+
+			case CaptureRecord::RawEntry:
+			{
+				CtrlCmdGpfifoEntry entry;
+				memcpy(&entry, payload, sizeof(entry));
+				w.addRaw(entry.iova, entry.numCmds, entry.flags);
+				break;
+			}
+
+			case CaptureRecord::CtrlCmd:
+			{
+				// Replayed calls count towards the nesting depth of the list being recorded
+				auto* src = reinterpret_cast<CtrlCmdHeader const*>(payload);
+				if (src->type == CtrlCmdHeader::Call && !addListCall(DkCmdList(static_cast<CtrlCmdJumpCall const*>(src)->ptr)))
+					break;
+
+				CtrlCmdHeader* cmd = w.addCtrl(payloadSize);
+				if (cmd)
+					memcpy(cmd, payload, payloadSize);
+				break;
+			}
+
+			case CaptureRecord::Start:
+				break;
+
+			default:
+				DK_WARNING("unknown capture record");
+				break;
+		}
+
+		pos += 1 + arg;
+		copyRun(&words[pos], runSize);
+		pos += runSize;
+	}
+}
+
 CmdWord* CmdBuf::requestCmdMem(uint32_t size)
 {
 	if (m_isCapturing)
@@ -117,12 +372,15 @@ CmdWord* CmdBuf::requestCmdMem(uint32_t size)
 		DK_ERROR(DkResult_BadState, "out of capture memory");
 		return nullptr;
 	}
-	if (!m_cbAddMem)
+	if (m_memPool)
+		m_memPool->addMemory(this, (size+m_numReservedWords)*sizeof(CmdWord));
+	else if (!m_cbAddMem)
 	{
 		DK_ERROR(DkResult_OutOfMemory, "out of command memory and no add-mem callback set");
 		return nullptr;
 	}
-	m_cbAddMem(m_userData, this, (size+m_numReservedWords)*sizeof(CmdWord));
+	else
+		m_cbAddMem(m_userData, this, (size+m_numReservedWords)*sizeof(CmdWord));
 	if ((m_cmdPos + size) > m_cmdEnd)
 	{
 		DK_ERROR(DkResult_OutOfMemory, "add-mem callback did not add enough command memory");
@@ -133,6 +391,20 @@ CmdWord* CmdBuf::requestCmdMem(uint32_t size)
 
 bool CmdBuf::appendRawGpfifoEntry(DkGpuAddr iova, uint32_t numCmds, uint32_t flags)
 {
+	if (m_isCapturing)
+	{
+		auto* entry = static_cast<CtrlCmdGpfifoEntry*>(appendCaptureRecord(CaptureRecord::RawEntry, sizeof(CtrlCmdGpfifoEntry)));
+		if (!entry)
+			return false;
+		entry->iova = iova;
+		entry->numCmds = numCmds;
+		entry->flags = flags;
+		return true;
+	}
+
+	if (m_statsEnabled)
+		m_stats.numGpfifoEntries++;
+
 	if (m_ctrlGpfifo)
 	{
 		if (flags == CtrlCmdGpfifoEntry::AutoKick && m_ctrlGpfifo->arg)
@@ -145,6 +417,8 @@ bool CmdBuf::appendRawGpfifoEntry(DkGpuAddr iova, uint32_t numCmds, uint32_t fla
 				// Success - all we need to do is update the number of commands
 				lastEntry->numCmds += numCmds;
 				lastEntry->flags |= CtrlCmdGpfifoEntry::AutoKick;
+				if (m_statsEnabled)
+					m_stats.numCoalescedGpfifoEntries++;
 				return true;
 			}
 		}
@@ -195,7 +469,8 @@ bool CmdBuf::appendRawGpfifoEntry(DkGpuAddr iova, uint32_t numCmds, uint32_t fla
 
 CtrlCmdHeader* CmdBuf::appendCtrlCmd(size_t size)
 {
-	DK_DEBUG_BAD_STATE(m_isCapturing, "capturing this command is not supported");
+	if (m_isCapturing)
+		return static_cast<CtrlCmdHeader*>(appendCaptureRecord(CaptureRecord::CtrlCmd, size));
 
 	CtrlCmdHeader* ret = nullptr;
 	if (getCtrlSpaceFree() >= size)
@@ -204,8 +479,8 @@ CtrlCmdHeader* CmdBuf::appendCtrlCmd(size_t size)
 	{
 		// Calculate minimum required size for the chunk
 		size_t reqSize = size + s_reservedCtrlMem;
-		if (reqSize < s_ctrlChunkSize)
-			reqSize = s_ctrlChunkSize;
+		if (reqSize < m_ctrlNextChunkSize)
+			reqSize = m_ctrlNextChunkSize;
 
 		// Try to find a big enough chunk in the list of free chunks
 		CtrlMemChunk* chunk = nullptr;
@@ -242,6 +517,14 @@ CtrlCmdHeader* CmdBuf::appendCtrlCmd(size_t size)
 			chunk->m_next = m_ctrlChunkCur;
 			m_ctrlChunkCur = chunk;
 			m_ctrlEnd = (char*)ret + chunk->m_size - s_reservedCtrlMem;
+
+			// Grow chunks geometrically, so that long lists only need a few of them (and thus few jumps)
+			if (m_ctrlNextChunkSize < s_ctrlMaxGrowChunkSize)
+			{
+				m_ctrlNextChunkSize = 2*(m_ctrlNextChunkSize + sizeof(CtrlMemChunk)) - sizeof(CtrlMemChunk);
+				if (m_ctrlNextChunkSize > s_ctrlMaxGrowChunkSize)
+					m_ctrlNextChunkSize = s_ctrlMaxGrowChunkSize;
+			}
 		}
 	}
 
@@ -252,6 +535,8 @@ CtrlCmdHeader* CmdBuf::appendCtrlCmd(size_t size)
 			m_ctrlStart = ret;
 		m_ctrlPos = (char*)ret + size;
 		m_ctrlGpfifo = nullptr;
+		if (m_statsEnabled)
+			m_stats.numCtrlBytes += size;
 	}
 	return ret;
 }
@@ -260,7 +545,15 @@ DkCmdBuf dkCmdBufCreate(DkCmdBufMaker const* maker)
 {
 	DK_ENTRYPOINT(maker->device);
 	DkCmdBuf obj = nullptr;
-	obj = new(maker->device) CmdBuf(*maker);
+	obj = new(maker->device, CmdBuf::calcExtraSize(maker->flags)) CmdBuf(*maker);
+	if (!obj)
+		return nullptr;
+	if (maker->flags & DkCmdBufFlags_FilterRedundantState)
+		obj->enableStateShadow();
+	if (maker->flags & DkCmdBufFlags_EnableStats)
+		obj->enableStats();
+	if (maker->cmdMemPool)
+		maker->cmdMemPool->attach(obj);
 	return obj;
 }
 
@@ -289,6 +582,14 @@ DkCmdList dkCmdBufFinishList(DkCmdBuf obj)
 	return obj->finishList();
 }
 
+DkCmdList dkCmdBufFlattenList(DkCmdBuf obj, DkCmdList list)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_BAD_STATE(obj->isCapturing(), "illegal operation during command capture");
+	DK_DEBUG_BAD_STATE(obj->hasUnfinishedList(), "command buffer has unfinished commands");
+	return obj->flattenList(list);
+}
+
 void dkCmdBufClear(DkCmdBuf obj)
 {
 	DK_ENTRYPOINT(obj);
@@ -319,22 +620,38 @@ void dkCmdBufReplayCmds(DkCmdBuf obj, const uint32_t* words, uint32_t num_words)
 	if (!num_words)
 		return;
 
-	CmdBufWriter w{obj};
-	w.reserve(num_words);
-	w.addRawData(words, num_words*4);
+	obj->replay(words, num_words);
 }
 
 void dkCmdBufCallList(DkCmdBuf obj, DkCmdList list)
 {
 	DK_ENTRYPOINT(obj);
-	CmdBufWriter w{obj};
+	if (!obj->addListCall(list))
+		return;
 
+	CmdBufWriter w{obj};
 	auto* cmd = w.addCtrl<CtrlCmdJumpCall>();
 	if (cmd)
 	{
 		cmd->type = CtrlCmdHeader::Call;
 		cmd->ptr = reinterpret_cast<CtrlCmdHeader const*>(list);
 	}
+
+	// The called list may modify any state
+	obj->invalidateStateShadow();
+}
+
+uint64_t dkCmdBufGetElidedWordCount(DkCmdBuf obj)
+{
+	DK_ENTRYPOINT(obj);
+	return obj->getNumElidedWords();
+}
+
+void dkCmdBufGetStats(DkCmdBuf obj, DkCmdBufStats* stats)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL(stats);
+	obj->getStats(*stats);
 }
 
 void dkCmdBufWaitFence(DkCmdBuf obj, DkFence* fence)
@@ -13,6 +13,7 @@ template <bool> class CmdBufWriter;
 class CmdBuf : public ObjBase
 {
 	template <bool> friend class CmdBufWriter;
+	friend class CmdMemPool;
 
 	struct CtrlMemChunk
 	{
@@ -20,7 +21,48 @@ class CmdBuf : public ObjBase
 		size_t m_size;
 	};
 
+	// Shadow copy of the 3D engine registers written by the command list being recorded
+	struct StateShadow
+	{
+		static constexpr unsigned s_numMethods = 0xE00; // methods past this point are macro calls
+
+		uint32_t m_skipWords; // payload words of a partially filtered command
+		uint32_t m_valid[s_numMethods/32];
+		uint32_t m_values[s_numMethods];
+
+		void invalidate() noexcept
+		{
+			memset(m_valid, 0, sizeof(m_valid));
+		}
+	};
+
+	// Control commands recorded during command capture are stored inline in the captured words, as
+	// records introduced by a header using a submission mode that is never emitted otherwise.
+	// The word after the header holds the number of plain command words following the record, so
+	// that replay never needs to walk command headers (commands cut short by a raw gpfifo entry, as
+	// done by indirect draws, would throw it off). Captures with records start with a Start record.
+	// Records are decoded (and turned back into control commands) by replay.
+	struct CaptureRecord
+	{
+		enum // Types (stored in the subchannel field)
+		{
+			Split,    // payload: gpfifo entry flags
+			RawEntry, // payload: CtrlCmdGpfifoEntry
+			CtrlCmd,  // payload: control command
+			Start,    // no payload
+		};
+
+		static constexpr uint32_t s_mode = 6;
+		static constexpr uint32_t s_magic = 0x0DC0; // method field, bit 0 set = padding word follows the header
+
+		static constexpr bool isRecord(uint32_t header) noexcept
+		{
+			return (header >> 29) == s_mode && (header & 0x1FFE) == s_magic;
+		}
+	};
+
 	static constexpr size_t s_ctrlChunkSize = 1024 - sizeof(CtrlMemChunk);
+	static constexpr size_t s_ctrlMaxGrowChunkSize = 64*1024 - sizeof(CtrlMemChunk);
 	static constexpr auto s_reservedCtrlMem = sizeof(CtrlCmdJumpCall);
 
 	void* m_userData;
@@ -29,6 +71,7 @@ class CmdBuf : public ObjBase
 	uint32_t m_numReservedWords;
 	bool m_hasFlushFunc;
 	bool m_isCapturing;
+	bool m_statsEnabled;
 
 	union
 	{
@@ -42,17 +85,59 @@ class CmdBuf : public ObjBase
 			void* m_flushFuncData;
 		};
 	};
+	size_t m_ctrlNextChunkSize;
 	CtrlCmdHeader *m_ctrlGpfifo;
 	void *m_ctrlStart, *m_ctrlPos, *m_ctrlEnd;
+	uint32_t m_ctrlCallDepth; // nesting depth of the Call commands in the list being recorded
 	DkGpuAddr m_cmdChunkStartIova, m_cmdStartIova;
 	maxwell::CmdWord *m_cmdChunkStart, *m_cmdStart, *m_cmdPos, *m_cmdEnd;
+
+	uint32_t *m_captureRunSize; // run size word of the last capture record
+
+	StateShadow *m_stateShadow;
+	uint64_t m_numElidedWords;
+	DkCmdBufStats m_stats;
+
+	DkCmdMemPool m_memPool;
+	DkCmdBuf m_memPoolNext;
+
+	void freeCtrlChunks(CtrlMemChunk* list) noexcept;
+	maxwell::CmdWord* filterStateCmds(maxwell::CmdWord* start, maxwell::CmdWord* end) noexcept;
+	void* appendCaptureRecord(uint32_t type, size_t size);
 public:
 	constexpr CmdBuf(DkCmdBufMaker const& maker, uint32_t rw = 0) noexcept : ObjBase{maker.device},
-		m_userData{maker.userData}, m_cbAddMem{maker.cbAddMem}, m_numReservedWords{rw}, m_hasFlushFunc{false}, m_isCapturing{false},
-		m_ctrlChunkCur{}, m_ctrlChunkFree{}, m_ctrlGpfifo{}, m_ctrlStart{}, m_ctrlPos{}, m_ctrlEnd{},
-		m_cmdChunkStartIova{}, m_cmdStartIova{}, m_cmdChunkStart{}, m_cmdStart{}, m_cmdPos{}, m_cmdEnd{} { }
+		m_userData{maker.userData}, m_cbAddMem{maker.cbAddMem}, m_numReservedWords{rw}, m_hasFlushFunc{false}, m_isCapturing{false}, m_statsEnabled{false},
+		m_ctrlChunkCur{}, m_ctrlChunkFree{}, m_ctrlNextChunkSize{s_ctrlChunkSize}, m_ctrlGpfifo{}, m_ctrlStart{}, m_ctrlPos{}, m_ctrlEnd{}, m_ctrlCallDepth{},
+		m_cmdChunkStartIova{}, m_cmdStartIova{}, m_cmdChunkStart{}, m_cmdStart{}, m_cmdPos{}, m_cmdEnd{},
+		m_captureRunSize{}, m_stateShadow{}, m_numElidedWords{}, m_stats{}, m_memPool{maker.cmdMemPool}, m_memPoolNext{} { }
 	~CmdBuf();
 
+	static constexpr size_t calcExtraSize(uint32_t flags) noexcept
+	{
+		return (flags & DkCmdBufFlags_FilterRedundantState) ? sizeof(StateShadow) : 0;
+	}
+
+	void enableStateShadow() noexcept
+	{
+		// The shadow is allocated right after the object itself (see calcExtraSize)
+		m_stateShadow = reinterpret_cast<StateShadow*>(this+1);
+		m_stateShadow->m_skipWords = 0;
+		m_stateShadow->invalidate();
+	}
+
+	void enableStats() noexcept
+	{
+		m_statsEnabled = true;
+	}
+
+	void getStats(DkCmdBufStats& stats) const noexcept
+	{
+		// Words that haven't been signed off into a gpfifo entry yet are counted too
+		stats = m_stats;
+		if (m_statsEnabled)
+			stats.numCmdWords += m_cmdPos - m_cmdStart;
+	}
+
 	void useGpfifoFlushFunc(GpfifoFlushFunc func, void* data, CtrlCmdHeader* mem, uint32_t maxEntries)
 	{
 		m_hasFlushFunc = true;
@@ -70,14 +155,30 @@ public:
 	}
 
 	void addMemory(DkMemBlock mem, uint32_t offset, uint32_t size);
+	void releaseMemory();
 	DkCmdList finishList();
+	bool addListCall(DkCmdList list);
+	DkCmdList flattenList(DkCmdList list);
 	void clear();
 
 	void beginCapture(uint32_t* storage, uint32_t max_words);
 	uint32_t endCapture();
+	void replay(const uint32_t* words, uint32_t numWords);
+
+	void invalidateStateShadow(bool resetStream = false) noexcept
+	{
+		if (m_stateShadow)
+		{
+			m_stateShadow->invalidate();
+			if (resetStream)
+				m_stateShadow->m_skipWords = 0;
+		}
+	}
 
 	constexpr bool isDirty() const noexcept { return m_cmdStart != m_cmdPos; }
+	constexpr bool hasUnfinishedList() const noexcept { return isDirty() || m_ctrlStart; }
 	constexpr bool isCapturing() const noexcept { return m_isCapturing; }
+	constexpr uint64_t getNumElidedWords() const noexcept { return m_numElidedWords; }
 	constexpr uint32_t getCmdOffset() const noexcept { return uint32_t((char*)(void*)m_cmdPos - (char*)(void*)m_cmdChunkStart); }
 	constexpr size_t getCtrlSpaceFree() const noexcept { return size_t((char*)(void*)m_ctrlEnd-(char*)(void*)m_ctrlPos); }
 	maxwell::CmdWord* requestCmdMem(uint32_t size);
@@ -86,8 +187,25 @@ public:
 	bool appendRawGpfifoEntry(DkGpuAddr iova, uint32_t numCmds, uint32_t flags);
 	void signOffGpfifoEntry(uint32_t flags = CtrlCmdGpfifoEntry::AutoKick)
 	{
+		// A command cut short at the end of an entry gets the rest of its payload from another entry
+		// (e.g. the parameters of indirect draws), so the filter must not skip over the next commands
+		if (m_stateShadow && m_stateShadow->m_skipWords)
+			invalidateStateShadow(true);
+
 		uint32_t numCmds = m_cmdPos - m_cmdStart;
-		if (numCmds && appendRawGpfifoEntry(m_cmdStartIova, numCmds, flags))
+		if (!numCmds)
+			return;
+		if (m_statsEnabled)
+			m_stats.numCmdWords += numCmds;
+
+		if (m_isCapturing)
+		{
+			// Record the split so that it can be reproduced on replay
+			auto* recFlags = static_cast<uint32_t*>(appendCaptureRecord(CaptureRecord::Split, sizeof(uint32_t)));
+			if (recFlags)
+				*recFlags = flags;
+		}
+		else if (appendRawGpfifoEntry(m_cmdStartIova, numCmds, flags))
 		{
 			m_cmdStart = m_cmdPos;
 			m_cmdStartIova += numCmds*sizeof(maxwell::CmdWord);
@@ -0,0 +1,206 @@
+#include "dk_cmdmempool.h"
+#include "dk_cmdbuf.h"
+#include "dk_queue.h"
+
+using namespace dk::detail;
+
+DkResult CmdMemPool::initialize()
+{
+	return m_memBlock.initialize(DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached, nullptr, m_ring.getSize());
+}
+
+CmdMemPool::~CmdMemPool()
+{
+	// Wait for all commands using the pool's memory to finish executing
+	while (waitFenceRing());
+}
+
+bool CmdMemPool::waitFenceRing(bool peek)
+{
+	uint32_t id;
+	int32_t timeout = peek ? 0 : -1;
+	bool waited = false;
+	while (m_fenceRing.getFirstInFlight(id))
+	{
+		DkResult res = m_fences[id].wait(timeout);
+		if (res == DkResult_Timeout)
+			break;
+		m_completedFenceSerial ++; // fences complete in the order they were signaled
+		m_fenceRing.consumeOne();
+		timeout = 0;
+		waited = true;
+	}
+	reclaimChunks();
+	return waited;
+}
+
+void CmdMemPool::reclaimChunks()
+{
+	// Memory is reclaimed in order, so a chunk that is still owned by a command buffer (or that
+	// hasn't been covered by a completed fence) holds back the chunks handed out after it
+	uint32_t id;
+	while (m_chunkRing.getFirstInFlight(id))
+	{
+		Chunk& chunk = m_chunks[id];
+		if (chunk.owner || !chunk.fenceSerial || chunk.fenceSerial > m_completedFenceSerial)
+			break;
+		m_ring.updateConsumer(chunk.end);
+		m_chunkRing.consumeOne();
+	}
+}
+
+void CmdMemPool::releaseChunks(DkCmdBuf cmdbuf)
+{
+	uint32_t first = m_chunkRing.getConsumer();
+	uint32_t count = m_chunkRing.getInFlight();
+	if (!count)
+		return;
+
+	// Give back the unused part of the command buffer's current chunk, if nothing was handed out after it
+	Chunk& last = getChunk(first + count - 1);
+	if (last.owner == cmdbuf && cmdbuf->m_cmdChunkStart && !cmdbuf->isCapturing())
+	{
+		uint32_t used = (char*)cmdbuf->m_cmdPos - (char*)cmdbuf->m_cmdChunkStart;
+		uint32_t unused = last.end - last.start - used;
+		m_ring.rewindProducer(unused);
+		last.end -= unused;
+	}
+
+	for (uint32_t i = 0; i < count; i ++)
+	{
+		Chunk& chunk = getChunk(first + i);
+		if (chunk.owner == cmdbuf)
+			chunk.owner = nullptr;
+	}
+
+	if (!cmdbuf->isCapturing())
+		cmdbuf->releaseMemory();
+}
+
+void CmdMemPool::attach(DkCmdBuf cmdbuf)
+{
+	MutexHolder m{m_mutex};
+	cmdbuf->m_memPoolNext = m_cmdBufList;
+	m_cmdBufList = cmdbuf;
+}
+
+void CmdMemPool::detach(DkCmdBuf cmdbuf)
+{
+	MutexHolder m{m_mutex};
+	releaseChunks(cmdbuf);
+	for (DkCmdBuf* prevNext = &m_cmdBufList; *prevNext; prevNext = &(*prevNext)->m_memPoolNext)
+	{
+		if (*prevNext == cmdbuf)
+		{
+			*prevNext = cmdbuf->m_memPoolNext;
+			break;
+		}
+	}
+}
+
+void CmdMemPool::addMemory(DkCmdBuf cmdbuf, size_t minReqSize)
+{
+	MutexHolder m{m_mutex};
+	if (minReqSize > m_ring.getSize())
+	{
+		DK_ERROR(DkResult_OutOfMemory, "command memory request is larger than the pool");
+		return;
+	}
+
+	uint32_t offset, chunkId;
+	uint32_t availableSize = m_chunkRing.reserve(chunkId, 1) ? m_ring.reserve(offset, minReqSize) : 0;
+	bool peek = true;
+	while (!availableSize)
+	{
+		// Try reclaiming chunks whose commands have finished executing, blocking if needed
+		if (!waitFenceRing(peek) && !peek)
+		{
+			DK_ERROR(DkResult_OutOfMemory, "out of command memory in pool and no fences in flight");
+			return;
+		}
+		peek = false;
+		availableSize = m_chunkRing.reserve(chunkId, 1) ? m_ring.reserve(offset, minReqSize) : 0;
+	}
+
+	// Hand out a whole chunk if possible, so that the pool isn't hit on every small request
+	uint32_t size = availableSize < m_chunkSize ? availableSize : m_chunkSize;
+	if (size < minReqSize)
+		size = minReqSize;
+
+	m_ring.updateProducer(offset + size);
+	m_chunks[chunkId] = Chunk{ cmdbuf, offset, offset + size, 0 };
+	m_chunkRing.updateProducer(chunkId + 1);
+	cmdbuf->addMemory(&m_memBlock, offset, size);
+}
+
+void CmdMemPool::finishList(DkCmdBuf cmdbuf)
+{
+	MutexHolder m{m_mutex};
+	releaseChunks(cmdbuf);
+}
+
+void CmdMemPool::signalFence(DkQueue queue, bool flush)
+{
+	MutexHolder m{m_mutex};
+
+	uint32_t id;
+	bool peek = true;
+	do
+	{
+		waitFenceRing(peek);
+		peek = false;
+	}
+	while (!m_fenceRing.reserve(id, 1));
+
+	// Only chunks whose lists have been finished are covered by this fence. Chunks still owned by
+	// command buffers are left alone, as they may be in use by other threads.
+	uint64_t serial = ++m_lastFenceSerial;
+	uint32_t first = m_chunkRing.getConsumer();
+	for (uint32_t i = 0; i < m_chunkRing.getInFlight(); i ++)
+	{
+		Chunk& chunk = getChunk(first + i);
+		if (!chunk.owner && !chunk.fenceSerial)
+			chunk.fenceSerial = serial;
+	}
+
+	// Thread-safe queues take the signal through their submission ring, so that it is ordered
+	// after the submissions queued before it (the fence stays pending until then)
+	dkQueueSignalFence(queue, &m_fences[id], flush);
+	m_fenceRing.updateProducer(id+1);
+}
+
+DkCmdMemPool dkCmdMemPoolCreate(DkCmdMemPoolMaker const* maker)
+{
+	DK_ENTRYPOINT(maker->device);
+	DK_DEBUG_NON_ZERO(maker->size);
+	DK_DEBUG_SIZE_ALIGN(maker->size, DK_MEMBLOCK_ALIGNMENT);
+	DK_DEBUG_NON_ZERO(maker->chunkSize);
+	DK_DEBUG_SIZE_ALIGN(maker->chunkSize, DK_CMDMEM_ALIGNMENT);
+
+	DkCmdMemPool obj = new(maker->device, CmdMemPool::calcExtraSize(*maker)) CmdMemPool(*maker);
+	if (!obj)
+		return nullptr;
+
+	DkResult res = obj->initialize();
+	if (res != DkResult_Success)
+	{
+		delete obj;
+		DK_ERROR(res, "initialization failure");
+		return nullptr;
+	}
+	return obj;
+}
+
+void dkCmdMemPoolDestroy(DkCmdMemPool obj)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_BAD_STATE(obj->hasCmdBufs(), "command buffers using this pool still exist");
+	delete obj;
+}
+
+void dkCmdMemPoolSignalFence(DkCmdMemPool obj, DkQueue queue, bool flush)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL(queue);
+	obj->signalFence(queue, flush);
+}
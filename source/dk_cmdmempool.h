@@ -0,0 +1,85 @@
+#pragma once
+#include "dk_private.h"
+#include "dk_memblock.h"
+#include "dk_fence.h"
+#include "ringbuf.h"
+
+namespace dk::detail
+{
+
+class CmdMemPool : public ObjBase
+{
+	static constexpr uint32_t s_numFences = 16;
+
+	// Chunks are tracked in the order they were handed out. A chunk can only be reclaimed once the
+	// command buffer that owns it has finished its lists, and a fence signaled afterwards has completed.
+	struct Chunk
+	{
+		DkCmdBuf owner;       // null once all lists using the chunk have been finished
+		uint32_t start, end;  // offsets within the pool memory (end is not wrapped around)
+		uint64_t fenceSerial; // serial of the fence covering the chunk (0 if none yet)
+	};
+
+	Mutex m_mutex;
+	MemBlock m_memBlock;
+	uint32_t m_chunkSize;
+	RingBuf<uint32_t> m_ring;
+	RingBuf<uint32_t> m_chunkRing;
+	Chunk* m_chunks; // allocated right after the object (see calcExtraSize)
+
+	RingBuf<uint32_t> m_fenceRing;
+	DkFence m_fences[s_numFences];
+	uint64_t m_lastFenceSerial;
+	uint64_t m_completedFenceSerial;
+
+	DkCmdBuf m_cmdBufList;
+
+	static uint32_t calcMaxChunks(DkCmdMemPoolMaker const& maker) noexcept
+	{
+		// Chunks can end up smaller than chunkSize (at the end of the pool, or when trimmed),
+		// so leave some headroom. Running out of records is handled like running out of memory.
+		return 2*(maker.size / maker.chunkSize) + 16;
+	}
+
+	Chunk& getChunk(uint32_t pos) noexcept
+	{
+		if (pos >= m_chunkRing.getSize())
+			pos -= m_chunkRing.getSize();
+		return m_chunks[pos];
+	}
+
+	bool waitFenceRing(bool peek = false) noexcept;
+	void reclaimChunks() noexcept;
+	void releaseChunks(DkCmdBuf cmdbuf) noexcept;
+
+public:
+	CmdMemPool(DkCmdMemPoolMaker const& maker) noexcept : ObjBase{maker.device},
+		m_mutex{}, m_memBlock{maker.device}, m_chunkSize{maker.chunkSize}, m_ring{maker.size},
+		m_chunkRing{calcMaxChunks(maker)}, m_chunks{reinterpret_cast<Chunk*>(this+1)},
+		m_fenceRing{s_numFences}, m_fences{}, m_lastFenceSerial{}, m_completedFenceSerial{}, m_cmdBufList{}
+	{ }
+	~CmdMemPool();
+
+	static size_t calcExtraSize(DkCmdMemPoolMaker const& maker) noexcept
+	{
+		return calcMaxChunks(maker)*sizeof(Chunk);
+	}
+
+	DkResult initialize();
+	bool hasCmdBufs() const noexcept { return m_cmdBufList != nullptr; }
+
+	void attach(DkCmdBuf cmdbuf) noexcept;
+	void detach(DkCmdBuf cmdbuf) noexcept;
+	void addMemory(DkCmdBuf cmdbuf, size_t minReqSize) noexcept;
+
+	// Called by the command buffer when it finishes a list: takes away all chunks it holds, so that
+	// they can be covered by the next fence. Its next commands are written to a new chunk.
+	void finishList(DkCmdBuf cmdbuf) noexcept;
+
+	// Memory used by lists finished before this call is reclaimed once the fence signals. All those
+	// lists must have been submitted to the queue beforehand. Lists still being recorded (by this or
+	// any other thread) are not affected.
+	void signalFence(DkQueue queue, bool flush) noexcept;
+};
+
+}
@@ -0,0 +1,167 @@
+#include "dk_cmdtemplate.h"
+#include "dk_device.h"
+#include "cmdbuf_writer.h"
+
+using namespace maxwell;
+using namespace dk::detail;
+
+DkResult CmdTemplate::initialize(DkCmdTemplateMaker const& maker)
+{
+	m_numRelocs = 0;
+
+	// Only the payload of the commands is looked at, so that command headers never get mistaken for placeholders
+	for (uint32_t pos = 0; pos < maker.numWords; )
+	{
+		uint32_t header = maker.words[pos++];
+		uint32_t arg  = (header >> 16) & 0x1FFF;
+		uint32_t mode = header >> 29;
+
+		if (mode == Inline)
+			continue;
+		if (mode != Increasing && mode != NonIncreasing && mode != IncreaseOnce)
+			return DkResult_BadInput;
+		if (arg > maker.numWords - pos)
+			return DkResult_BadInput;
+
+		for (uint32_t i = 0; i < arg; i ++)
+		{
+			uint32_t word = maker.words[pos+i];
+			for (uint32_t slot = 0; slot < maker.numSlots; slot ++)
+			{
+				DkCmdTemplateSlot const& s = maker.pSlots[slot];
+				uint16_t type = Reloc::Value;
+				bool found;
+				if (s.type == DkCmdTemplateSlotType_Iova)
+				{
+					// Addresses are written to methods high word first, but copied raw (low word first)
+					// by commands taking DkBufExtents
+					uint32_t high = IovaHigh(s.placeholder), low = IovaLow(s.placeholder);
+					if ((i+1) < arg && word == high && maker.words[pos+i+1] == low)
+						type = Reloc::IovaHighLow;
+					else if ((i+1) < arg && word == low && maker.words[pos+i+1] == high)
+						type = Reloc::IovaLowHigh;
+					found = type != Reloc::Value;
+				}
+				else
+					found = word == uint32_t(s.placeholder);
+
+				if (found)
+				{
+					// A placeholder matching more than once can't be told apart from an actual value
+					// (BadState is only used to tell this case apart in dkCmdTemplateCreate)
+					if (hasReloc(slot))
+						return DkResult_BadState;
+
+					m_relocs[m_numRelocs++] = Reloc{ pos+i, uint16_t(slot), type };
+					if (type != Reloc::Value)
+						i ++;
+					break;
+				}
+			}
+		}
+
+		pos += arg;
+	}
+
+	memcpy(m_words, maker.words, m_numWords*sizeof(uint32_t));
+	return DkResult_Success;
+}
+
+void CmdTemplate::instantiate(DkCmdBuf cmdBuf, uint64_t const slotValues[])
+{
+	if (!m_numWords)
+		return;
+
+	CmdBufWriter w{cmdBuf};
+	CmdWord* pos = w.reserve(m_numWords);
+	if (!pos)
+	{
+		w.invalidate();
+		return;
+	}
+	w.addRawData(m_words, m_numWords*sizeof(uint32_t));
+
+	// Patch the relocation sites before the writer is flushed
+	for (uint32_t i = 0; i < m_numRelocs; i ++)
+	{
+		Reloc const& r = m_relocs[i];
+		uint64_t value = slotValues[r.slot];
+		switch (r.type)
+		{
+			case Reloc::Value:
+				pos[r.offset] = CmdWord{uint32_t(value)};
+				break;
+			case Reloc::IovaHighLow:
+				pos[r.offset+0] = CmdWord{IovaHigh(value)};
+				pos[r.offset+1] = CmdWord{IovaLow(value)};
+				break;
+			case Reloc::IovaLowHigh:
+				pos[r.offset+0] = CmdWord{IovaLow(value)};
+				pos[r.offset+1] = CmdWord{IovaHigh(value)};
+				break;
+		}
+	}
+}
+
+DkCmdTemplate dkCmdTemplateCreate(DkCmdTemplateMaker const* maker)
+{
+	DK_ENTRYPOINT(maker->device);
+	DK_DEBUG_NON_NULL_ARRAY(maker->words, maker->numWords);
+	DK_DEBUG_NON_NULL_ARRAY(maker->pSlots, maker->numSlots);
+	DK_DEBUG_BAD_INPUT(maker->numSlots > UINT16_MAX, "too many slots");
+
+	DkCmdTemplate obj = new(maker->device, CmdTemplate::calcExtraSize(maker->numWords, maker->numSlots))
+		CmdTemplate(maker->device, maker->numWords, maker->numSlots);
+	if (!obj)
+		return nullptr;
+
+	DkResult res = obj->initialize(*maker);
+	if (res != DkResult_Success)
+	{
+		delete obj;
+		if (res == DkResult_BadState)
+			DK_ERROR(DkResult_BadInput, "template placeholder matches more than once");
+		else
+			DK_ERROR(res, "malformed or unsupported commands in template");
+		return nullptr;
+	}
+
+	// Instances would silently keep using the placeholder address, which the GPU would then access
+	for (uint32_t i = 0; i < maker->numSlots; i ++)
+	{
+		if (maker->pSlots[i].type == DkCmdTemplateSlotType_Iova && !obj->hasReloc(i))
+		{
+			delete obj;
+			DK_ERROR(DkResult_BadInput, "template address placeholder not found");
+			return nullptr;
+		}
+	}
+
+#ifdef DEBUG
+	if (obj->getNumRelocs() < maker->numSlots)
+		DK_WARNING("placeholders for %u template slots not found", maker->numSlots - obj->getNumRelocs());
+#endif
+
+	return obj;
+}
+
+void dkCmdTemplateDestroy(DkCmdTemplate obj)
+{
+	DK_ENTRYPOINT(obj);
+	delete obj;
+}
+
+uint32_t dkCmdTemplateGetNumRelocs(DkCmdTemplate obj)
+{
+	DK_ENTRYPOINT(obj);
+	return obj->getNumRelocs();
+}
+
+void dkCmdTemplateInstantiate(DkCmdTemplate obj, DkCmdBuf cmdBuf, uint64_t const slotValues[], uint32_t numSlotValues)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL(cmdBuf);
+	DK_DEBUG_NON_NULL_ARRAY(slotValues, numSlotValues);
+	DK_DEBUG_BAD_INPUT(numSlotValues < obj->getNumSlots(), "a value must be provided for each template slot");
+	obj->instantiate(cmdBuf, slotValues);
+}
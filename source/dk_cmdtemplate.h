@@ -0,0 +1,58 @@
+#pragma once
+#include "dk_private.h"
+
+namespace dk::detail
+{
+
+class CmdTemplate : public ObjBase
+{
+public:
+	struct Reloc
+	{
+		enum // Types
+		{
+			Value,       // single word
+			IovaHighLow, // address as written to methods (high word first)
+			IovaLowHigh, // address as stored in memory, e.g. DkBufExtents copied into the commands
+		};
+
+		uint32_t offset; // in words
+		uint16_t slot;
+		uint16_t type;
+	};
+
+private:
+	uint32_t m_numWords;
+	uint32_t m_numSlots;
+	uint32_t m_numRelocs;
+	Reloc* m_relocs;
+	uint32_t* m_words;
+
+public:
+	// Each placeholder may only match once, so there is room for at most one relocation per slot
+	constexpr CmdTemplate(DkDevice dev, uint32_t numWords, uint32_t numSlots) noexcept : ObjBase{dev},
+		m_numWords{numWords}, m_numSlots{numSlots}, m_numRelocs{},
+		m_relocs{(Reloc*)(void*)(this+1)}, m_words{(uint32_t*)(void*)(m_relocs+numSlots)}
+	{ }
+
+	static constexpr size_t calcExtraSize(uint32_t numWords, uint32_t numSlots) noexcept
+	{
+		return numSlots*sizeof(Reloc) + numWords*sizeof(uint32_t);
+	}
+
+	uint32_t getNumSlots() const noexcept { return m_numSlots; }
+	uint32_t getNumRelocs() const noexcept { return m_numRelocs; }
+
+	bool hasReloc(uint32_t slot) const noexcept
+	{
+		for (uint32_t i = 0; i < m_numRelocs; i ++)
+			if (m_relocs[i].slot == slot)
+				return true;
+		return false;
+	}
+
+	DkResult initialize(DkCmdTemplateMaker const& maker);
+	void instantiate(DkCmdBuf cmdBuf, uint64_t const slotValues[]);
+};
+
+}
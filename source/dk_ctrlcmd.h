@@ -23,7 +23,8 @@ struct CtrlCmdHeader
 	};
 
 	uint64_t type : 8;
-	uint64_t extra : 24;
+	uint64_t callDepth : 8; // first command of a list: nesting depth of its Call commands (see CmdBuf::finishList)
+	uint64_t extra : 16;
 	uint64_t arg : 32;
 };
 
@@ -74,4 +75,81 @@ struct CtrlCmdComputeDispatch : public CtrlCmdHeader
 	uint32_t numGroupsZ;
 };
 
+// Maximum nesting depth of Call commands (return addresses are kept in a fixed-size stack)
+constexpr unsigned s_maxCtrlCallDepth = DK_MAX_CMD_LIST_CALL_DEPTH;
+
+// Nesting depth of the Call commands in a finished list (0 for lists that don't call other lists)
+inline unsigned GetCtrlListCallDepth(DkCmdList list)
+{
+	return list ? reinterpret_cast<CtrlCmdHeader const*>(list)->callDepth : 0;
+}
+
+// Size of control commands that don't affect control flow
+constexpr size_t GetCtrlCmdSize(CtrlCmdHeader const* cmd)
+{
+	switch (cmd->type)
+	{
+		case CtrlCmdHeader::GpfifoList:
+			return sizeof(CtrlCmdHeader) + cmd->arg*sizeof(CtrlCmdGpfifoEntry);
+		case CtrlCmdHeader::WaitFence:
+		case CtrlCmdHeader::SignalFence:
+			return sizeof(CtrlCmdFence);
+		case CtrlCmdHeader::ComputeBindShader:
+			return sizeof(CtrlCmdComputeShader);
+		case CtrlCmdHeader::ComputeBindBuffer:
+		case CtrlCmdHeader::ComputeDispatchIndirect:
+			return sizeof(CtrlCmdComputeAddress);
+		case CtrlCmdHeader::ComputeDispatch:
+			return sizeof(CtrlCmdComputeDispatch);
+		default:
+			return sizeof(CtrlCmdHeader);
+	}
+}
+
+// Walks a list along the same path as Queue::submitCommands, checking that Call commands aren't
+// nested more deeply than s_maxCtrlCallDepth. This lets CmdBuf::flattenList reject lists before
+// any of their commands are processed, instead of leaving a partially flattened list behind.
+inline bool CheckCtrlCallDepth(CtrlCmdHeader const* cur)
+{
+	CtrlCmdHeader const* callStack[s_maxCtrlCallDepth];
+	unsigned callDepth = 0;
+
+	while (cur)
+	{
+		switch (cur->type)
+		{
+			default:
+			case CtrlCmdHeader::Return:
+				cur = callDepth ? callStack[--callDepth] : nullptr;
+				break;
+			case CtrlCmdHeader::Jump:
+			case CtrlCmdHeader::Call:
+			{
+				auto* cmd = static_cast<CtrlCmdJumpCall const*>(cur);
+				if (cur->type == CtrlCmdHeader::Call)
+				{
+					if (!cmd->ptr)
+					{
+						cur = cmd+1;
+						break;
+					}
+					if (callDepth == s_maxCtrlCallDepth)
+						return false;
+					callStack[callDepth++] = cmd+1;
+				}
+				cur = cmd->ptr;
+				break;
+			}
+			case CtrlCmdHeader::GpfifoList:
+			case CtrlCmdHeader::WaitFence:
+			case CtrlCmdHeader::SignalFence:
+			case CtrlCmdHeader::ComputeBindShader ... CtrlCmdHeader::ComputeDispatchIndirect:
+				cur = reinterpret_cast<CtrlCmdHeader const*>((char const*)cur + GetCtrlCmdSize(cur));
+				break;
+		}
+	}
+
+	return true;
+}
+
 }
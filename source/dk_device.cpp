@@ -125,6 +125,7 @@ Device::~Device()
 			DK_ERROR(DkResult_BadState, "unfreed queues");
 #endif
 
+	m_fenceCallbacks.shutdown();
 	m_semaphoreMem.destroy(); // must do this before NvLib is wound down
 	m_codeSeg.cleanup();
 
@@ -201,6 +202,13 @@ void dkDeviceDestroy(DkDevice obj)
 	delete obj;
 }
 
+void dkDeviceGetCodeSegStats(DkDevice obj, DkCodeSegStats* stats)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL(stats);
+	obj->getCodeSeg().getStats(*stats);
+}
+
 void* ObjBase::operator new(size_t size, DkDevice device)
 {
 	return device->allocMem(size);
@@ -2,6 +2,7 @@
 #include "dk_private.h"
 #include "dk_memblock.h"
 #include "codesegmgr.h"
+#include "fence_callbacks.h"
 
 #ifdef DEBUG
 #define DK_DEVICE_ERROR(_m, _ctx, _res, _msg) \
@@ -55,6 +56,7 @@ class Device
 {
 	static constexpr unsigned s_numQueues = DK_MEMBLOCK_ALIGNMENT / sizeof(NvLongSemaphore);
 	static constexpr unsigned s_usedQueueBitmapSize = (s_numQueues + 31) >> 5;
+	static constexpr unsigned s_numPipelineCacheBuckets = 64;
 
 	DkDeviceMaker m_maker;
 	mutable NvAddressSpace m_addrSpace;
@@ -70,10 +72,22 @@ class Device
 	uint32_t m_usedQueues[s_usedQueueBitmapSize];
 
 	MemBlock m_semaphoreMem;
-	uint32_t m_semaphores[s_numQueues];
+	uint64_t m_semaphores[s_numQueues];
 
 	CodeSegMgr m_codeSeg;
 
+	Mutex m_pipelineCacheMutex;
+	DkPipelineState m_pipelineCache[s_numPipelineCacheBuckets];
+
+	FenceCallbacks m_fenceCallbacks;
+
+	// Signaled whenever a fence pending on a thread-safe queue is resolved
+	Mutex m_pendingFenceMutex;
+	CondVar m_pendingFenceCondVar;
+	uint32_t m_numDeferredQueues; // thread-safe queues stopped at a wait on a pending fence
+
+	void retryDeferredQueues() noexcept;
+
 public:
 
 	constexpr Device(DkDeviceMaker const& m) noexcept :
@@ -83,11 +97,17 @@ public:
 #endif
 		m_queueTableMutex{}, m_queueTable{}, m_usedQueues{},
 		m_semaphoreMem{this}, m_semaphores{},
-		m_codeSeg{this} { }
+		m_codeSeg{this},
+		m_pipelineCacheMutex{}, m_pipelineCache{},
+		m_fenceCallbacks{this},
+		m_pendingFenceMutex{}, m_pendingFenceCondVar{}, m_numDeferredQueues{} { }
 	constexpr DkDeviceMaker const& getMaker() const noexcept { return m_maker; }
 	constexpr NvAddressSpace *getAddrSpace() const noexcept { return &m_addrSpace; }
 	constexpr CodeSegMgr &getCodeSeg() noexcept { return m_codeSeg; }
 	constexpr GpuInfo const& getGpuInfo() const noexcept { return m_gpuInfo; }
+	constexpr Mutex &getPipelineCacheMutex() noexcept { return m_pipelineCacheMutex; }
+	constexpr DkPipelineState &getPipelineCacheBucket(uint32_t hash) noexcept { return m_pipelineCache[hash % s_numPipelineCacheBuckets]; }
+	constexpr FenceCallbacks &getFenceCallbacks() noexcept { return m_fenceCallbacks; }
 
 	bool isDepthModeOpenGL() const noexcept { return (m_maker.flags & DkDeviceFlags_DepthMinusOneToOne) != 0; }
 	bool isOriginModeOpenGL() const noexcept { return (m_maker.flags & DkDeviceFlags_OriginLowerLeft) != 0; }
@@ -112,17 +132,34 @@ public:
 		return m_semaphoreMem.getGpuAddrPitch() + id*sizeof(NvLongSemaphore);
 	}
 
-	uint32_t getSemaphoreValue(uint32_t id) const noexcept
+	uint64_t getSemaphoreValue(uint32_t id) const noexcept
 	{
 		return m_semaphores[id];
 	}
 
-	uint32_t incrSemaphoreValue(uint32_t id) noexcept
+	uint64_t incrSemaphoreValue(uint32_t id) noexcept
 	{
-		return ++m_semaphores[id];
+		// Only the thread owning the queue increments the value, but others may read it concurrently
+		uint64_t value = m_semaphores[id] + 1;
+		__atomic_store_n(&m_semaphores[id], value, __ATOMIC_RELEASE);
+		return value;
+	}
+
+	uint64_t getCompletedSemaphoreValue(uint32_t id) noexcept
+	{
+		// The GPU only writes the low 32 bits of the value. Extend them using the most recent value
+		// handed out by the CPU, which is always ahead of (or equal to) the value seen by the GPU.
+		uint32_t gpuValue = __atomic_load_n(&getSemaphoreCpuAddr(id)->sequence, __ATOMIC_ACQUIRE);
+		uint64_t cpuValue = __atomic_load_n(&m_semaphores[id], __ATOMIC_ACQUIRE);
+		return cpuValue - uint32_t(uint32_t(cpuValue) - gpuValue);
 	}
 
 	void checkQueueErrors() noexcept;
+
+	void notifyFenceResolved() noexcept;
+	void waitFenceResolved(DkFence const& fence, u64 timeout_ns) noexcept;
+	void addDeferredQueue() noexcept { __atomic_add_fetch(&m_numDeferredQueues, 1, __ATOMIC_RELEASE); }
+	void removeDeferredQueue() noexcept { __atomic_sub_fetch(&m_numDeferredQueues, 1, __ATOMIC_RELEASE); }
 	void calcZcullStorageInfo(ZcullStorageInfo& out, uint32_t width, uint32_t height, uint32_t depth, DkImageFormat format, DkMsMode msMode);
 
 	void incrNvMapCount() noexcept
@@ -1,8 +1,45 @@
 #include "dk_fence.h"
 #include "dk_device.h"
+#include "dk_queue.h"
+#include "dk_trace.h"
+
+using namespace dk::detail;
+
+bool DkFence::waitPending(s32& timeout_us)
+{
+	// The queue processing the signal operation publishes the type last (see Queue::signalFence)
+	u64 start = armGetSystemTick();
+	while (__atomic_load_n(&m_type, __ATOMIC_ACQUIRE) == DkFence::Pending)
+	{
+		// Process the signaling queue's operations in case nobody else is doing so right now
+		DkQueue queue = m_pending.m_queue;
+		queue->pokeSubmitRing();
+
+		u64 wait_ns = 100000000; // 10^8 ns = 100 ms
+		if (timeout_us >= 0)
+		{
+			s32 elapsed_us = armTicksToNs(armGetSystemTick() - start) / 1000U;
+			if (elapsed_us >= timeout_us)
+				return false;
+			if (wait_ns > u64(timeout_us - elapsed_us)*1000U)
+				wait_ns = u64(timeout_us - elapsed_us)*1000U;
+		}
+		queue->getDevice()->waitFenceResolved(*this, wait_ns);
+	}
+
+	if (timeout_us > 0)
+	{
+		s32 elapsed_us = armTicksToNs(armGetSystemTick() - start) / 1000U;
+		timeout_us = elapsed_us < timeout_us ? timeout_us - elapsed_us : 0;
+	}
+	return true;
+}
 
 DkResult DkFence::wait(s32 timeout_us)
 {
+	if (__atomic_load_n(&m_type, __ATOMIC_ACQUIRE) == DkFence::Pending && !waitPending(timeout_us))
+		return DkResult_Timeout;
+
 	Result res = 0;
 	switch (m_type)
 	{
@@ -20,6 +57,7 @@ DkResult DkFence::wait(s32 timeout_us)
 			if (timeout_us == 0)
 				return DkResult_Timeout;
 
+			TraceScope trace{TraceEvent::FenceWait};
 			u64 start = armGetSystemTick();
 			do
 			{
@@ -69,3 +107,45 @@ DkResult dkFenceWait(DkFence* obj, int64_t timeout_ns)
 		timeout_us = timeout_ns / 1000;
 	return obj->wait(timeout_us);
 }
+
+void Device::notifyFenceResolved() noexcept
+{
+	mutexLock(&m_pendingFenceMutex);
+	condvarWakeAll(&m_pendingFenceCondVar);
+	mutexUnlock(&m_pendingFenceMutex);
+	m_fenceCallbacks.notifyFenceResolved();
+
+	// Pairs with the fence in Queue::drainSubmitRing, so that a queue deferring a wait on this fence
+	// either sees it resolved or gets retried here
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&m_numDeferredQueues, __ATOMIC_ACQUIRE))
+		retryDeferredQueues();
+}
+
+void Device::waitFenceResolved(DkFence const& fence, u64 timeout_ns) noexcept
+{
+	// The type is checked with the mutex held, so that the wakeup can't be missed
+	mutexLock(&m_pendingFenceMutex);
+	if (__atomic_load_n(&fence.m_type, __ATOMIC_ACQUIRE) == DkFence::Pending)
+		condvarWaitTimeout(&m_pendingFenceCondVar, &m_pendingFenceMutex, timeout_ns);
+	mutexUnlock(&m_pendingFenceMutex);
+}
+
+void Device::retryDeferredQueues() noexcept
+{
+	// Queues are collected first, since resuming them may resolve further fences
+	DkQueue queues[s_numQueues];
+	uint32_t numQueues = 0;
+	{
+		MutexHolder m{m_queueTableMutex};
+		for (unsigned i = 0; i < s_numQueues; i ++)
+		{
+			DkQueue q = m_queueTable[i];
+			if (q && q->hasDeferredWait())
+				queues[numQueues++] = q;
+		}
+	}
+
+	for (uint32_t i = 0; i < numQueues; i ++)
+		queues[i]->pokeSubmitRing();
+}
@@ -11,6 +11,7 @@ struct Fence
 		Empty,
 		Internal,
 		External,
+		Pending, // queued for signaling by a thread-safe queue, but not processed yet
 	};
 
 	struct _Internal
@@ -29,11 +30,20 @@ struct Fence
 		NvMultiFence m_fence;
 	};
 
+	// Kept clear of the fields above, which the signaling queue fills in before publishing the type
+	struct _Pending
+	{
+		Type m_type;
+		uint32_t _padding[11];
+		DkQueue m_queue; // queue that is going to process the signal operation
+	};
+
 	union
 	{
 		Type m_type;
 		_Internal m_internal;
 		_External m_external;
+		_Pending m_pending;
 	};
 
 	bool internalPoll() const
@@ -41,6 +51,7 @@ struct Fence
 		return (int32_t)(*m_internal.m_semaphoreCpuAddr - m_internal.m_semaphoreValue) >= 0;
 	}
 
+	bool waitPending(s32& timeout_us);
 	DkResult wait(s32 timeout_us = -1);
 };
 
@@ -0,0 +1,117 @@
+#include "dk_pipeline.h"
+#include "dk_device.h"
+#include "dk_cmdbuf.h"
+#include "cmdbuf_writer.h"
+
+using namespace dk::detail;
+
+namespace
+{
+	uint32_t hashWords(uint32_t const* words, uint32_t numWords)
+	{
+		// FNV-1a
+		uint32_t hash = 0x811c9dc5;
+		for (uint32_t i = 0; i < numWords; i ++)
+		{
+			hash ^= words[i];
+			hash *= 0x01000193;
+		}
+		return hash;
+	}
+}
+
+uint32_t PipelineState::encode(DkPipelineStateMaker const& maker, uint32_t* storage, uint32_t maxWords)
+{
+	// Record the state using the regular bind functions into a temporary capture-mode command buffer
+	DkCmdBufMaker cmdBufMaker;
+	dkCmdBufMakerDefaults(&cmdBufMaker, maker.device);
+	CmdBuf cmdBuf{cmdBufMaker};
+
+	cmdBuf.beginCapture(storage, maxWords);
+	if (maker.rasterizer)
+		dkCmdBufBindRasterizerState(&cmdBuf, maker.rasterizer);
+	if (maker.multisample)
+		dkCmdBufBindMultisampleState(&cmdBuf, maker.multisample);
+	if (maker.color)
+		dkCmdBufBindColorState(&cmdBuf, maker.color);
+	if (maker.colorWrite)
+		dkCmdBufBindColorWriteState(&cmdBuf, maker.colorWrite);
+	if (maker.numBlendStates)
+		dkCmdBufBindBlendStates(&cmdBuf, 0, maker.pBlendStates, maker.numBlendStates);
+	if (maker.depthStencil)
+		dkCmdBufBindDepthStencilState(&cmdBuf, maker.depthStencil);
+	return cmdBuf.endCapture();
+}
+
+DkPipelineState PipelineState::create(DkPipelineStateMaker const& maker)
+{
+	DkDevice dev = maker.device;
+
+	// The command writer needs one word of slack at the end of the capture buffer
+	uint32_t words[s_maxWords+1];
+	uint32_t numWords = encode(maker, words, s_maxWords+1);
+	uint32_t hash = hashWords(words, numWords);
+
+	// Identical states encode to identical commands, so look for an existing object first
+	MutexHolder m{dev->getPipelineCacheMutex()};
+	DkPipelineState& bucket = dev->getPipelineCacheBucket(hash);
+	for (DkPipelineState cur = bucket; cur; cur = cur->m_next)
+	{
+		if (cur->matches(hash, words, numWords))
+		{
+			cur->m_refCount ++;
+			return cur;
+		}
+	}
+
+	DkPipelineState obj = new(dev, numWords*sizeof(uint32_t)) PipelineState(dev, hash, numWords);
+	if (!obj)
+		return nullptr;
+	memcpy(obj->m_words, words, numWords*sizeof(uint32_t));
+	obj->m_next = bucket;
+	bucket = obj;
+	return obj;
+}
+
+void PipelineState::release()
+{
+	DkDevice dev = getDevice();
+	MutexHolder m{dev->getPipelineCacheMutex()};
+	if (--m_refCount)
+		return;
+
+	DkPipelineState* link = &dev->getPipelineCacheBucket(m_hash);
+	while (*link != this)
+		link = &(*link)->m_next;
+	*link = m_next;
+
+	delete this;
+}
+
+DkPipelineState dkPipelineStateCreate(DkPipelineStateMaker const* maker)
+{
+	DK_ENTRYPOINT(maker->device);
+	DK_DEBUG_NON_NULL_ARRAY(maker->pBlendStates, maker->numBlendStates);
+	DK_DEBUG_BAD_INPUT(maker->numBlendStates > DK_MAX_RENDER_TARGETS);
+
+	return PipelineState::create(*maker);
+}
+
+void dkPipelineStateDestroy(DkPipelineState obj)
+{
+	DK_ENTRYPOINT(obj);
+	obj->release();
+}
+
+void dkCmdBufBindPipelineState(DkCmdBuf obj, DkPipelineState state)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL(state);
+	uint32_t numWords = state->getNumWords();
+	if (!numWords)
+		return;
+
+	CmdBufWriter w{obj};
+	w.reserve(numWords);
+	w.addRawData(state->getWords(), numWords*sizeof(uint32_t));
+}
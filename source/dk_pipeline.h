@@ -0,0 +1,37 @@
+#pragma once
+#include "dk_private.h"
+
+namespace dk::detail
+{
+
+class PipelineState : public ObjBase
+{
+	// Upper bound of the words emitted by the dkCmdBufBind*State functions baked into a pipeline state
+	static constexpr uint32_t s_maxWords = 15 + 12 + 5 + 2 + 7*DK_MAX_RENDER_TARGETS + 3;
+
+	PipelineState* m_next;
+	uint32_t m_hash;
+	uint32_t m_refCount;
+	uint32_t m_numWords;
+	uint32_t* m_words;
+
+	static uint32_t encode(DkPipelineStateMaker const& maker, uint32_t* storage, uint32_t maxWords);
+
+	bool matches(uint32_t hash, uint32_t const* words, uint32_t numWords) const noexcept
+	{
+		return m_hash == hash && m_numWords == numWords && memcmp(m_words, words, numWords*sizeof(uint32_t)) == 0;
+	}
+
+public:
+	constexpr PipelineState(DkDevice dev, uint32_t hash, uint32_t numWords) noexcept : ObjBase{dev},
+		m_next{}, m_hash{hash}, m_refCount{1}, m_numWords{numWords}, m_words{(uint32_t*)(void*)(this+1)}
+	{ }
+
+	uint32_t getNumWords() const noexcept { return m_numWords; }
+	uint32_t const* getWords() const noexcept { return m_words; }
+
+	static DkPipelineState create(DkPipelineStateMaker const& maker);
+	void release();
+};
+
+}
@@ -129,6 +129,16 @@ public:
 	void freeMem(void* ptr) const noexcept;
 };
 
+// Waits for prior stores to complete, so that they are visible to the GPU
+NX_INLINE void GpuStoreBarrier()
+{
+#ifdef __aarch64__
+	__asm__ __volatile__("dmb\tst" ::: "memory"); // "DMB operation that waits only for stores to complete."
+#else
+	__atomic_thread_fence(__ATOMIC_RELEASE); // host build (null GPU)
+#endif
+}
+
 #ifdef DEBUG
 
 void SetContextForDebug(Device const* dev, const char* funcname);
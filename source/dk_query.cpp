@@ -0,0 +1,187 @@
+#include "dk_query.h"
+#include "dk_memblock.h"
+#include "cmdbuf_writer.h"
+
+#include "engine_3d.h"
+#include "engine_gpfifo.h"
+
+using namespace maxwell;
+using namespace dk::detail;
+
+using S = EngineGpfifo::Semaphore;
+using R = Engine3D::SetReportSemaphore;
+
+namespace
+{
+	uint32_t getZcullStatsReport(uint32_t counter)
+	{
+		switch (counter)
+		{
+			default:
+			case 0: return R::Report::ZcullStats0;
+			case 1: return R::Report::ZcullStats1;
+			case 2: return R::Report::ZcullStats2;
+			case 3: return R::Report::ZcullStats3;
+		}
+	}
+
+	// Writes the counters of a query to the given set of reports (either the start or the end set)
+	// Uses up to 20 command words
+	template <bool Arg>
+	void emitCounterReports(CmdBufWriter<Arg>& w, DkQueryPool const* pool, DkGpuAddr reports)
+	{
+		switch (pool->m_type)
+		{
+			default:
+				break;
+			case DkQueryType_SamplesPassed:
+				w << Cmd(3D, SetReportSemaphoreOffset{}, Iova(reports), 0,
+					R::Operation::ReportOnly | R::Unit::Crop | R::Report::ZPassPixelCount64 | R::StructureSize::FourWords
+				);
+				break;
+			case DkQueryType_ZcullStats:
+				for (uint32_t i = 0; i < 4; i ++)
+					w << Cmd(3D, SetReportSemaphoreOffset{}, Iova(reports + i*sizeof(QueryPool::Report)), 0,
+						R::Operation::ReportOnly | R::Unit::ZCull | getZcullStatsReport(i) | R::StructureSize::FourWords
+					);
+				break;
+		}
+	}
+}
+
+uint32_t dkQueryPoolCalcSize(DkQueryType type, uint32_t numQueries)
+{
+	return numQueries * QueryPool::getReportsPerQuery(type) * sizeof(QueryPool::Report);
+}
+
+void dkQueryPoolInitialize(DkQueryPool* obj, DkMemBlock mem, uint32_t offset, DkQueryType type, uint32_t numQueries)
+{
+	DK_ENTRYPOINT(mem);
+	DK_DEBUG_NON_NULL(obj);
+	DK_DEBUG_NON_ZERO(numQueries);
+	DK_DEBUG_DATA_ALIGN(offset, 16);
+	DK_DEBUG_BAD_INPUT(type != DkQueryType_Timestamp && type != DkQueryType_SamplesPassed && type != DkQueryType_ZcullStats);
+	DK_DEBUG_BAD_INPUT(offset + dkQueryPoolCalcSize(type, numQueries) > mem->getSize(), "query pool out of bounds");
+	DK_DEBUG_BAD_STATE(!mem->isCpuUncached(), "memblock must be DkMemBlockFlags_CpuUncached");
+	DK_DEBUG_BAD_STATE(!mem->isGpuUncached(), "memblock must be DkMemBlockFlags_GpuUncached");
+
+	obj->m_cpuAddr = (QueryPool::Report*)((uint8_t*)mem->getCpuAddr() + offset);
+	obj->m_gpuAddr = mem->getGpuAddrPitch() + offset;
+	obj->m_type = type;
+	obj->m_numQueries = numQueries;
+	dkQueryPoolReset(obj, 0, numQueries);
+}
+
+void dkQueryPoolReset(DkQueryPool const* obj, uint32_t first, uint32_t count)
+{
+	DK_DEBUG_BAD_INPUT(first + count > obj->m_numQueries, "query range out of bounds");
+	memset(obj->getCpuReports(first), 0, dkQueryPoolCalcSize(obj->m_type, count));
+	GpuStoreBarrier(); // make sure the GPU sees the cleared reports
+}
+
+bool dkQueryPoolGetResults(DkQueryPool const* obj, uint32_t first, uint32_t count, uint64_t results[])
+{
+	DK_DEBUG_BAD_INPUT(first + count > obj->m_numQueries, "query range out of bounds");
+	DK_DEBUG_NON_NULL_ARRAY(results, count);
+
+	uint32_t numCounters = QueryPool::getNumCounters(obj->m_type);
+	uint32_t numReports = QueryPool::getReportsPerQuery(obj->m_type);
+	bool available = true;
+	for (uint32_t i = 0; i < count; i ++)
+	{
+		QueryPool::Report volatile* reports = obj->getCpuReports(first+i);
+		uint64_t* out = &results[i*numCounters];
+
+		// A report is available once the GPU has written its timestamp
+		bool ready = true;
+		for (uint32_t j = 0; j < numReports; j ++)
+			if (!reports[j].timestamp)
+				ready = false;
+		if (!ready)
+		{
+			available = false;
+			continue;
+		}
+
+		switch (obj->m_type)
+		{
+			default:
+			case DkQueryType_Timestamp:
+				out[0] = dkGpuTicksToNs(reports[0].timestamp);
+				break;
+			case DkQueryType_SamplesPassed:
+				out[0] = reports[1].value - reports[0].value;
+				break;
+			case DkQueryType_ZcullStats:
+				// These counters are 32-bit
+				for (uint32_t j = 0; j < numCounters; j ++)
+					out[j] = uint32_t(reports[numCounters+j].value - reports[j].value);
+				break;
+		}
+	}
+
+	return available;
+}
+
+void dkCmdBufWriteTimestamp(DkCmdBuf obj, DkQueryPool const* pool, uint32_t index, DkPipelinePos pos)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL(pool);
+	DK_DEBUG_BAD_STATE(pool->m_type != DkQueryType_Timestamp, "query pool must be DkQueryType_Timestamp");
+	DK_DEBUG_BAD_INPUT(index >= pool->m_numQueries, "query index out of bounds");
+
+	CmdBufWriter w{obj};
+	w.reserve(5);
+
+	DkGpuAddr addr = pool->getGpuReports(index);
+	switch (pos)
+	{
+		case DkPipelinePos_Top:
+			w << Cmd(Gpfifo, SemaphoreOffset{}, Iova(addr), 0, S::Operation::Release | S::ReleaseWfiDisable{} | S::ReleaseSize::_16);
+			break;
+		default:
+		case DkPipelinePos_Rasterizer:
+			w << Cmd(3D, SetReportSemaphoreOffset{}, Iova(addr), 0,
+				R::Operation::ReportOnly | R::Unit::Rast | R::Report::None | R::StructureSize::FourWords);
+			break;
+		case DkPipelinePos_Bottom:
+			w << Cmd(3D, SetReportSemaphoreOffset{}, Iova(addr), 0,
+				R::Operation::ReportOnly | R::Unit::Crop | R::Report::None | R::StructureSize::FourWords);
+			break;
+	}
+}
+
+void dkCmdBufBeginQuery(DkCmdBuf obj, DkQueryPool const* pool, uint32_t index)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL(pool);
+	DK_DEBUG_BAD_STATE(pool->m_type == DkQueryType_Timestamp, "timestamp queries must be written with dkCmdBufWriteTimestamp");
+	DK_DEBUG_BAD_INPUT(index >= pool->m_numQueries, "query index out of bounds");
+
+	CmdBufWriter w{obj};
+	w.reserve(1 + 5*QueryPool::getNumCounters(pool->m_type));
+
+	if (pool->m_type == DkQueryType_SamplesPassed)
+		w << CmdInline(3D, SampleCounterEnable{}, 1);
+	else
+		w << CmdInline(3D, ZcullStatCountersEnable{}, 1);
+	emitCounterReports(w, pool, pool->getGpuReports(index));
+}
+
+void dkCmdBufEndQuery(DkCmdBuf obj, DkQueryPool const* pool, uint32_t index)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL(pool);
+	DK_DEBUG_BAD_STATE(pool->m_type == DkQueryType_Timestamp, "timestamp queries must be written with dkCmdBufWriteTimestamp");
+	DK_DEBUG_BAD_INPUT(index >= pool->m_numQueries, "query index out of bounds");
+
+	CmdBufWriter w{obj};
+	w.reserve(1 + 5*QueryPool::getNumCounters(pool->m_type));
+
+	uint32_t numCounters = QueryPool::getNumCounters(pool->m_type);
+	emitCounterReports(w, pool, pool->getGpuReports(index) + numCounters*sizeof(QueryPool::Report));
+	if (pool->m_type == DkQueryType_SamplesPassed)
+		w << CmdInline(3D, SampleCounterEnable{}, 0);
+	else
+		w << CmdInline(3D, ZcullStatCountersEnable{}, 0);
+}
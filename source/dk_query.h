@@ -0,0 +1,46 @@
+#pragma once
+#include "dk_private.h"
+
+namespace dk::detail
+{
+
+struct QueryPool
+{
+	// Layout of a four-word report written by the GPU
+	struct Report
+	{
+		uint64_t value;
+		uint64_t timestamp; // never zero once written
+	};
+
+	Report* m_cpuAddr;
+	DkGpuAddr m_gpuAddr;
+	DkQueryType m_type;
+	uint32_t m_numQueries;
+
+	static constexpr uint32_t getNumCounters(DkQueryType type) noexcept
+	{
+		return type == DkQueryType_ZcullStats ? 4 : 1;
+	}
+
+	static constexpr uint32_t getReportsPerQuery(DkQueryType type) noexcept
+	{
+		// Timestamp queries take a single report, the others take a report per counter at both
+		// the start and the end of the query (the result being the difference)
+		return type == DkQueryType_Timestamp ? 1 : 2*getNumCounters(type);
+	}
+
+	Report* getCpuReports(uint32_t index) const noexcept
+	{
+		return m_cpuAddr + index*getReportsPerQuery(m_type);
+	}
+
+	DkGpuAddr getGpuReports(uint32_t index) const noexcept
+	{
+		return m_gpuAddr + index*getReportsPerQuery(m_type)*sizeof(Report);
+	}
+};
+
+}
+
+DK_OPAQUE_CHECK(QueryPool);
@@ -1,6 +1,7 @@
 #include "dk_queue.h"
 #include "dk_device.h"
 #include "queue_compute.h"
+#include "dk_trace.h"
 
 #include "cmdbuf_writer.h"
 
@@ -10,6 +11,44 @@
 using namespace maxwell;
 using namespace dk::detail;
 
+namespace
+{
+	// Accounts for the time spent blocked waiting for the GPU (in stats and in the trace), starting
+	// from the first wait that actually blocks
+	class BlockedWait
+	{
+		uint64_t* m_statNs; // null if stats are disabled
+		TraceEvent m_event;
+		uint32_t m_arg;
+		u64 m_start;
+		bool m_started;
+		bool m_traced;
+	public:
+		BlockedWait(uint64_t* statNs, TraceEvent event, uint32_t arg) noexcept :
+			m_statNs{statNs}, m_event{event}, m_arg{arg}, m_start{}, m_started{}, m_traced{} { }
+
+		void begin() noexcept
+		{
+			if (m_started)
+				return;
+			m_started = true;
+			if (m_statNs)
+				m_start = armGetSystemTick();
+			m_traced = IsTraceEnabled();
+			if (m_traced)
+				TraceWrite(m_event, TracePhase_Begin, m_arg);
+		}
+
+		~BlockedWait()
+		{
+			if (m_statNs && m_started)
+				*m_statNs += armTicksToNs(armGetSystemTick() - m_start);
+			if (m_traced)
+				TraceWrite(m_event, TracePhase_End, m_arg);
+		}
+	};
+}
+
 DkResult Queue::initialize()
 {
 	DkResult res;
@@ -28,16 +67,24 @@ DkResult Queue::initialize()
 	if (R_FAILED(nvGpuChannelCreate(&m_gpuChannel, getDevice()->getAddrSpace(), prio)))
 		return DkResult_Fail;
 
+	// Allocate the submission ring for thread-safe queues
+	if (isThreadSafe())
+	{
+		void* ringMem = allocMem(sizeof(QueueSubmitRing));
+		if (!ringMem)
+			return DkResult_OutOfMemory;
+		m_submitRing = new(ringMem) QueueSubmitRing;
+	}
+
 	// Allocate cmdbuf
+	if (hasStats())
+		m_cmdBuf.enableStats();
 	res = m_cmdBufMemBlock.initialize(DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuUncached, nullptr, m_cmdBufRing.getSize());
 	if (res != DkResult_Success)
 		return res;
 
 	// Add initial chunk of command memory for init purposes
 	addCmdMemory(m_cmdBufRing.getSize()/2);
-#ifdef DK_QUEUE_DEBUG
-	printf("cmdBufRing: sz=0x%x con=0x%x pro=0x%x fli=0x%x\n", m_cmdBufRing.getSize(), m_cmdBufRing.getConsumer(), m_cmdBufRing.getProducer(), m_cmdBufRing.getInFlight());
-#endif
 
 	// Allocate the work buffer
 	res = m_workBuf.initialize();
@@ -62,15 +109,26 @@ DkResult Queue::initialize()
 		setup3DEngine();
 	if (hasCompute())
 	{
-		m_computeQueue = new(this+1) ComputeQueue(this);
+		m_computeQueue = new((char*)(this+1) + calcGpfifoBlockSize(m_maxQueuedGpfifoEntries)) ComputeQueue(this);
 		m_computeQueue->initialize();
 	}
 	postSubmitFlush();
 	flush();
 
-#ifdef DK_QUEUE_DEBUG
-	printf("cmdBufRing: sz=0x%x con=0x%x pro=0x%x fli=0x%x\n", m_cmdBufRing.getSize(), m_cmdBufRing.getConsumer(), m_cmdBufRing.getProducer(), m_cmdBufRing.getInFlight());
-#endif
+	// Start the kickoff worker thread, using the same priority as the creating thread
+	if (m_flags & DkQueueFlags_BackgroundKickoff)
+	{
+		s32 prio = 0x2C;
+		svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+		if (R_FAILED(threadCreate(&m_worker, _workerFunc, this, nullptr, s_workerStackSize, prio, m_workerCpuId)))
+			return DkResult_Fail;
+		if (R_FAILED(threadStart(&m_worker)))
+		{
+			threadClose(&m_worker);
+			return DkResult_Fail;
+		}
+		m_hasWorker = true;
+	}
 
 	m_state = Healthy;
 	getDevice()->registerQueue(m_id, this);
@@ -79,6 +137,29 @@ DkResult Queue::initialize()
 
 Queue::~Queue()
 {
+	if (m_hasWorker)
+	{
+		mutexLock(&m_workerMutex);
+		m_workerExit = true;
+		condvarWakeOne(&m_workerCondVar);
+		mutexUnlock(&m_workerMutex);
+		threadWaitForExit(&m_worker);
+		threadClose(&m_worker);
+	}
+
+	if (m_submitRing)
+	{
+		// Process any remaining operations from other threads
+		drainSubmitRing();
+		while (m_deferredWait)
+		{
+			s32 timeout_us = -1;
+			m_deferredWait->waitPending(timeout_us);
+			drainSubmitRing();
+		}
+		freeMem(m_submitRing);
+	}
+
 	if (m_state == Healthy)
 		waitIdle();
 
@@ -97,17 +178,22 @@ void Queue::addCmdMemory(size_t minReqSize)
 		idealSize = m_cmdBufFlushThreshold - inFlightSize;
 
 	uint32_t offset;
-#ifdef DK_QUEUE_DEBUG
-	printf("cmdBufRing: sz=0x%x con=0x%x pro=0x%x fli=0x%x\n", m_cmdBufRing.getSize(), m_cmdBufRing.getConsumer(), m_cmdBufRing.getProducer(), m_cmdBufRing.getInFlight());
-	printf("reserving 0x%x\n", (unsigned)minReqSize);
-#endif
 	uint32_t availableSize = m_cmdBufRing.reserve(offset, minReqSize);
-	bool peek = true;
-	while (!availableSize)
+	if (!availableSize)
 	{
-		waitFenceRing(peek);
-		peek = false;
-		availableSize = m_cmdBufRing.reserve(offset, minReqSize);
+		BlockedWait blocked{hasStats() ? &m_stats.cmdMemWaitNs : nullptr, TraceEvent::QueueCmdMemWait, m_id};
+		bool peek = true;
+		while (!availableSize)
+		{
+			if (!peek)
+			{
+				m_adaptiveMemoryStalled = true;
+				blocked.begin();
+			}
+			waitFenceRing(peek);
+			peek = false;
+			availableSize = m_cmdBufRing.reserve(offset, minReqSize);
+		}
 	}
 
 	m_cmdBuf.addMemory(&m_cmdBufMemBlock, offset, availableSize < idealSize ? availableSize : idealSize);
@@ -134,13 +220,21 @@ bool Queue::waitFenceRing(bool peek)
 void Queue::flushRing(bool fenceFlush)
 {
 	uint32_t id;
-	bool peek = true;
-	do
 	{
-		waitFenceRing(peek);
-		peek = false;
+		BlockedWait blocked{hasStats() ? &m_stats.fenceRingWaitNs : nullptr, TraceEvent::QueueFenceRingWait, m_id};
+		bool peek = true;
+		do
+		{
+			if (!peek)
+			{
+				m_adaptiveFenceRingStalled = true;
+				blocked.begin();
+			}
+			waitFenceRing(peek);
+			peek = false;
+		}
+		while (!m_fenceRing.reserve(id, 1));
 	}
-	while (!m_fenceRing.reserve(id, 1));
 
 	m_cmdBuf.unlockReservedWords();
 	signalFence(m_fences[id], fenceFlush);
@@ -160,39 +254,66 @@ void Queue::onCmdBufAddMem(size_t minReqSize)
 	}
 	if (shouldAddMem)
 	{
-		m_cmdBufRing.updateProducer(getCmdOffset());
+		updateCmdBufProducer();
 		addCmdMemory(minReqSize);
 	}
 }
 
+void Queue::updateCmdBufProducer()
+{
+	m_cmdBufRing.updateProducer(getCmdOffset());
+	if (hasStats() && m_cmdBufRing.getInFlight() > m_stats.maxInFlightCmdMem)
+		m_stats.maxInFlightCmdMem = m_cmdBufRing.getInFlight();
+}
+
 void Queue::appendGpfifoEntries(CtrlCmdGpfifoEntry const* entries, uint32_t numEntries)
 {
+	// Entries are converted directly into the channel's gpfifo, following the same kickoff rules as
+	// nvGpuChannelAppendEntry (auto-kick entries leave some room at the end of the gpfifo)
+	uint32_t numQueued = m_gpuChannel.num_entries;
 	for (unsigned i = 0; i < numEntries; i ++)
 	{
 		auto& ent = entries[i];
-#ifdef DK_QUEUE_DEBUG
-		printf("  [%u]: iova 0x%010lx numCmds %u flags %x\n", i, ent.iova, ent.numCmds, ent.flags);
-#endif
-		u32 flags = GPFIFO_ENTRY_NOT_MAIN | ((ent.flags & CtrlCmdGpfifoEntry::NoPrefetch) ? GPFIFO_ENTRY_NO_PREFETCH : 0);
-		u32 threshold = (ent.flags & CtrlCmdGpfifoEntry::AutoKick) ? 8 : 0;
-		if (R_FAILED(nvGpuChannelAppendEntry(&m_gpuChannel, ent.iova, ent.numCmds, flags, threshold)))
+		u32 threshold = (ent.flags & CtrlCmdGpfifoEntry::AutoKick) ? s_gpfifoKickThreshold : 0;
+		if (numQueued >= GPFIFO_QUEUE_SIZE - threshold)
 		{
-			if (!checkError())
-				DK_ERROR(DkResult_Fail, "gpfifo entry append failed, but no error was reported");
-			return;
+			m_gpuChannel.num_entries = numQueued;
+			if (R_FAILED(nvGpuChannelKickoff(&m_gpuChannel)))
+			{
+				if (!checkError())
+					DK_ERROR(DkResult_Fail, "gpu channel kickoff failed, but no error was reported");
+				return;
+			}
+			numQueued = m_gpuChannel.num_entries;
+			Trace(TraceEvent::QueueKickoff, m_id);
+			if (hasStats())
+				m_stats.numKickoffs ++;
 		}
+
+		u32 flags = GPFIFO_ENTRY_NOT_MAIN | ((ent.flags & CtrlCmdGpfifoEntry::NoPrefetch) ? GPFIFO_ENTRY_NO_PREFETCH : 0);
+		nvioctl_gpfifo_entry& out = m_gpuChannel.entries[numQueued++];
+		out.desc = ent.iova;
+		out.desc32[1] |= flags | (ent.numCmds << 10);
 	}
+	m_gpuChannel.num_entries = numQueued;
+	if (hasStats())
+		m_stats.numGpfifoEntries += numEntries;
 }
 
 void Queue::waitFence(DkFence& fence)
 {
-#ifdef DK_QUEUE_DEBUG
-	printf("  waitFence %p\n", &fence);
-#endif
-
 	if (isInErrorState())
 		return;
 
+	Trace(TraceEvent::QueueWaitFence, m_id);
+	if (fence.m_type == DkFence::Pending)
+	{
+		// The fence is yet to be processed by another thread-safe queue. Thread-safe queues never get
+		// here (see Queue::drainSubmitRing); others are externally synchronized, so they simply wait.
+		s32 timeout_us = -1;
+		fence.waitPending(timeout_us);
+	}
+
 	using S = EngineGpfifo::Semaphore;
 	using F = EngineGpfifo::Syncpoint;
 	CmdBufWriterChecked w{&m_cmdBuf};
@@ -226,15 +347,22 @@ void Queue::waitFence(DkFence& fence)
 
 void Queue::signalFence(DkFence& fence, bool flush)
 {
-#ifdef DK_QUEUE_DEBUG
-	printf("  signalFence %p %d\n", &fence, flush);
-#endif
-
-	fence.m_type = DkFence::Internal;
+	bool wasPending = fence.m_type == DkFence::Pending;
 	fence.m_internal.m_semaphoreAddr = getDevice()->getSemaphoreGpuAddr(m_id);
 	fence.m_internal.m_semaphoreCpuAddr = &getDevice()->getSemaphoreCpuAddr(m_id)->sequence;
 	fence.m_internal.m_device = getDevice();
+	fence.m_internal.m_semaphoreValue = signalTimeline(flush, &fence.m_internal.m_fence);
+
+	// Publish the fence last, since other threads may be waiting for a pending fence to become valid
+	__atomic_store_n(&fence.m_type, DkFence::Internal, __ATOMIC_RELEASE);
+	if (wasPending)
+		getDevice()->notifyFenceResolved();
+}
 
+uint64_t Queue::signalTimeline(bool flush, NvFence* outFence)
+{
+	uint64_t value;
+	NvFence fence;
 	if (!isInErrorState())
 	{
 		using A = Engine3D::SyncptAction;
@@ -255,25 +383,60 @@ void Queue::signalFence(DkFence& fence, bool flush)
 			nvGpuChannelIncrFence(&m_gpuChannel);
 		}
 		nvGpuChannelIncrFence(&m_gpuChannel);
-		fence.m_internal.m_semaphoreValue = getDevice()->incrSemaphoreValue(m_id);
+		value = getDevice()->incrSemaphoreValue(m_id);
+		Trace(TraceEvent::QueueSignal, m_id);
 
 		w << CmdInline(3D, UnknownFlush{}, 0);
 		w << Cmd(3D, SetReportSemaphoreOffset{},
-			Iova(fence.m_internal.m_semaphoreAddr),
-			fence.m_internal.m_semaphoreValue,
+			Iova(getDevice()->getSemaphoreGpuAddr(m_id)),
+			uint32_t(value),
 			S::Operation::Release | S::FenceEnable{} | S::Unit::Crop | S::StructureSize::OneWord
 		);
 
 		w << CmdInline(3D, TiledCacheFlush{}, Engine3D::TiledCacheFlush::Flush);
+		nvGpuChannelGetFence(&m_gpuChannel, &fence);
+
+		MutexHolder m{m_timelineMutex};
+		m_timelineSignals[value % s_numTimelineSignals] = { value, fence };
 	}
 	else
-		fence.m_internal.m_semaphoreValue = getDevice()->getSemaphoreValue(m_id);
+	{
+		value = getDevice()->getSemaphoreValue(m_id);
+		nvGpuChannelGetFence(&m_gpuChannel, &fence);
+	}
 
-	nvGpuChannelGetFence(&m_gpuChannel, &fence.m_internal.m_fence);
+	if (outFence)
+		*outFence = fence;
+	return value;
+}
+
+uint64_t Queue::getCompletedValue()
+{
+	return getDevice()->getCompletedSemaphoreValue(m_id);
+}
+
+bool Queue::getTimelineFence(uint64_t value, NvFence& fence)
+{
+	MutexHolder m{m_timelineMutex};
+
+	// Timeline values are consecutive, so the signal (if it was remembered) lives in a known slot.
+	// If the slot was reused by a later signal, waiting for the latter is enough (and the value is
+	// most likely complete anyway, since it is at least s_numTimelineSignals signals old).
+	TimelineSignal const& sig = m_timelineSignals[value % s_numTimelineSignals];
+	if (sig.value < value)
+		return false; // not signaled yet
+	fence = sig.fence;
+	return true;
 }
 
 void Queue::submitCommands(DkCmdList list)
 {
+	TraceScope trace{TraceEvent::QueueSubmit, m_id};
+
+	// Return addresses of Call commands are kept in an explicit stack, so that nesting doesn't use native stack
+	CtrlCmdHeader const* callStack[s_maxCtrlCallDepth];
+	unsigned callDepth = 0;
+
 	CtrlCmdHeader const *cur, *next;
 	for (cur = reinterpret_cast<CtrlCmdHeader*>(list); cur; cur = next)
 	{
@@ -281,19 +444,23 @@ void Queue::submitCommands(DkCmdList list)
 		{
 			default:
 			case CtrlCmdHeader::Return:
-				next = nullptr;
+				next = callDepth ? callStack[--callDepth] : nullptr;
 				break;
 			case CtrlCmdHeader::Jump:
 			case CtrlCmdHeader::Call:
 			{
 				auto* cmd = static_cast<CtrlCmdJumpCall const*>(cur);
-				if (cur->type == CtrlCmdHeader::Jump)
-					next = cmd->ptr;
-				else
+				if (cur->type == CtrlCmdHeader::Call)
 				{
-					submitCommands(DkCmdList(cmd->ptr));
-					next = cmd+1;
+					if (!cmd->ptr)
+					{
+						// Calling an empty list does nothing
+						next = cmd+1;
+						break;
+					}
+					callStack[callDepth++] = cmd+1; // depth checked when the call was recorded
 				}
+				next = cmd->ptr;
 				break;
 			}
 			case CtrlCmdHeader::WaitFence:
@@ -327,6 +494,169 @@ void Queue::submitCommands(DkCmdList list)
 	}
 }
 
+void Queue::pushSubmitOp(QueueSubmitRing::Op const& op)
+{
+	while (!m_submitRing->push(op))
+	{
+		if (hasWorker())
+		{
+			// The ring is full: leave processing it to the worker (which may have to wait for the GPU),
+			// and wait for it to make room. The flush request makes sure it goes through the ring again.
+			mutexLock(&m_workerMutex);
+			m_workerFlushRequested = true;
+			condvarWakeOne(&m_workerCondVar);
+			condvarWait(&m_submitSpaceCondVar, &m_workerMutex);
+			mutexUnlock(&m_workerMutex);
+		}
+		else
+		{
+			// The ring is full, so make room by processing the pending operations on this thread
+			MutexHolder m{m_submitMutex};
+			drainSubmitRing();
+		}
+
+		// If processing is stopped at a wait on a pending fence, there won't be any room until it is resolved
+		DkFence* deferred = __atomic_load_n(&m_deferredWait, __ATOMIC_ACQUIRE);
+		if (deferred)
+			getDevice()->waitFenceResolved(*deferred, 100000000); // 10^8 ns = 100 ms
+	}
+}
+
+void Queue::setDeferredWait(DkFence* fence)
+{
+	if (fence && !m_deferredWait)
+		getDevice()->addDeferredQueue();
+	else if (!fence && m_deferredWait)
+		getDevice()->removeDeferredQueue();
+	__atomic_store_n(&m_deferredWait, fence, __ATOMIC_SEQ_CST);
+}
+
+bool Queue::waitPendingFence(DkFence& fence)
+{
+	if (__atomic_load_n(&fence.m_type, __ATOMIC_ACQUIRE) == DkFence::Pending)
+	{
+		DkQueue signaler = fence.m_pending.m_queue;
+		if (signaler == this)
+		{
+			// The signal operation comes after the wait in the ring, so it could never be satisfied
+			DK_ERROR(DkResult_BadState, "attempt to wait on a fence signaled later on the same queue");
+			return true;
+		}
+
+		// Don't block waiting for the other queue: if its ring can't be processed right away,
+		// the wait is retried once the fence is resolved (see Device::notifyFenceResolved)
+		signaler->pokeSubmitRing();
+		if (__atomic_load_n(&fence.m_type, __ATOMIC_ACQUIRE) == DkFence::Pending)
+			return false;
+	}
+
+	waitFence(fence);
+	return true;
+}
+
+void Queue::drainSubmitRing()
+{
+	QueueSubmitRing::Op op;
+	for (;;)
+	{
+		// Waits on pending fences are deferred until the fence is resolved, leaving the following
+		// operations in the ring so that they remain ordered after the wait
+		if (m_deferredWait)
+		{
+			if (!waitPendingFence(*m_deferredWait))
+			{
+				// The fence may have been resolved just before this queue was marked as deferred
+				__atomic_thread_fence(__ATOMIC_SEQ_CST);
+				if (__atomic_load_n(&m_deferredWait->m_type, __ATOMIC_ACQUIRE) == DkFence::Pending)
+					return;
+				continue;
+			}
+			setDeferredWait(nullptr);
+		}
+
+		if (!m_submitRing->pop(op))
+			break;
+
+		switch (op.type)
+		{
+			case QueueSubmitRing::SubmitCommands:
+				if (isInErrorState())
+					DK_ERROR(DkResult_Fail, "attempt to submit commands to a queue in error state");
+				else
+					submitCommands(DkCmdList(op.ptr));
+				break;
+			case QueueSubmitRing::WaitFence:
+				if (op.ptr)
+					setDeferredWait(static_cast<DkFence*>(op.ptr)); // handled above
+				else
+					waitFence(op.fence);
+				break;
+			case QueueSubmitRing::SignalFence:
+				signalFence(*static_cast<DkFence*>(op.ptr), op.arg != 0);
+				break;
+		}
+	}
+
+	// Kick off the operations that were held back by a deferred wait, if a flush was requested meanwhile
+	if (m_flushAfterDeferredWait)
+	{
+		m_flushAfterDeferredWait = false;
+		if (hasWorker())
+			requestFlush();
+		else if (!isInErrorState())
+			flush();
+	}
+}
+
+void Queue::pokeSubmitRing()
+{
+	if (!m_submitRing)
+		return;
+
+	if (hasWorker())
+		requestFlush();
+	else if (mutexTryLock(&m_submitMutex))
+	{
+		drainSubmitRing();
+		mutexUnlock(&m_submitMutex);
+	}
+}
+
+void Queue::requestFlush()
+{
+	mutexLock(&m_workerMutex);
+	m_workerFlushRequested = true;
+	condvarWakeOne(&m_workerCondVar);
+	mutexUnlock(&m_workerMutex);
+}
+
+void Queue::workerMain()
+{
+	mutexLock(&m_workerMutex);
+	for (;;)
+	{
+		while (!m_workerFlushRequested && !m_workerExit)
+			condvarWait(&m_workerCondVar, &m_workerMutex);
+
+		bool shouldExit = m_workerExit;
+		m_workerFlushRequested = false;
+		mutexUnlock(&m_workerMutex);
+
+		// Process the operations pushed so far, then kick them off. Any waits for GPU progress
+		// (fence ring, command memory) happen here instead of on the thread calling dkQueueFlush.
+		{
+			OwnerLock lock{this};
+			if (!isInErrorState())
+				flush();
+		}
+
+		if (shouldExit)
+			break;
+		mutexLock(&m_workerMutex);
+		condvarWakeAll(&m_submitSpaceCondVar);
+	}
+}
+
 void Queue::flush()
 {
 	if (isInErrorState())
@@ -335,8 +665,13 @@ void Queue::flush()
 		return;
 	}
 
+	// Operations held back by a deferred wait get flushed once they are processed (see drainSubmitRing)
+	if (m_deferredWait)
+		m_flushAfterDeferredWait = true;
+
 	if (m_gpuChannel.num_entries || hasPendingCommands())
 	{
+		TraceScope trace{TraceEvent::QueueFlush, m_id};
 		if (getSizeSinceLastFenceFlush() >= m_cmdBufPerFenceSliceSize)
 			flushRing();
 		flushCmdBuf();
@@ -348,14 +683,102 @@ void Queue::flush()
 				DK_ERROR(DkResult_Fail, "gpu channel kickoff failed, but no error was reported");
 			return;
 		}
+		Trace(TraceEvent::QueueKickoff, m_id);
+		if (hasStats())
+		{
+			m_stats.numFlushes ++;
+			m_stats.numKickoffs ++;
+		}
 		// - Update device query data (is this really necessary?)
-		m_cmdBufRing.updateProducer(getCmdOffset());
+		updateCmdBufProducer();
+		if (m_flags & DkQueueFlags_AdaptiveFlush)
+			adaptFlushParams();
 		addCmdMemory(m_cmdBufPerFenceSliceSize);
 		postSubmitFlush();
 		m_cmdBuf.flushGpfifoEntries();
 	}
 }
 
+void Queue::adaptFlushParams()
+{
+	auto& st = m_adaptiveStats;
+	uint32_t size = m_cmdBufRing.getSize();
+	uint32_t minThreshold = size/64 > DK_MEMBLOCK_ALIGNMENT ? size/64 : DK_MEMBLOCK_ALIGNMENT;
+	uint32_t maxThreshold = size/2;
+	uint32_t minSliceSize = size/64 > DK_MEMBLOCK_ALIGNMENT ? (size/64) &~ (DK_MEMBLOCK_ALIGNMENT-1) : DK_MEMBLOCK_ALIGNMENT;
+	uint32_t maxSliceSize = size/4;
+
+	auto adjust = [](uint32_t value, uint32_t num, uint32_t den, uint32_t min, uint32_t max) -> uint32_t
+	{
+		value = (uint64_t(value)*num/den) &~ (DK_MEMBLOCK_ALIGNMENT-1);
+		return value < min ? min : value > max ? max : value;
+	};
+
+	if (m_adaptiveMemoryStalled)
+	{
+		// Command memory is being reclaimed too late: use finer fence slices and hand work to the GPU sooner
+		st.numMemoryStalls ++;
+		if (m_cmdBufPerFenceSliceSize > minSliceSize)
+		{
+			m_cmdBufPerFenceSliceSize = adjust(m_cmdBufPerFenceSliceSize, 1, 2, minSliceSize, maxSliceSize);
+			st.numSliceDecreases ++;
+		}
+		if (m_cmdBufFlushThreshold > minThreshold)
+		{
+			m_cmdBufFlushThreshold = adjust(m_cmdBufFlushThreshold, 3, 4, minThreshold, maxThreshold);
+			st.numThresholdDecreases ++;
+		}
+	}
+	else if (m_adaptiveFenceRingStalled)
+	{
+		// All fence slices were in flight: slices are too small for the amount of queued work
+		st.numFenceRingStalls ++;
+		if (m_cmdBufPerFenceSliceSize < maxSliceSize)
+		{
+			m_cmdBufPerFenceSliceSize = adjust(m_cmdBufPerFenceSliceSize, 2, 1, minSliceSize, maxSliceSize);
+			st.numSliceIncreases ++;
+		}
+	}
+	else
+	{
+		// No stalls - look at how busy the GPU is. If it retires slices as fast as they are produced,
+		// it is waiting for us, so flush sooner to reduce latency; otherwise batch up more work per flush.
+		waitFenceRing(true);
+		uint32_t numInFlight = m_fenceRing.getInFlight();
+		if (numInFlight <= 1 && m_cmdBufFlushThreshold > minThreshold)
+		{
+			m_cmdBufFlushThreshold = adjust(m_cmdBufFlushThreshold, 7, 8, minThreshold, maxThreshold);
+			st.numThresholdDecreases ++;
+		}
+		else if (numInFlight >= s_numFences/2 && m_cmdBufFlushThreshold < maxThreshold)
+		{
+			m_cmdBufFlushThreshold = adjust(m_cmdBufFlushThreshold, 9, 8, minThreshold, maxThreshold);
+			st.numThresholdIncreases ++;
+		}
+	}
+
+	m_adaptiveMemoryStalled = false;
+	m_adaptiveFenceRingStalled = false;
+	st.flushThreshold = m_cmdBufFlushThreshold;
+	st.perFenceSliceSize = m_cmdBufPerFenceSliceSize;
+}
+
+void Queue::getAdaptiveFlushStats(DkQueueAdaptiveFlushStats& stats) const
+{
+	stats = m_adaptiveStats;
+	stats.flushThreshold = m_cmdBufFlushThreshold;
+	stats.perFenceSliceSize = m_cmdBufPerFenceSliceSize;
+}
+
+void Queue::getStats(DkQueueStats& stats) const
+{
+	DkCmdBufStats cmdBufStats;
+	m_cmdBuf.getStats(cmdBufStats);
+	stats = m_stats;
+	stats.numCmdWords = cmdBufStats.numCmdWords;
+	stats.numCoalescedGpfifoEntries = cmdBufStats.numCoalescedGpfifoEntries;
+}
+
 void Queue::waitIdle()
 {
 	if (isInErrorState())
@@ -375,10 +798,11 @@ DkQueue dkQueueCreate(DkQueueMaker const* maker)
 	DK_DEBUG_BAD_INPUT(maker->flushThreshold < DK_MEMBLOCK_ALIGNMENT || maker->flushThreshold > maker->commandMemorySize);
 	DK_DEBUG_SIZE_ALIGN(maker->perWarpScratchMemorySize, DK_PER_WARP_SCRATCH_MEM_ALIGNMENT);
 	DK_DEBUG_BAD_INPUT(!maker->maxConcurrentComputeJobs && (maker->flags & DkQueueFlags_Compute));
+	DK_DEBUG_NON_ZERO(maker->maxQueuedGpfifoEntries);
 
-	size_t extraSize = 0;
+	size_t extraSize = Queue::calcGpfifoBlockSize(maker->maxQueuedGpfifoEntries);
 	if (maker->flags & DkQueueFlags_Compute)
-		extraSize += sizeof(ComputeQueue);
+		extraSize += ComputeQueue::calcExtraSize(maker->maxConcurrentComputeJobs);
 
 	int32_t id = maker->device->reserveQueueId();
 	if (id < 0)
@@ -409,13 +833,137 @@ bool dkQueueIsInErrorState(DkQueue obj)
 void dkQueueWaitFence(DkQueue obj, DkFence* fence)
 {
 	DK_ENTRYPOINT(obj);
-	obj->waitFence(*fence);
+	if (obj->isThreadSafe())
+	{
+		// The caller's fence may be gone by the time the operation is processed, so copy it - unless its
+		// signal operation is yet to be processed by another thread-safe queue, in which case its contents
+		// aren't known yet (that fence must stay alive anyway, see dkQueueSignalFence)
+		QueueSubmitRing::Op op{ QueueSubmitRing::WaitFence, 0, nullptr };
+		if (__atomic_load_n(&fence->m_type, __ATOMIC_ACQUIRE) == DkFence::Pending)
+			op.ptr = fence;
+		else
+			op.fence = *fence;
+		obj->pushSubmitOp(op);
+	}
+	else
+		obj->waitFence(*fence);
 }
 
 void dkQueueSignalFence(DkQueue obj, DkFence* fence, bool flush)
 {
 	DK_ENTRYPOINT(obj);
-	obj->signalFence(*fence, flush);
+	if (obj->isThreadSafe())
+	{
+		fence->m_pending.m_queue = obj;
+		__atomic_store_n(&fence->m_type, DkFence::Pending, __ATOMIC_RELEASE);
+		obj->pushSubmitOp({ QueueSubmitRing::SignalFence, flush ? 1U : 0U, fence });
+	}
+	else
+		obj->signalFence(*fence, flush);
+}
+
+uint64_t dkQueueSignalTimeline(DkQueue obj, bool flush)
+{
+	DK_ENTRYPOINT(obj);
+	Queue::OwnerLock lock{obj};
+	return obj->signalTimeline(flush);
+}
+
+uint64_t dkQueueGetCompletedValue(DkQueue obj)
+{
+	DK_ENTRYPOINT(obj);
+	return obj->getCompletedValue();
+}
+
+DkResult dkWaitTimelines(DkTimelinePoint const* points, uint32_t numPoints, DkTimelineWait mode, int64_t timeout_ns)
+{
+	DK_DEBUG_NON_NULL_ARRAY(points, numPoints);
+	if (!numPoints)
+		return DkResult_Success;
+	DK_ENTRYPOINT(points[0].queue);
+	DK_DEBUG_BAD_INPUT(mode != DkTimelineWait_All && mode != DkTimelineWait_Any);
+
+	u64 start = armGetSystemTick();
+	s32 any_slice = 1000; // 1 ms, see below
+	for (;;)
+	{
+		// Pick the pending point to block on. For "all" waits the highest value of a queue covers the
+		// lower ones, so each queue is waited for once. For "any" waits the point closest to completion
+		// is picked (on a given queue, this is the lowest value).
+		DkTimelinePoint const* pending = nullptr;
+		uint64_t pendingGap = 0;
+		bool multipleQueues = false;
+		for (uint32_t i = 0; i < numPoints; i ++)
+		{
+			DkTimelinePoint const& pt = points[i];
+			DK_DEBUG_NON_NULL(pt.queue);
+			uint64_t completed = pt.queue->getCompletedValue();
+			if (completed >= pt.value)
+			{
+				if (mode == DkTimelineWait_Any)
+					return DkResult_Success;
+				continue;
+			}
+
+			uint64_t gap = pt.value - completed;
+			if (!pending)
+			{
+				pending = &pt;
+				pendingGap = gap;
+				continue;
+			}
+
+			if (mode == DkTimelineWait_All)
+			{
+				if (pt.queue == pending->queue && pt.value > pending->value)
+					pending = &pt;
+			}
+			else
+			{
+				multipleQueues = multipleQueues || pt.queue != pending->queue;
+				if (gap < pendingGap)
+				{
+					pending = &pt;
+					pendingGap = gap;
+				}
+			}
+		}
+		if (!pending)
+			return DkResult_Success;
+
+		s32 wait_timeout = 100000; // 10^5 μs = 100 ms
+		if (timeout_ns >= 0)
+		{
+			s64 remaining_us = (timeout_ns - (s64)armTicksToNs(armGetSystemTick() - start)) / 1000;
+			if (remaining_us <= 0)
+				return DkResult_Timeout;
+			if (wait_timeout > remaining_us)
+				wait_timeout = remaining_us;
+		}
+
+		// Only one syncpoint can be blocked on at a time, so "any" waits involving several queues
+		// need to look at the other queues periodically. They start out checking often and back off
+		// the longer the wait takes; waits on a single queue simply block until it is done.
+		if (mode == DkTimelineWait_Any && multipleQueues)
+		{
+			if (wait_timeout > any_slice)
+				wait_timeout = any_slice;
+			if (any_slice < 100000)
+				any_slice *= 2;
+		}
+
+		NvFence fence;
+		if (!pending->queue->getTimelineFence(pending->value, fence))
+		{
+			DK_WARNING("waiting for a timeline value that was never signaled");
+			return DkResult_Fail;
+		}
+
+		Result res = nvFenceWait(&fence, wait_timeout);
+		if (R_FAILED(res) && res != MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Timeout))
+			return DkResult_Fail;
+		pending->queue->getDevice()->checkQueueErrors();
+	}
 }
 
 void dkQueueSubmitCommands(DkQueue obj, DkCmdList cmds)
@@ -424,18 +972,45 @@ void dkQueueSubmitCommands(DkQueue obj, DkCmdList cmds)
 	if (obj->isInErrorState())
 		DK_ERROR(DkResult_Fail, "attempt to submit commands to a queue in error state");
 
-	obj->submitCommands(cmds);
+	if (obj->isThreadSafe())
+		obj->pushSubmitOp({ QueueSubmitRing::SubmitCommands, 0, (void*)cmds });
+	else
+		obj->submitCommands(cmds);
 }
 
 void dkQueueFlush(DkQueue obj)
 {
 	DK_ENTRYPOINT(obj);
+	if (obj->hasWorker())
+	{
+		obj->requestFlush();
+		return;
+	}
+
+	Queue::OwnerLock lock{obj};
 	obj->flush();
 }
 
+void dkQueueGetAdaptiveFlushStats(DkQueue obj, DkQueueAdaptiveFlushStats* stats)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL(stats);
+	Queue::OwnerLock lock{obj};
+	obj->getAdaptiveFlushStats(*stats);
+}
+
+void dkQueueGetStats(DkQueue obj, DkQueueStats* stats)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL(stats);
+	Queue::OwnerLock lock{obj};
+	obj->getStats(*stats);
+}
+
 void dkQueueWaitIdle(DkQueue obj)
 {
 	DK_ENTRYPOINT(obj);
+	Queue::OwnerLock lock{obj};
 	obj->waitIdle();
 }
 
@@ -5,6 +5,7 @@
 #include "dk_cmdbuf.h"
 #include "ringbuf.h"
 #include "queue_workbuf.h"
+#include "queue_submitring.h"
 
 namespace dk::detail
 {
@@ -16,8 +17,10 @@ class Queue : public ObjBase
 	friend class ComputeQueue;
 
 	static constexpr uint32_t s_numReservedWords = 12;
-	static constexpr size_t s_maxQueuedGpfifoEntries = 64;
 	static constexpr uint32_t s_numFences = 16;
+	static constexpr uint32_t s_numTimelineSignals = 64; // syncpoint fences remembered for timeline waits
+	static constexpr size_t s_workerStackSize = 0x4000;
+	static constexpr uint32_t s_gpfifoKickThreshold = 8; // gpfifo slots left free by auto-kick entries
 
 	uint32_t m_id;
 	uint32_t m_flags;
@@ -32,22 +35,53 @@ class Queue : public ObjBase
 	MemBlock m_cmdBufMemBlock;
 	CmdBuf m_cmdBuf;
 
-	CtrlCmdHeader m_cmdBufCtrlHeader;
-	CtrlCmdGpfifoEntry m_gpfifoEntries[s_maxQueuedGpfifoEntries];
+	CtrlCmdHeader* m_cmdBufCtrlHeader; // followed by the queued gpfifo entries (allocated after the object)
+	uint32_t m_maxQueuedGpfifoEntries;
 
 	RingBuf<uint32_t> m_cmdBufRing;
 	uint32_t m_cmdBufFlushThreshold;
 	uint32_t m_cmdBufPerFenceSliceSize;
 
+	// Adaptive flush parameters (DkQueueFlags_AdaptiveFlush)
+	bool m_adaptiveMemoryStalled;
+	bool m_adaptiveFenceRingStalled;
+	DkQueueAdaptiveFlushStats m_adaptiveStats;
+
+	DkQueueStats m_stats; // only updated with DkQueueFlags_EnableStats
+
 	RingBuf<uint32_t> m_fenceRing;
 	DkFence m_fences[s_numFences];
 	uint32_t m_fenceCmdOffsets[s_numFences];
 	uint32_t m_fenceLastFlushOffset;
 
+	// Syncpoint fences corresponding to recently signaled timeline values, indexed by value
+	struct TimelineSignal
+	{
+		uint64_t value;
+		NvFence fence;
+	};
+	Mutex m_timelineMutex;
+	TimelineSignal m_timelineSignals[s_numTimelineSignals];
+
 	QueueWorkBuf m_workBuf;
 
 	ComputeQueue* m_computeQueue;
 
+	Mutex m_submitMutex;
+	QueueSubmitRing* m_submitRing;
+	DkFence* m_deferredWait; // pending fence the ring is stopped at, until another queue resolves it
+	bool m_flushAfterDeferredWait;
+	CondVar m_submitSpaceCondVar; // signaled by the worker thread after processing the ring
+
+	// Kickoff worker thread (DkQueueFlags_BackgroundKickoff)
+	Thread m_worker;
+	Mutex m_workerMutex;
+	CondVar m_workerCondVar;
+	int32_t m_workerCpuId;
+	bool m_hasWorker;
+	bool m_workerFlushRequested;
+	bool m_workerExit;
+
 	uint32_t getCmdOffset() const noexcept { return m_cmdBufRing.getProducer() + m_cmdBuf.getCmdOffset(); }
 	uint32_t getInFlightCmdSize() const noexcept { return m_cmdBufRing.getInFlight() + m_cmdBuf.getCmdOffset(); }
 	uint32_t getSizeSinceLastFenceFlush() const noexcept
@@ -62,13 +96,18 @@ class Queue : public ObjBase
 	void addCmdMemory(size_t minReqSize) noexcept;
 	bool waitFenceRing(bool peek = false) noexcept;
 	void flushRing(bool fenceFlush = false) noexcept;
+	void adaptFlushParams() noexcept;
 
 	void onCmdBufAddMem(size_t minReqSize) noexcept;
+	void updateCmdBufProducer() noexcept;
+	void workerMain() noexcept;
+	bool waitPendingFence(DkFence& fence) noexcept;
+	void setDeferredWait(DkFence* fence) noexcept;
 	void appendGpfifoEntries(CtrlCmdGpfifoEntry const* entries, uint32_t numEntries) noexcept;
 
 	bool hasPendingCommands() const noexcept
 	{
-		return m_cmdBuf.isDirty() || m_cmdBufCtrlHeader.arg != 0;
+		return m_cmdBuf.isDirty() || m_cmdBufCtrlHeader->arg != 0;
 	}
 
 	void flushCmdBuf() noexcept
@@ -87,6 +126,11 @@ class Queue : public ObjBase
 		static_cast<Queue*>(userData)->onCmdBufAddMem(minReqSize);
 	}
 
+	static void _workerFunc(void* arg) noexcept
+	{
+		static_cast<Queue*>(arg)->workerMain();
+	}
+
 	static void _gpfifoFlushFunc(void* data, CtrlCmdGpfifoEntry const* entries, uint32_t numEntries) noexcept
 	{
 		static_cast<Queue*>(data)->appendGpfifoEntries(entries, numEntries);
@@ -101,29 +145,81 @@ public:
 	Queue(DkQueueMaker const& maker, uint32_t id) : ObjBase{maker.device},
 		m_id{id}, m_flags{maker.flags}, m_state{Uninitialized}, m_gpuChannel{},
 		m_cmdBufMemBlock{maker.device}, m_cmdBuf{{maker.device,this,_addMemFunc},s_numReservedWords},
-		m_cmdBufCtrlHeader{}, m_gpfifoEntries{},
+		m_cmdBufCtrlHeader{(CtrlCmdHeader*)(void*)(this+1)}, m_maxQueuedGpfifoEntries{maker.maxQueuedGpfifoEntries},
 		m_cmdBufRing{maker.commandMemorySize}, m_cmdBufFlushThreshold{maker.flushThreshold}, m_cmdBufPerFenceSliceSize{maker.commandMemorySize/s_numFences},
+		m_adaptiveMemoryStalled{}, m_adaptiveFenceRingStalled{}, m_adaptiveStats{}, m_stats{},
 		m_fenceRing{s_numFences}, m_fences{}, m_fenceCmdOffsets{}, m_fenceLastFlushOffset{},
-		m_workBuf{maker}, m_computeQueue{}
+		m_timelineMutex{}, m_timelineSignals{},
+		m_workBuf{maker}, m_computeQueue{}, m_submitMutex{}, m_submitRing{},
+		m_deferredWait{}, m_flushAfterDeferredWait{}, m_submitSpaceCondVar{},
+		m_worker{}, m_workerMutex{}, m_workerCondVar{}, m_workerCpuId{maker.workerCpuId},
+		m_hasWorker{}, m_workerFlushRequested{}, m_workerExit{}
 	{
-		m_cmdBuf.useGpfifoFlushFunc(_gpfifoFlushFunc, this, &m_cmdBufCtrlHeader, s_maxQueuedGpfifoEntries);
+		*m_cmdBufCtrlHeader = {};
+		m_cmdBuf.useGpfifoFlushFunc(_gpfifoFlushFunc, this, m_cmdBufCtrlHeader, m_maxQueuedGpfifoEntries);
+	}
+
+	static constexpr size_t calcGpfifoBlockSize(uint32_t maxQueuedGpfifoEntries) noexcept
+	{
+		return sizeof(CtrlCmdHeader) + maxQueuedGpfifoEntries*sizeof(CtrlCmdGpfifoEntry);
 	}
 
 	bool hasGraphics() const noexcept { return (m_flags & DkQueueFlags_Graphics) != 0; }
 	bool hasCompute() const noexcept { return (m_flags & DkQueueFlags_Compute) != 0; }
 	bool hasZcull() const noexcept { return (m_flags & DkQueueFlags_DisableZcull) == 0; }
+	bool isThreadSafe() const noexcept { return (m_flags & (DkQueueFlags_ThreadSafeSubmit | DkQueueFlags_BackgroundKickoff)) != 0; }
+	bool hasWorker() const noexcept { return m_hasWorker; }
+	bool hasStats() const noexcept { return (m_flags & DkQueueFlags_EnableStats) != 0; }
 	bool isInErrorState() const noexcept { return m_state == Error; }
 
 	~Queue();
 	DkResult initialize();
 	void waitFence(DkFence& fence);
 	void signalFence(DkFence& fence, bool flush);
+	uint64_t signalTimeline(bool flush, NvFence* outFence = nullptr);
 	void submitCommands(DkCmdList list);
 	void flush();
 	void waitIdle();
 
 	void decompressSurface(DkImage const* image);
 	bool checkError();
+
+	uint64_t getCompletedValue() noexcept;
+	bool getTimelineFence(uint64_t value, NvFence& fence);
+
+	void getAdaptiveFlushStats(DkQueueAdaptiveFlushStats& stats) const;
+	void getStats(DkQueueStats& stats) const;
+	void requestFlush();
+	void pushSubmitOp(QueueSubmitRing::Op const& op);
+	void drainSubmitRing();
+
+	// Gets the operations in the submission ring processed without blocking the caller: by the
+	// worker thread if there is one, otherwise right away unless another thread is already at it.
+	void pokeSubmitRing();
+	bool hasDeferredWait() const noexcept { return __atomic_load_n(&m_deferredWait, __ATOMIC_ACQUIRE) != nullptr; }
+
+	// Grants exclusive access to the queue's internal state to the owner thread (i.e. the thread
+	// calling functions other than submit/wait/signal). For thread-safe queues this also processes
+	// all operations pushed to the submission ring by other threads, so that they are ordered before
+	// whatever the owner does next. Does nothing for externally synchronized queues.
+	class OwnerLock
+	{
+		Queue* m_queue;
+	public:
+		OwnerLock(Queue* queue) noexcept : m_queue{queue->m_submitRing ? queue : nullptr}
+		{
+			if (m_queue)
+			{
+				mutexLock(&m_queue->m_submitMutex);
+				m_queue->drainSubmitRing();
+			}
+		}
+		~OwnerLock()
+		{
+			if (m_queue)
+				mutexUnlock(&m_queue->m_submitMutex);
+		}
+	};
 };
 
 }
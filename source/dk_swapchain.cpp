@@ -3,6 +3,7 @@
 #include "dk_memblock.h"
 #include "dk_queue.h"
 #include "dk_image.h"
+#include "dk_trace.h"
 
 using namespace dk::detail;
 using namespace maxwell;
@@ -108,6 +109,7 @@ Swapchain::~Swapchain()
 
 void Swapchain::acquireImage(int& imageSlot, DkFence& fence)
 {
+	TraceScope trace{TraceEvent::SwapchainAcquire};
 	fence.m_type = DkFence::External;
 	if (R_FAILED(nwindowDequeueBuffer(m_nwin, &imageSlot, &fence.m_external.m_fence)))
 		DK_ERROR(DkResult_Fail, "failed to dequeue buffer");
@@ -115,6 +117,7 @@ void Swapchain::acquireImage(int& imageSlot, DkFence& fence)
 
 void Swapchain::presentImage(int imageSlot, DkFence const& fence)
 {
+	TraceScope trace{TraceEvent::SwapchainPresent, uint32_t(imageSlot)};
 	NvMultiFence nvfence = {};
 	nvMultiFenceCreate(&nvfence, &fence.m_internal.m_fence);
 	if (R_FAILED(nwindowQueueBuffer(m_nwin, imageSlot, &nvfence)))
@@ -191,6 +194,7 @@ int dkQueueAcquireImage(DkQueue obj, DkSwapchain swapchain)
 	if (obj->isInErrorState())
 		DK_ERROR(DkResult_Fail, "attempted to acquire image using a queue in error state");
 
+	Queue::OwnerLock lock{obj};
 	int imageSlot;
 	DkFence fence;
 	swapchain->acquireImage(imageSlot, fence);
@@ -205,6 +209,7 @@ void dkQueuePresentImage(DkQueue obj, DkSwapchain swapchain, int imageSlot)
 	if (obj->isInErrorState())
 		DK_ERROR(DkResult_Fail, "attempted to present image using a queue in error state");
 
+	Queue::OwnerLock lock{obj};
 	DkImage const* image = swapchain->getImage(imageSlot);
 	if (image->m_flags & DkImageFlags_HwCompression)
 	{
@@ -0,0 +1,162 @@
+#include <stdarg.h>
+#include "dk_trace.h"
+
+using namespace dk::detail;
+
+bool dk::detail::g_traceEnabled;
+
+namespace
+{
+	constexpr uint32_t s_maxTraceThreads = 32;
+	constexpr uint32_t s_numTraceRecords = 4096; // per thread
+	static_assert((s_numTraceRecords & (s_numTraceRecords - 1)) == 0, "Number of records must be a power of two");
+
+	// Single-producer ring owned by a thread. Older records are overwritten once the ring is full.
+	struct TraceRing
+	{
+		uint32_t head;     // number of records written so far (only written by the owner thread)
+		uint32_t clearPos; // value of head when the trace was last cleared
+		TraceRecord records[s_numTraceRecords];
+	};
+
+	// Rings are allocated on the first event recorded by each thread, and kept for the lifetime of
+	// the process. Threads beyond the maximum don't get a ring, and their events are dropped.
+	TraceRing* g_traceRings[s_maxTraceThreads];
+	uint32_t g_numTraceRings;
+	thread_local TraceRing* t_traceRing;
+	thread_local bool t_traceRingFailed;
+
+	constexpr const char* s_traceEventNames[] =
+	{
+		"QueueSubmit",
+		"QueueFlush",
+		"QueueKickoff",
+		"QueueSignal",
+		"QueueWaitFence",
+		"QueueFenceRingWait",
+		"QueueCmdMemWait",
+		"QueueError",
+		"FenceWait",
+		"ErrorCheck",
+		"SwapchainAcquire",
+		"SwapchainPresent",
+	};
+	static_assert(sizeof(s_traceEventNames)/sizeof(s_traceEventNames[0]) == size_t(TraceEvent::Count), "Missing trace event names");
+
+	TraceRing* claimTraceRing()
+	{
+		if (t_traceRingFailed)
+			return nullptr;
+
+		uint32_t id = __atomic_fetch_add(&g_numTraceRings, 1, __ATOMIC_RELAXED);
+		TraceRing* ring = nullptr;
+		if (id < s_maxTraceThreads)
+			ring = static_cast<TraceRing*>(calloc(1, sizeof(TraceRing)));
+		if (!ring)
+		{
+			t_traceRingFailed = true;
+			return nullptr;
+		}
+
+		__atomic_store_n(&g_traceRings[id], ring, __ATOMIC_RELEASE);
+		t_traceRing = ring;
+		return ring;
+	}
+
+	class JsonWriter
+	{
+		DkTraceWriteFunc m_func;
+		void* m_userData;
+	public:
+		JsonWriter(DkTraceWriteFunc func, void* userData) : m_func{func}, m_userData{userData} { }
+
+		__attribute__((format(printf, 2, 3)))
+		void print(const char* fmt, ...)
+		{
+			char buf[256];
+			va_list va;
+			va_start(va, fmt);
+			int len = vsnprintf(buf, sizeof(buf), fmt, va);
+			va_end(va);
+			if (len > 0)
+				m_func(m_userData, buf, (size_t)len < sizeof(buf) ? len : sizeof(buf)-1);
+		}
+	};
+}
+
+void dk::detail::TraceWrite(TraceEvent event, TracePhase phase, uint32_t arg) noexcept
+{
+	TraceRing* ring = t_traceRing;
+	if (!ring && !(ring = claimTraceRing()))
+		return;
+
+	uint32_t pos = ring->head;
+	TraceRecord& rec = ring->records[pos & (s_numTraceRecords - 1)];
+	rec.timestamp = armGetSystemTick();
+	rec.event = event;
+	rec.phase = phase;
+	rec.arg = arg;
+	__atomic_store_n(&ring->head, pos+1, __ATOMIC_RELEASE);
+}
+
+void dkTraceSetEnabled(bool enable)
+{
+	__atomic_store_n(&g_traceEnabled, enable, __ATOMIC_RELAXED);
+}
+
+void dkTraceClear(void)
+{
+	uint32_t numRings = __atomic_load_n(&g_numTraceRings, __ATOMIC_RELAXED);
+	if (numRings > s_maxTraceThreads)
+		numRings = s_maxTraceThreads;
+
+	for (uint32_t i = 0; i < numRings; i ++)
+	{
+		TraceRing* ring = __atomic_load_n(&g_traceRings[i], __ATOMIC_ACQUIRE);
+		if (ring)
+			ring->clearPos = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	}
+}
+
+void dkTraceExportJson(DkTraceWriteFunc func, void* userData)
+{
+	// Events are exported in the Chrome trace event format, which is also understood by Perfetto.
+	// Records that are being overwritten by their thread during the export may come out garbled,
+	// so for a consistent snapshot tracing should be disabled first.
+	JsonWriter w{func, userData};
+	w.print("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	uint32_t numRings = __atomic_load_n(&g_numTraceRings, __ATOMIC_RELAXED);
+	if (numRings > s_maxTraceThreads)
+		numRings = s_maxTraceThreads;
+
+	bool first = true;
+	for (uint32_t i = 0; i < numRings; i ++)
+	{
+		TraceRing* ring = __atomic_load_n(&g_traceRings[i], __ATOMIC_ACQUIRE);
+		if (!ring)
+			continue;
+
+		uint32_t end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint32_t start = ring->clearPos;
+		if (end - start > s_numTraceRecords)
+			start = end - s_numTraceRecords;
+
+		for (uint32_t pos = start; pos != end; pos ++)
+		{
+			TraceRecord const& rec = ring->records[pos & (s_numTraceRecords - 1)];
+			if (rec.event >= TraceEvent::Count)
+				continue;
+
+			static constexpr char s_phases[] = { 'i', 'B', 'E' };
+			uint64_t ns = armTicksToNs(rec.timestamp);
+			w.print("%s{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%lu.%03u,\"pid\":1,\"tid\":%u,\"args\":{\"arg\":%u}}",
+				first ? "" : ",", s_traceEventNames[unsigned(rec.event)], s_phases[rec.phase % 3],
+				rec.phase == TracePhase_Instant ? "\"s\":\"t\"," : "",
+				ns / 1000, unsigned(ns % 1000), i+1, rec.arg);
+			first = false;
+		}
+	}
+
+	w.print("]}\n");
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "dk_private.h"
+
+namespace dk::detail
+{
+	// Binary trace events recorded by the library (see dkTraceSetEnabled). Each thread appends to its
+	// own ring of records, so recording an event consists of a handful of stores and no locking.
+	enum class TraceEvent : uint16_t
+	{
+		QueueSubmit,
+		QueueFlush,
+		QueueKickoff,
+		QueueSignal,
+		QueueWaitFence,
+		QueueFenceRingWait,
+		QueueCmdMemWait,
+		QueueError,
+		FenceWait,
+		ErrorCheck,
+		SwapchainAcquire,
+		SwapchainPresent,
+
+		Count
+	};
+
+	enum TracePhase : uint8_t
+	{
+		TracePhase_Instant,
+		TracePhase_Begin,
+		TracePhase_End,
+	};
+
+	struct TraceRecord
+	{
+		uint64_t timestamp; // system ticks
+		TraceEvent event;
+		TracePhase phase;
+		uint32_t arg;
+	};
+
+	extern bool g_traceEnabled;
+	void TraceWrite(TraceEvent event, TracePhase phase, uint32_t arg) noexcept;
+
+	inline bool IsTraceEnabled() noexcept
+	{
+		return __builtin_expect(__atomic_load_n(&g_traceEnabled, __ATOMIC_RELAXED), false);
+	}
+
+	inline void Trace(TraceEvent event, uint32_t arg = 0) noexcept
+	{
+		if (IsTraceEnabled())
+			TraceWrite(event, TracePhase_Instant, arg);
+	}
+
+	// Records a begin/end pair around a scope
+	class TraceScope
+	{
+		TraceEvent m_event;
+		uint32_t m_arg;
+		bool m_active;
+	public:
+		TraceScope(TraceEvent event, uint32_t arg = 0) noexcept :
+			m_event{event}, m_arg{arg}, m_active{IsTraceEnabled()}
+		{
+			if (m_active)
+				TraceWrite(m_event, TracePhase_Begin, m_arg);
+		}
+
+		~TraceScope()
+		{
+			if (m_active)
+				TraceWrite(m_event, TracePhase_End, m_arg);
+		}
+	};
+}
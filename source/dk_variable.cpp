@@ -139,7 +139,7 @@ void dkVariableSignal(DkVariable const* obj, DkVarOp op, uint32_t value)
 			__atomic_xor_fetch(obj->m_cpuAddr, value, __ATOMIC_SEQ_CST);
 			break;
 	}
-	__asm__ __volatile__("dmb\tst" ::: "memory"); // "DMB operation that waits only for stores to complete." i.e. so that it is visible to the GPU
+	GpuStoreBarrier();
 }
 
 void dkCmdBufWaitVariable(DkCmdBuf obj, DkVariable const* var, DkVarCompareOp op, uint32_t value)
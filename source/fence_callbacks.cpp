@@ -0,0 +1,235 @@
+#include "dk_device.h"
+
+using namespace dk::detail;
+
+bool FenceCallbacks::isComplete(Entry& e)
+{
+	if (e.pendingFence)
+	{
+		// Pick up the contents of the fence once its queue has processed the signal operation
+		if (__atomic_load_n(&e.pendingFence->m_type, __ATOMIC_ACQUIRE) == DkFence::Pending)
+			return false;
+		e.fence = *e.pendingFence;
+		e.pendingFence = nullptr;
+	}
+
+	switch (e.fence.m_type)
+	{
+		default:
+		case DkFence::Empty:
+			return true;
+		case DkFence::Internal:
+			return e.fence.internalPoll();
+		case DkFence::External:
+			return R_SUCCEEDED(nvMultiFenceWait(&e.fence.m_external.m_fence, 0));
+	}
+}
+
+bool FenceCallbacks::start()
+{
+	// Use the same priority as the thread registering the first callback
+	s32 prio = 0x2C;
+	svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+	if (R_FAILED(threadCreate(&m_thread, _threadFunc, this, nullptr, s_threadStackSize, prio, -2)))
+		return false;
+	if (R_FAILED(threadStart(&m_thread)))
+	{
+		threadClose(&m_thread);
+		return false;
+	}
+	__atomic_store_n(&m_started, true, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool FenceCallbacks::completesBefore(Entry const& a, Entry const& b)
+{
+	// Internal fences signaled by the same queue complete in order. Across queues, the fence with the
+	// fewest signals left to go is the most likely to complete first.
+	if (a.fence.m_type != DkFence::Internal || b.fence.m_type != DkFence::Internal)
+		return false;
+	uint32_t leftA = a.fence.m_internal.m_semaphoreValue - *a.fence.m_internal.m_semaphoreCpuAddr;
+	uint32_t leftB = b.fence.m_internal.m_semaphoreValue - *b.fence.m_internal.m_semaphoreCpuAddr;
+	return leftA < leftB;
+}
+
+uint32_t FenceCallbacks::pickNextToComplete(bool& coversAll) const
+{
+	uint32_t next = m_numEntries;
+	for (uint32_t i = 0; i < m_numEntries; i ++)
+		if (!m_entries[i].pendingFence && (next == m_numEntries || completesBefore(m_entries[i], m_entries[next])))
+			next = i;
+
+	// The wait can only be long if nothing else could complete in the meantime: all other fences
+	// must be signaled later by the same queue
+	coversAll = next < m_numEntries && m_entries[next].fence.m_type == DkFence::Internal;
+	for (uint32_t i = 0; coversAll && i < m_numEntries; i ++)
+	{
+		Entry const& e = m_entries[i];
+		coversAll = i == next || (!e.pendingFence && e.fence.m_type == DkFence::Internal &&
+			e.fence.m_internal.m_semaphoreCpuAddr == m_entries[next].fence.m_internal.m_semaphoreCpuAddr &&
+			!completesBefore(e, m_entries[next]));
+	}
+	return next;
+}
+
+void FenceCallbacks::waitForProgress(Entry const& e, s32 timeout_us)
+{
+	switch (e.fence.m_type)
+	{
+		default:
+			break;
+		case DkFence::Internal:
+		{
+			NvFence fence = e.fence.m_internal.m_fence;
+			nvFenceWait(&fence, timeout_us);
+			m_device->checkQueueErrors();
+			break;
+		}
+		case DkFence::External:
+		{
+			NvMultiFence fence = e.fence.m_external.m_fence;
+			nvMultiFenceWait(&fence, timeout_us);
+			break;
+		}
+	}
+}
+
+void FenceCallbacks::threadMain()
+{
+	Entry batch[s_maxBatchSize];
+
+	mutexLock(&m_mutex);
+	for (;;)
+	{
+		while (!m_numEntries && !m_exit)
+			condvarWait(&m_condVar, &m_mutex);
+		if (m_exit)
+			break;
+
+		// Take out the callbacks whose fences have completed, keeping the rest in registration order
+		uint32_t numDone = 0, numKept = 0;
+		for (uint32_t i = 0; i < m_numEntries; i ++)
+		{
+			Entry& e = m_entries[i];
+			if (numDone < s_maxBatchSize && isComplete(e))
+				batch[numDone++] = e;
+			else
+				m_entries[numKept++] = e;
+		}
+		m_numEntries = numKept;
+
+		// Pick the fence to wait on if nothing completed
+		Entry next;
+		bool coversAll = false;
+		if (!numDone)
+		{
+			uint32_t nextId = pickNextToComplete(coversAll);
+			if (nextId == m_numEntries)
+			{
+				// All fences are yet to be processed by their queues: sleep until a queue resolves
+				// a pending fence (see notifyFenceResolved) or another callback is added
+				condvarWaitTimeout(&m_condVar, &m_mutex, 100000000); // 10^8 ns = 100 ms
+				continue;
+			}
+			next = m_entries[nextId];
+		}
+		mutexUnlock(&m_mutex);
+
+		if (numDone)
+		{
+			for (uint32_t i = 0; i < numDone; i ++)
+				batch[i].callback(batch[i].userData);
+		}
+		else
+		{
+			// Nothing completed: block on the fence that completes first. The GPU wait can't be
+			// interrupted by add() or notifyFenceResolved, so it is kept shorter whenever another
+			// callback (including a pending one) could become ready before that fence.
+			waitForProgress(next, coversAll ? s_longWaitUs : s_shortWaitUs);
+		}
+
+		mutexLock(&m_mutex);
+	}
+	mutexUnlock(&m_mutex);
+}
+
+void FenceCallbacks::add(DkFence* fence, DkFenceCallbackFunc callback, void* userData)
+{
+	MutexHolder m{m_mutex};
+
+	if (!m_started && !start())
+	{
+		DK_ERROR(DkResult_Fail, "failed to start fence callback thread");
+		return;
+	}
+
+	if (m_numEntries == m_capacity)
+	{
+		uint32_t newCapacity = m_capacity ? 2*m_capacity : s_initialCapacity;
+		Entry* newEntries = static_cast<Entry*>(m_device->allocMem(newCapacity*sizeof(Entry)));
+		if (!newEntries)
+		{
+			DK_ERROR(DkResult_OutOfMemory, "failed to allocate fence callback entries");
+			return;
+		}
+		if (m_entries)
+		{
+			memcpy(newEntries, m_entries, m_numEntries*sizeof(Entry));
+			m_device->freeMem(m_entries);
+		}
+		m_entries = newEntries;
+		m_capacity = newCapacity;
+	}
+
+	Entry& e = m_entries[m_numEntries++];
+	e.pendingFence = __atomic_load_n(&fence->m_type, __ATOMIC_ACQUIRE) == DkFence::Pending ? fence : nullptr;
+	e.fence = *fence;
+	e.callback = callback;
+	e.userData = userData;
+	condvarWakeOne(&m_condVar);
+}
+
+void FenceCallbacks::notifyFenceResolved()
+{
+	if (!__atomic_load_n(&m_started, __ATOMIC_ACQUIRE))
+		return;
+
+	// Taking the mutex ensures the thread is either asleep or yet to check the fence
+	mutexLock(&m_mutex);
+	condvarWakeOne(&m_condVar);
+	mutexUnlock(&m_mutex);
+}
+
+void FenceCallbacks::shutdown()
+{
+	if (m_started)
+	{
+		mutexLock(&m_mutex);
+		m_exit = true;
+		condvarWakeOne(&m_condVar);
+		mutexUnlock(&m_mutex);
+		threadWaitForExit(&m_thread);
+		threadClose(&m_thread);
+		m_started = false;
+	}
+
+	// All queues are gone at this point, so run whatever is left
+	for (uint32_t i = 0; i < m_numEntries; i ++)
+		m_entries[i].callback(m_entries[i].userData);
+	m_numEntries = 0;
+
+	if (m_entries)
+	{
+		m_device->freeMem(m_entries);
+		m_entries = nullptr;
+		m_capacity = 0;
+	}
+}
+
+void dkFenceOnComplete(DkFence* obj, DkDevice device, DkFenceCallbackFunc callback, void* userData)
+{
+	DK_ENTRYPOINT(device);
+	DK_DEBUG_NON_NULL(obj);
+	DK_DEBUG_NON_NULL(callback);
+	device->getFenceCallbacks().add(obj, callback, userData);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "dk_private.h"
+#include "dk_fence.h"
+
+namespace dk::detail
+{
+	// Runs callbacks registered with dkFenceOnComplete once their fences are signaled. The work is
+	// done by a thread owned by the device, which is only started when the first callback is added.
+	// Whenever the thread wakes up it processes all callbacks whose fences completed in the meantime.
+	class FenceCallbacks
+	{
+		static constexpr size_t s_threadStackSize = 0x8000;
+		static constexpr uint32_t s_initialCapacity = 16;
+		static constexpr uint32_t s_maxBatchSize = 32;
+		// GPU waits can't be interrupted, so these bound how late a newly added callback is noticed
+		static constexpr s32 s_longWaitUs = 10000; // 10 ms, when one fence covers all callbacks
+		static constexpr s32 s_shortWaitUs = 2000; // 2 ms, when other callbacks may complete first
+
+		struct Entry
+		{
+			DkFence fence;
+			DkFence* pendingFence; // set while the fence is still pending on a thread-safe queue (must outlive that)
+			DkFenceCallbackFunc callback;
+			void* userData;
+		};
+
+		DkDevice m_device;
+		Mutex m_mutex;
+		CondVar m_condVar;
+		Thread m_thread;
+		Entry* m_entries;
+		uint32_t m_numEntries;
+		uint32_t m_capacity;
+		bool m_started;
+		bool m_exit;
+
+		static bool isComplete(Entry& e) noexcept;
+		static bool completesBefore(Entry const& a, Entry const& b) noexcept;
+		static void _threadFunc(void* arg) noexcept
+		{
+			static_cast<FenceCallbacks*>(arg)->threadMain();
+		}
+
+		bool start() noexcept;
+		void threadMain() noexcept;
+		uint32_t pickNextToComplete(bool& coversAll) const noexcept;
+		void waitForProgress(Entry const& e, s32 timeout_us) noexcept;
+
+	public:
+		constexpr FenceCallbacks(DkDevice device) noexcept :
+			m_device{device}, m_mutex{}, m_condVar{}, m_thread{},
+			m_entries{}, m_numEntries{}, m_capacity{}, m_started{}, m_exit{} { }
+
+		void add(DkFence* fence, DkFenceCallbackFunc callback, void* userData) noexcept;
+		void notifyFenceResolved() noexcept; // called when a queue resolves a pending fence
+		void shutdown() noexcept;
+	};
+}
@@ -1,10 +1,12 @@
 #include "dk_device.h"
 #include "dk_queue.h"
+#include "dk_trace.h"
 
 using namespace dk::detail;
 
 void Device::checkQueueErrors() noexcept
 {
+	Trace(TraceEvent::ErrorCheck);
 	MutexHolder m{m_queueTableMutex};
 	for (unsigned i = 0; i < s_numQueues; i ++)
 	{
@@ -19,6 +21,7 @@ bool Queue::checkError()
 	if (R_FAILED(nvGpuChannelGetErrorNotification(&m_gpuChannel, &notif)) || !notif.status)
 		return false; // No error
 
+	Trace(TraceEvent::QueueError, m_id);
 	DK_WARNING("Queue (%u) entered error state", m_id);
 	DK_WARNING("  timestamp: %lu", notif.timestamp);
 	DK_WARNING("  info32: %u", notif.info32);
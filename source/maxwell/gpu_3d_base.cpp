@@ -18,6 +18,12 @@ using SRC = E::MmeShadowRamControl;
 
 namespace
 {
+	// Multi-draws are split into several macro calls so that each of them needs a reasonable amount of command memory
+	constexpr uint32_t s_maxDrawsPerMacroCall = 64;
+
+	// Same for indirect multi-draws (here the limit comes from the size of the macro call, since the draw parameters don't take up command memory)
+	constexpr uint32_t s_maxDrawsPerIndirectCountCall = 1024;
+
 	constexpr auto SetShadowRamControl(unsigned mode)
 	{
 		return CmdInline(3D, MmeShadowRamControl{}, mode);
@@ -54,6 +60,38 @@ namespace
 			info.m_horizontal, info.m_vertical,
 			info.m_format, info.m_tileMode, info.m_arrayMode, info.m_layerStride);
 	}
+
+	template <typename T>
+	void DrawIndirectCount(DkCmdBuf obj, unsigned macro, DkPrimitive prim, DkGpuAddr indirect, uint32_t stride, DkGpuAddr countAddr, uint32_t maxDrawCount)
+	{
+		static constexpr uint32_t numWordsPerDraw = sizeof(T)/sizeof(uint32_t);
+		CmdBufWriter w{obj};
+		w.reserve(1);
+		w << MacroInline(SelectDriverConstbuf, 0); // needed for updating gl_BaseVertex/gl_BaseInstance/gl_DrawID in the driver constbuf
+
+		for (uint32_t firstDraw = 0; firstDraw < maxDrawCount; firstDraw += s_maxDrawsPerIndirectCountCall)
+		{
+			uint32_t batchSize = maxDrawCount - firstDraw;
+			if (batchSize > s_maxDrawsPerIndirectCountCall)
+				batchSize = s_maxDrawsPerIndirectCountCall;
+
+			// The macro parameters that follow the ones below (draw count, draw parameter sets) are fetched from GPU memory
+			w.reserve(4);
+			w << CmdList<4>{ MakeCmdHeader(IncreaseOnce, 4 + batchSize*numWordsPerDraw, Subchannel3D, macro), prim, batchSize, firstDraw };
+			w.split(CtrlCmdGpfifoEntry::NoPrefetch);
+			w.addRaw(countAddr, 1, CtrlCmdGpfifoEntry::NoPrefetch);
+
+			DkGpuAddr batchAddr = indirect + uint64_t(firstDraw)*stride;
+			if (stride == sizeof(T))
+				w.addRaw(batchAddr, batchSize*numWordsPerDraw, CtrlCmdGpfifoEntry::AutoKick);
+			else for (uint32_t i = 0; i < batchSize; i ++)
+			{
+				// Padded parameter sets need one gpfifo entry each
+				bool isLast = (i+1) == batchSize;
+				w.addRaw(batchAddr + i*stride, numWordsPerDraw, isLast ? CtrlCmdGpfifoEntry::AutoKick : CtrlCmdGpfifoEntry::NoPrefetch);
+			}
+		}
+	}
 }
 
 void Queue::setup3DEngine()
@@ -583,3 +621,81 @@ void dkCmdBufDrawIndexedIndirect(DkCmdBuf obj, DkPrimitive prim, DkGpuAddr indir
 	w.split(CtrlCmdGpfifoEntry::NoPrefetch);
 	w.addRaw(indirect, 5, CtrlCmdGpfifoEntry::AutoKick);
 }
+
+void dkCmdBufMultiDraw(DkCmdBuf obj, DkPrimitive prim, DkDrawIndirectData const draws[], uint32_t numDraws)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL_ARRAY(draws, numDraws);
+	if (!numDraws)
+		return;
+
+	CmdBufWriter w{obj};
+	w.reserve(1);
+	w << MacroInline(SelectDriverConstbuf, 0); // needed for updating gl_BaseInstance/gl_DrawID in the driver constbuf
+
+	for (uint32_t firstDraw = 0; firstDraw < numDraws; firstDraw += s_maxDrawsPerMacroCall)
+	{
+		uint32_t batchSize = numDraws - firstDraw;
+		if (batchSize > s_maxDrawsPerMacroCall)
+			batchSize = s_maxDrawsPerMacroCall;
+
+		uint32_t numParams = 3 + batchSize*sizeof(DkDrawIndirectData)/4;
+		w.reserve(1+numParams);
+		w << CmdList<4>{ MakeCmdHeader(IncreaseOnce, numParams, Subchannel3D, MmeMacroMultiDraw), prim, batchSize, firstDraw };
+		w.addRawData(&draws[firstDraw], batchSize*sizeof(DkDrawIndirectData));
+	}
+}
+
+void dkCmdBufMultiDrawIndexed(DkCmdBuf obj, DkPrimitive prim, DkDrawIndexedIndirectData const draws[], uint32_t numDraws)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_NON_NULL_ARRAY(draws, numDraws);
+	if (!numDraws)
+		return;
+
+	CmdBufWriter w{obj};
+	w.reserve(1);
+	w << MacroInline(SelectDriverConstbuf, 0); // needed for updating gl_BaseVertex/gl_BaseInstance/gl_DrawID in the driver constbuf
+
+	for (uint32_t firstDraw = 0; firstDraw < numDraws; firstDraw += s_maxDrawsPerMacroCall)
+	{
+		uint32_t batchSize = numDraws - firstDraw;
+		if (batchSize > s_maxDrawsPerMacroCall)
+			batchSize = s_maxDrawsPerMacroCall;
+
+		uint32_t numParams = 3 + batchSize*sizeof(DkDrawIndexedIndirectData)/4;
+		w.reserve(1+numParams);
+		w << CmdList<4>{ MakeCmdHeader(IncreaseOnce, numParams, Subchannel3D, MmeMacroMultiDrawIndexed), prim, batchSize, firstDraw };
+		w.addRawData(&draws[firstDraw], batchSize*sizeof(DkDrawIndexedIndirectData));
+	}
+}
+
+void dkCmdBufDrawIndirectCount(DkCmdBuf obj, DkPrimitive prim, DkGpuAddr indirect, uint32_t stride, DkGpuAddr countAddr, uint32_t maxDrawCount)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_BAD_INPUT(indirect == DK_GPU_ADDR_INVALID);
+	DK_DEBUG_BAD_INPUT(countAddr == DK_GPU_ADDR_INVALID);
+	DK_DEBUG_DATA_ALIGN(indirect, 4);
+	DK_DEBUG_DATA_ALIGN(countAddr, 4);
+	DK_DEBUG_BAD_INPUT(stride < sizeof(DkDrawIndirectData), "stride must not be smaller than DkDrawIndirectData");
+	DK_DEBUG_SIZE_ALIGN(stride, 4);
+	if (!maxDrawCount)
+		return;
+
+	DrawIndirectCount<DkDrawIndirectData>(obj, MmeMacroDrawIndirectCount, prim, indirect, stride, countAddr, maxDrawCount);
+}
+
+void dkCmdBufDrawIndexedIndirectCount(DkCmdBuf obj, DkPrimitive prim, DkGpuAddr indirect, uint32_t stride, DkGpuAddr countAddr, uint32_t maxDrawCount)
+{
+	DK_ENTRYPOINT(obj);
+	DK_DEBUG_BAD_INPUT(indirect == DK_GPU_ADDR_INVALID);
+	DK_DEBUG_BAD_INPUT(countAddr == DK_GPU_ADDR_INVALID);
+	DK_DEBUG_DATA_ALIGN(indirect, 4);
+	DK_DEBUG_DATA_ALIGN(countAddr, 4);
+	DK_DEBUG_BAD_INPUT(stride < sizeof(DkDrawIndexedIndirectData), "stride must not be smaller than DkDrawIndexedIndirectData");
+	DK_DEBUG_SIZE_ALIGN(stride, 4);
+	if (!maxDrawCount)
+		return;
+
+	DrawIndirectCount<DkDrawIndexedIndirectData>(obj, MmeMacroDrawIndexedIndirectCount, prim, indirect, stride, countAddr, maxDrawCount);
+}
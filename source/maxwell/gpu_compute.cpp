@@ -3,7 +3,9 @@
 #include "../queue_compute.h"
 #include "../cmdbuf_writer.h"
 
+#include "engine_3d.h"
 #include "engine_compute.h"
+#include "engine_gpfifo.h"
 
 using namespace maxwell;
 using namespace dk::detail;
@@ -26,6 +28,62 @@ namespace
 		);
 		w << CmdList<1>{ MakeCmdHeader(NonIncreasing, (sizeBytes + 3) / 4, SubchannelCompute, C::LoadInlineData{}) };
 	}
+
+	constexpr uint32_t s_inlineCopyOverhead = 7;
+	constexpr uint32_t s_maxDeltaRanges = 8;
+
+	// Uploads the words of a job that differ from the ones the job slot already holds. Changed words
+	// separated by fewer unchanged words than the cost of a new inline copy are uploaded together,
+	// and if the delta doesn't turn out to be cheaper the whole job is uploaded instead.
+	// Uses at most 7 + numWords command words, and returns the number of job words uploaded.
+	template <bool Arg>
+	uint32_t UploadJob(CmdBufWriter<Arg>& w, const void* job, const void* shadow, uint32_t numWords, DkGpuAddr target)
+	{
+		auto* cur = static_cast<const uint32_t*>(job);
+		auto* old = static_cast<const uint32_t*>(shadow);
+		struct { uint32_t start, end; } ranges[s_maxDeltaRanges];
+		uint32_t numRanges = 0, cost = 0;
+
+		for (uint32_t i = 0; old && i < numWords; i ++)
+		{
+			if (cur[i] == old[i])
+				continue;
+
+			auto* last = numRanges ? &ranges[numRanges-1] : nullptr;
+			if (last && (i - last->end) < s_inlineCopyOverhead)
+			{
+				cost += i + 1 - last->end;
+				last->end = i + 1;
+			}
+			else if (numRanges < s_maxDeltaRanges)
+			{
+				cost += s_inlineCopyOverhead + 1;
+				ranges[numRanges++] = { i, i + 1 };
+			}
+			else
+			{
+				old = nullptr; // too fragmented
+				break;
+			}
+		}
+
+		if (!old || cost >= s_inlineCopyOverhead + numWords)
+		{
+			PrepareInlineCopy(w, numWords*4, target);
+			w.addRawData(cur, numWords*4);
+			return numWords;
+		}
+
+		uint32_t numUploaded = 0;
+		for (uint32_t i = 0; i < numRanges; i ++)
+		{
+			uint32_t size = ranges[i].end - ranges[i].start;
+			PrepareInlineCopy(w, size*4, target + ranges[i].start*4);
+			w.addRawData(&cur[ranges[i].start], size*4);
+			numUploaded += size;
+		}
+		return numUploaded;
+	}
 }
 
 void ComputeQueue::initQmd()
@@ -37,6 +95,14 @@ void ComputeQueue::initQmd()
 	job.qmd.qmd_major_version = 1;
 }
 
+void ComputeQueue::initJobQueue()
+{
+	uint32_t numJobs = m_parent.m_workBuf.getComputeJobsCount();
+	m_jobsPerChunk = (numJobs + s_numJobChunks - 1) / s_numJobChunks;
+	for (uint32_t i = 0; i < numJobs; i ++)
+		m_jobShadows[i].valid = false;
+}
+
 void ComputeQueue::initComputeEngine()
 {
 	DkDevice dev = m_parent.getDevice();
@@ -130,38 +196,81 @@ void ComputeQueue::bindShader(CtrlCmdComputeShader const* cmd)
 void ComputeQueue::dispatch(uint32_t numGroupsX, uint32_t numGroupsY, uint32_t numGroupsZ, DkGpuAddr indirect)
 {
 	CmdBufWriter w{&m_parent.m_cmdBuf};
-	w.reserve(7 + s_jobSizeWords + 7*3 + 3);
-
-	uint32_t jobId = m_curJob;
-	if (jobId >= m_parent.m_workBuf.getComputeJobsCount())
-	{
-		// We ran out of slots in the job queue, so now we need to wait for
-		// all previous jobs to finish and start over from the beginning
-		using ISC = C::InvalidateShaderCaches;
-		w << CmdInline(Compute, WaitForIdle{}, 0);
-		w << CmdInline(Compute, InvalidateShaderCaches{}, ISC::Constant{}); // we're overwriting old cbufs so invalidate this too
-		jobId = 0;
-	}
-	m_curJob = jobId + 1; // advance the job counter
-
-	// Calculate the address to the job within the queue
-	DkGpuAddr jobAddr = m_parent.m_workBuf.getComputeJobs();
-	jobAddr += jobId * s_jobSizeAlign;
+	w.reserve(6 + 7 + s_jobSizeWords + 7*3 + 3 + 7);
 
 	// Update grid dimension parameters in the QMD
 	job.qmd.cta_raster_width  = numGroupsX;
 	job.qmd.cta_raster_height = numGroupsY;
 	job.qmd.cta_raster_depth  = numGroupsZ;
-	bindConstbuf(0, jobAddr + sizeof(ComputeQmd), ComputeDriverCbufSize);
 
 	// Update grid dimension parameters in the driver constbuf
 	job.cbuf.gridSize[0] = numGroupsX;
 	job.cbuf.gridSize[1] = numGroupsY;
 	job.cbuf.gridSize[2] = numGroupsZ;
 
-	// Time to copy the job to the job queue!
-	PrepareInlineCopy(w, s_jobSizeBytes, jobAddr);
-	w.addRawData(&job, s_jobSizeBytes);
+	uint32_t numJobs = m_parent.m_workBuf.getComputeJobsCount();
+	DkGpuAddr jobsBase = m_parent.m_workBuf.getComputeJobs();
+	uint32_t jobId = m_curJob;
+
+	// If the previous job slot holds the very same job (i.e. the same dispatch is repeated with no
+	// state changes in between), simply launch it again instead of taking up a new slot.
+	bool relaunch = false;
+	if (indirect == DK_GPU_ADDR_INVALID && jobId && m_jobShadows[jobId-1].valid)
+	{
+		DkGpuAddr prevJobAddr = jobsBase + (jobId-1) * s_jobSizeAlign;
+		bindConstbuf(0, prevJobAddr + sizeof(ComputeQmd), ComputeDriverCbufSize);
+		relaunch = memcmp(&m_jobShadows[jobId-1].job, &job, s_jobSizeBytes) == 0;
+	}
+
+	if (relaunch)
+		jobId --;
+	else
+	{
+		if (jobId >= numJobs)
+			jobId = 0; // wrap around to the beginning of the job queue
+		m_curJob = jobId + 1; // advance the job counter
+	}
+
+	// When entering a chunk that was used before, the jobs that previously occupied it need to be
+	// complete before they are overwritten. Instead of waiting for the GPU to idle, wait only for the
+	// semaphore released after them - and not even that if the timeline says they are already done.
+	JobChunk& chunk = m_jobChunks[jobId / m_jobsPerChunk];
+	if (!relaunch && (jobId % m_jobsPerChunk) == 0 && chunk.timelineValue)
+	{
+		using S = EngineGpfifo::Semaphore;
+		using ISC = C::InvalidateShaderCaches;
+		if (m_parent.getCompletedValue() < chunk.timelineValue)
+		{
+			w << Cmd(Gpfifo, SemaphoreOffset{},
+				Iova(m_parent.m_workBuf.getComputeJobsSemaphore()),
+				chunk.semValue,
+				S::Operation::AcqGeq | S::AcquireSwitch{}
+			);
+			if (m_parent.hasStats())
+				m_parent.m_stats.numComputeJobRingWraps ++;
+		}
+		w << CmdInline(Compute, InvalidateShaderCaches{}, ISC::Constant{}); // we're overwriting old cbufs so invalidate this too
+	}
+
+	// Calculate the address to the job within the queue
+	DkGpuAddr jobAddr = jobsBase + jobId * s_jobSizeAlign;
+
+	if (!relaunch)
+	{
+		bindConstbuf(0, jobAddr + sizeof(ComputeQmd), ComputeDriverCbufSize);
+
+		// Time to copy the job to the job queue! Only the words that changed since the last time
+		// this slot was uploaded need to be sent.
+		JobShadow& shadow = m_jobShadows[jobId];
+		uint32_t numWords = UploadJob(w, &job, shadow.valid ? &shadow.job : nullptr, s_jobSizeWords, jobAddr);
+		memcpy(&shadow.job, &job, s_jobSizeBytes);
+		shadow.valid = indirect == DK_GPU_ADDR_INVALID; // the GPU patches the grid size below
+
+		if (m_parent.hasStats())
+			m_parent.m_stats.numComputeJobWords += numWords;
+	}
+	else if (m_parent.hasStats())
+		m_parent.m_stats.numComputeJobRelaunches ++;
 
 	if (indirect != DK_GPU_ADDR_INVALID)
 	{
@@ -190,4 +299,20 @@ void ComputeQueue::dispatch(uint32_t numGroupsX, uint32_t numGroupsY, uint32_t n
 	w << CmdInline(Compute, SendSignalingPcasB{},
 		C::SendSignalingPcasB::Invalidate{} | C::SendSignalingPcasB::Schedule{}
 	);
+
+	// Release the chunk's semaphore after its last job (again, if it was relaunched)
+	if (((jobId + 1) % m_jobsPerChunk) == 0 || (jobId + 1) == numJobs)
+	{
+		using S = Engine3D::SetReportSemaphore;
+		chunk.semValue = ++m_jobSemValue;
+		chunk.timelineValue = m_parent.getDevice()->getSemaphoreValue(m_parent.m_id) + 1; // i.e. the next signal
+
+		w << CmdInline(3D, UnknownFlush{}, 0);
+		w << Cmd(3D, SetReportSemaphoreOffset{},
+			Iova(m_parent.m_workBuf.getComputeJobsSemaphore()),
+			chunk.semValue,
+			S::Operation::Release | S::FenceEnable{} | S::Unit::Crop | S::StructureSize::OneWord
+		);
+		w << CmdInline(3D, TiledCacheFlush{}, Engine3D::TiledCacheFlush::Flush);
+	}
 }
@@ -0,0 +1,267 @@
+#include "../dk_cmdbuf.h"
+
+#include "helpers.h"
+#include "engine_3d.h"
+
+using namespace maxwell;
+using namespace dk::detail;
+
+using E = Engine3D;
+
+namespace
+{
+	constexpr unsigned s_numMethods = 0xE00;
+
+	struct MethodBitmap
+	{
+		uint32_t bits[s_numMethods/32];
+
+		constexpr void add(unsigned method, unsigned count = 1)
+		{
+			for (unsigned i = 0; i < count; i ++)
+				bits[(method+i)/32] |= 1U << ((method+i)%32);
+		}
+
+		constexpr bool test(unsigned method) const
+		{
+			return method < s_numMethods && (bits[method/32] & (1U << (method%32)));
+		}
+	};
+
+	// Methods that may be filtered. All of these are plain state registers, i.e. writing them has no
+	// side effects other than updating their value, and none of them are written by MME macros
+	// (which would otherwise make the shadow go stale without the CPU noticing).
+	constexpr MethodBitmap s_filterableMethods = []() constexpr
+	{
+		MethodBitmap m{};
+
+		// Rasterizer state
+		m.add(E::RasterizerEnable{});
+		m.add(E::ViewVolumeClipControl{});
+		m.add(E::FillRectangleConfig{});
+		m.add(E::SetPolygonModeFront{});
+		m.add(E::SetPolygonModeBack{});
+		m.add(E::CullFaceEnable{});
+		m.add(E::SetCullFace{});
+		m.add(E::SetFrontFace{});
+		m.add(E::ProvokingVertexLast{});
+		m.add(E::PointSmoothEnable{});
+		m.add(E::LineSmoothEnable{});
+		m.add(E::PolygonSmoothEnable{});
+		m.add(E::PolygonOffsetPointEnable{});
+		m.add(E::PolygonOffsetLineEnable{});
+		m.add(E::PolygonOffsetFillEnable{});
+		m.add(E::PolygonOffsetUnits{});
+		m.add(E::PolygonOffsetClamp{});
+		m.add(E::PolygonOffsetFactor{});
+		m.add(E::PointSpriteSize{});
+		m.add(E::LineWidthSmooth{});
+		m.add(E::LineWidthAliased{});
+		m.add(E::LineStippleEnable{});
+		m.add(E::LineStipplePattern{});
+		m.add(E::PolygonStippleEnable{});
+		m.add(E::PolygonStipplePattern{}, 32);
+		m.add(E::SetConservativeRasterEnable{});
+
+		// Color/blend state
+		m.add(E::ColorLogicOpType{});
+		m.add(E::AlphaTestEnable{});
+		m.add(E::AlphaTestFunc{});
+		m.add(E::AlphaTestRef{});
+		m.add(E::BlendConstant{}, 4);
+		for (unsigned i = 0; i < DK_MAX_RENDER_TARGETS; i ++)
+		{
+			m.add(E::IndependentBlend::EquationRgb{i});
+			m.add(E::IndependentBlend::FuncRgbSrc{i});
+			m.add(E::IndependentBlend::FuncRgbDst{i});
+			m.add(E::IndependentBlend::EquationAlpha{i});
+			m.add(E::IndependentBlend::FuncAlphaSrc{i});
+			m.add(E::IndependentBlend::FuncAlphaDst{i});
+		}
+
+		// Depth/stencil state (the parts not handled by the BindDepthStencilState macro)
+		m.add(E::DepthBoundsEnable{});
+		m.add(E::DepthBoundsNear{});
+		m.add(E::DepthBoundsFar{});
+		m.add(E::StencilFrontMask{});
+		m.add(E::StencilFrontFuncRef{});
+		m.add(E::StencilFrontFuncMask{});
+		m.add(E::StencilBackMask{});
+		m.add(E::StencilBackFuncRef{});
+		m.add(E::StencilBackFuncMask{});
+
+		// Primitive assembly & tessellation state
+		m.add(E::PrimitiveRestartEnable{});
+		m.add(E::PrimitiveRestartIndex{});
+		m.add(E::TessellationPatchSize{});
+		m.add(E::TessellationOuterLevels{}, 4);
+		m.add(E::TessellationInnerLevels{}, 2);
+		m.add(E::TiledCacheTileSize{});
+
+		// Vertex input state
+		m.add(E::VertexAttribState{}, DK_MAX_VERTEX_ATTRIBS);
+		m.add(E::IsVertexArrayPerInstance{}, DK_MAX_VERTEX_BUFFERS);
+		m.add(E::VertexArrayLimit{}, 2*DK_MAX_VERTEX_BUFFERS);
+		for (unsigned i = 0; i < DK_MAX_VERTEX_BUFFERS; i ++)
+		{
+			m.add(E::VertexArray::Config{i});
+			m.add(E::VertexArray::Start{i}, 2);
+			m.add(E::VertexArray::Divisor{i});
+		}
+
+		return m;
+	}();
+}
+
+CmdWord* CmdBuf::filterStateCmds(CmdWord* start, CmdWord* end) noexcept
+{
+	StateShadow& shadow = *m_stateShadow;
+	static_assert(StateShadow::s_numMethods == s_numMethods, "Mismatched method count");
+
+	auto isRedundant = [&shadow](unsigned method, uint32_t value) -> bool
+	{
+		return s_filterableMethods.test(method) &&
+			(shadow.m_valid[method/32] & (1U << (method%32))) &&
+			shadow.m_values[method] == value;
+	};
+
+	auto update = [&shadow](unsigned method, uint32_t value)
+	{
+		if (s_filterableMethods.test(method))
+		{
+			shadow.m_valid[method/32] |= 1U << (method%32);
+			shadow.m_values[method] = value;
+		}
+	};
+
+	auto forget = [&shadow](unsigned method)
+	{
+		if (method < s_numMethods)
+			shadow.m_valid[method/32] &= ~(1U << (method%32));
+	};
+
+	CmdWord *in = start, *out = start;
+
+	// Skip over the remaining payload of a command that was split across two flushes
+	if (shadow.m_skipWords)
+	{
+		uint32_t numWords = end - in;
+		if (numWords > shadow.m_skipWords)
+			numWords = shadow.m_skipWords;
+		shadow.m_skipWords -= numWords;
+		in += numWords;
+		out = in;
+	}
+
+	while (in < end)
+	{
+		uint32_t header = in->i;
+		unsigned method  = header & 0x1FFF;
+		unsigned subchan = (header >> 13) & 7;
+		unsigned arg     = (header >> 16) & 0x1FFF;
+		unsigned mode    = header >> 29;
+
+		if (mode == Inline)
+		{
+			if (subchan == Subchannel3D)
+			{
+				if (isRedundant(method, arg))
+				{
+					in ++;
+					continue;
+				}
+				update(method, arg);
+			}
+			*out++ = *in++;
+			continue;
+		}
+
+		if (mode != Increasing && mode != NonIncreasing && mode != IncreaseOnce)
+		{
+			// Unknown kind of command - leave the rest of the commands untouched and start afresh
+			shadow.invalidate();
+			if (out != in)
+				memmove(out, in, (end - in)*sizeof(CmdWord));
+			out += end - in;
+			in = end;
+			break;
+		}
+
+		CmdWord* data = in + 1;
+		uint32_t numWords = end - data;
+		if (numWords < arg)
+		{
+			// The payload of this command is not fully written yet (this happens when it gets
+			// split by a flush), so we don't know the values - leave it alone and forget everything
+			shadow.invalidate();
+			shadow.m_skipWords = arg - numWords;
+			arg = numWords;
+			if (out != in)
+				memmove(out, in, (1+arg)*sizeof(CmdWord));
+			out += 1+arg;
+			in += 1+arg;
+			continue;
+		}
+
+		if (subchan != Subchannel3D || mode != Increasing)
+		{
+			// Non-incrementing writes usually feed FIFO-like registers, so they are not filtered;
+			// however we need to forget about the values of the affected registers.
+			if (subchan == Subchannel3D)
+			{
+				forget(method);
+				if (mode == IncreaseOnce)
+					forget(method+1);
+			}
+			if (out != in)
+				memmove(out, in, (1+arg)*sizeof(CmdWord));
+			out += 1+arg;
+			in += 1+arg;
+			continue;
+		}
+
+		// Split the incrementing write into runs of non-redundant writes. A header needs to be
+		// emitted for each run, so gaps of a single redundant write are kept (it would not pay off).
+		// Note that the output never catches up with the input, since each emitted header is
+		// accounted for by at least two elided words.
+		uint32_t i = 0;
+		while (i < arg)
+		{
+			// Skip leading redundant writes
+			if (isRedundant(method+i, data[i].i))
+			{
+				i ++;
+				continue;
+			}
+
+			// Extend the run
+			uint32_t runStart = i, runEnd = i+1;
+			while (runEnd < arg)
+			{
+				uint32_t gapEnd = runEnd;
+				while (gapEnd < arg && isRedundant(method+gapEnd, data[gapEnd].i))
+					gapEnd ++;
+				if (gapEnd == runEnd)
+					runEnd ++;
+				else if (gapEnd - runEnd == 1 && gapEnd < arg)
+					runEnd = gapEnd; // absorb the single word gap
+				else
+					break;
+			}
+
+			// Emit the run
+			uint32_t runSize = runEnd - runStart;
+			for (uint32_t j = runStart; j < runEnd; j ++)
+				update(method+j, data[j].i);
+			out->i = MakeCmdHeader(Increasing, runSize, Subchannel3D, method+runStart);
+			memmove(out+1, data+runStart, runSize*sizeof(CmdWord));
+			out += 1+runSize;
+			i = runEnd;
+		}
+
+		in += 1+arg;
+	}
+
+	m_numElidedWords += end - out;
+	return out;
+}
@@ -30,6 +30,7 @@ inline void ComputeQueue::bindImage(uint32_t id, DkResHandle handle)
 void ComputeQueue::initialize()
 {
 	initQmd();
+	initJobQueue();
 	initComputeEngine();
 }
 
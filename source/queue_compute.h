@@ -13,17 +13,41 @@ namespace dk::detail
 		uint32_t m_curJob;
 		uint32_t m_curSmThrottling;
 
-		struct
+		// The job queue is split into chunks. A semaphore is released after the last job of each chunk,
+		// so that the chunk can be reused as soon as its previous jobs are complete.
+		static constexpr uint32_t s_numJobChunks = 4;
+		struct JobChunk
+		{
+			uint32_t semValue;      // value released once the jobs in the chunk are complete
+			uint64_t timelineValue; // queue timeline value reached by then (0 if the chunk was never used)
+		};
+		uint32_t m_jobsPerChunk;
+		uint32_t m_jobSemValue;
+		JobChunk m_jobChunks[s_numJobChunks];
+
+		struct Job
 		{
 			maxwell::ComputeQmd qmd;
 			ComputeDriverCbuf cbuf;
-		} job;
+		};
+
+		// Contents last uploaded to each job slot, so that a dispatch only needs to upload the words
+		// that differ - or nothing at all when the previous slot already holds the very same job.
+		struct JobShadow
+		{
+			Job job;
+			bool valid; // false if the slot was never uploaded, or was patched by an indirect dispatch
+		};
+		JobShadow* m_jobShadows; // allocated right after the ComputeQueue (see calcExtraSize)
+
+		Job job;
 
 		static constexpr uint32_t s_jobSizeBytes = sizeof(job);
 		static constexpr uint32_t s_jobSizeWords = s_jobSizeBytes/sizeof(maxwell::CmdWord);
 		static constexpr uint32_t s_jobSizeAlign = (s_jobSizeBytes + 0xFF) &~ 0xFF;
 
 		void initQmd();
+		void initJobQueue();
 		void initComputeEngine();
 		void bindConstbuf(uint32_t id, DkGpuAddr addr, uint32_t size);
 		void bindShader(CtrlCmdComputeShader const* cmd);
@@ -35,9 +59,16 @@ namespace dk::detail
 
 	public:
 		ComputeQueue(DkQueue parent) :
-			m_parent{*parent}, m_curJob{}, m_curSmThrottling{0x100}, job{}
+			m_parent{*parent}, m_curJob{}, m_curSmThrottling{0x100},
+			m_jobsPerChunk{}, m_jobSemValue{}, m_jobChunks{},
+			m_jobShadows{reinterpret_cast<JobShadow*>(this+1)}, job{}
 		{ }
 
+		static size_t calcExtraSize(uint32_t numJobs) noexcept
+		{
+			return sizeof(ComputeQueue) + numJobs*sizeof(JobShadow);
+		}
+
 		void initialize();
 		CtrlCmdHeader const* processCtrlCmd(CtrlCmdHeader const* cmd);
 
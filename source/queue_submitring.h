@@ -0,0 +1,96 @@
+#pragma once
+#include "dk_private.h"
+#include "dk_fence.h"
+
+namespace dk::detail
+{
+	// Bounded lock-free multi-producer single-consumer ring of queue operations, used by queues
+	// created with DkQueueFlags_ThreadSafeSubmit. Each slot carries a sequence number which tells
+	// whether it is free for the producer that claimed position N (seq == N), or whether it holds
+	// an operation ready for the consumer (seq == N+1).
+	class QueueSubmitRing
+	{
+	public:
+		enum // Operation types
+		{
+			SubmitCommands, // ptr = command list
+			WaitFence,      // fence = copy of the fence (ptr = fence instead, if it was still pending)
+			SignalFence,    // ptr = fence, arg = flush flag
+		};
+
+		struct Op
+		{
+			uint32_t type;
+			uint32_t arg;
+			void* ptr;
+			DkFence fence;
+		};
+
+		static constexpr uint32_t s_numSlots = 256;
+		static_assert((s_numSlots & (s_numSlots - 1)) == 0, "Number of slots must be a power of two");
+
+	private:
+		struct Slot
+		{
+			uint32_t seq;
+			Op op;
+		};
+
+		uint32_t m_enqueuePos;
+		uint32_t m_dequeuePos;
+		Slot m_slots[s_numSlots];
+
+	public:
+		QueueSubmitRing() noexcept : m_enqueuePos{}, m_dequeuePos{}
+		{
+			for (uint32_t i = 0; i < s_numSlots; i ++)
+				m_slots[i].seq = i;
+		}
+
+		void* operator new(size_t size, void* p) noexcept { return p; }
+		void operator delete(void* ptr, void* p) noexcept { }
+
+		// Can be called from any thread. Returns false if the ring is full.
+		bool push(Op const& op) noexcept
+		{
+			Slot* slot;
+			uint32_t pos = __atomic_load_n(&m_enqueuePos, __ATOMIC_RELAXED);
+			for (;;)
+			{
+				slot = &m_slots[pos % s_numSlots];
+				uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+				int32_t diff = int32_t(seq - pos);
+				if (diff == 0)
+				{
+					// The slot is free - try to claim it (on failure pos is updated with the current value)
+					if (__atomic_compare_exchange_n(&m_enqueuePos, &pos, pos+1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+						break;
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = __atomic_load_n(&m_enqueuePos, __ATOMIC_RELAXED);
+			}
+
+			slot->op = op;
+			__atomic_store_n(&slot->seq, pos+1, __ATOMIC_RELEASE);
+			return true;
+		}
+
+		// Must only be called by one thread at a time. Operations are returned in the order in
+		// which their slots were claimed; a claimed slot that is still being written to stops
+		// the consumer until the next call.
+		bool pop(Op& op) noexcept
+		{
+			Slot* slot = &m_slots[m_dequeuePos % s_numSlots];
+			uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+			if (seq != m_dequeuePos+1)
+				return false;
+
+			op = slot->op;
+			__atomic_store_n(&slot->seq, m_dequeuePos + s_numSlots, __ATOMIC_RELEASE);
+			m_dequeuePos ++;
+			return true;
+		}
+	};
+}
@@ -11,7 +11,7 @@ QueueWorkBuf::QueueWorkBuf(DkQueueMaker const& maker) : MemBlock{maker.device},
 	m_graphicsCbufOffset{}, m_graphicsCbufSize{},
 	m_vtxRunoutBufOffset{}, m_vtxRunoutBufSize{},
 	m_zcullCtxOffset{}, m_zcullCtxSize{},
-	m_computeJobsOffset{}, m_computeJobsCount{},
+	m_computeJobsOffset{}, m_computeJobsCount{}, m_computeJobsSemOffset{},
 	m_totalSize{}
 {
 	auto& info = getDevice()->getGpuInfo();
@@ -42,6 +42,7 @@ QueueWorkBuf::QueueWorkBuf(DkQueueMaker const& maker) : MemBlock{maker.device},
 		uint32_t jobSize = sizeof(maxwell::ComputeQmd) + ComputeDriverCbufSize;
 		m_computeJobsCount = maker.maxConcurrentComputeJobs;
 		addSection(m_computeJobsOffset, m_computeJobsCount*jobSize, DK_UNIFORM_BUF_ALIGNMENT);
+		addSection(m_computeJobsSemOffset, sizeof(uint32_t), 0x10); // released as the jobs complete (see ComputeQueue::dispatch)
 	}
 
 	m_totalSize = (m_totalSize + DK_MEMBLOCK_ALIGNMENT - 1) &~ (DK_MEMBLOCK_ALIGNMENT - 1);
@@ -52,6 +53,7 @@ QueueWorkBuf::QueueWorkBuf(DkQueueMaker const& maker) : MemBlock{maker.device},
 	printf("Vtx runout buf: 0x%x (0x%x bytes)\n", m_vtxRunoutBufOffset, m_vtxRunoutBufSize);
 	printf("Zcull ctx:      0x%x (0x%x bytes)\n", m_zcullCtxOffset, m_zcullCtxSize);
 	printf("Compute mem:    0x%x (%u jobs)\n",    m_computeJobsOffset, m_computeJobsCount);
+	printf("Compute sem:    0x%x\n",              m_computeJobsSemOffset);
 	printf("Total size:     0x%x bytes\n",        m_totalSize);
 #endif
 }
@@ -21,6 +21,7 @@ namespace dk::detail
 		// Work memory needed for Compute-capable queues
 		uint32_t m_computeJobsOffset;
 		uint32_t m_computeJobsCount;
+		uint32_t m_computeJobsSemOffset;
 
 		// Total size of the work buffer
 		uint32_t m_totalSize;
@@ -66,5 +67,6 @@ namespace dk::detail
 
 		DkGpuAddr getComputeJobs() const noexcept { return getGpuAddr(m_computeJobsOffset); }
 		uint32_t getComputeJobsCount() const noexcept { return m_computeJobsCount; }
+		DkGpuAddr getComputeJobsSemaphore() const noexcept { return getGpuAddr(m_computeJobsSemOffset); }
 	};
 }
@@ -51,6 +51,13 @@ public:
 		m_inFlight += produced;
 	}
 
+	// Gives back the last 'amount' units handed out by updateProducer
+	void rewindProducer(T amount) noexcept
+	{
+		m_producer = (m_producer >= amount ? m_producer : m_producer + m_size) - amount;
+		m_inFlight -= amount;
+	}
+
 	void updateConsumer(T consumer) noexcept
 	{
 		if (consumer >= m_size)
@@ -0,0 +1,757 @@
+// dkcmddecode - host-side decoder and statistics tool for Maxwell command streams emitted by deko3d
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "maxwell/helpers.h"
+
+#ifndef DEF_DIR
+#define DEF_DIR "source/maxwell"
+#endif
+
+using namespace maxwell;
+
+namespace
+{
+	constexpr unsigned s_numMethods = 1U << 13;
+	constexpr unsigned s_numSubchannels = 8;
+	constexpr unsigned s_firstMacroMethod = 0xE00;
+	constexpr unsigned s_firstEngineMethod = 0x40; // methods below this point are handled by the gpfifo itself
+
+	const char* const s_modeNames[] =
+	{
+		"Grp0Tert", "Increasing", "Grp2Tert", "NonIncreasing", "Inline", "IncreaseOnce", "Reserved6", "EndSegment",
+	};
+
+	// Control commands recorded by dkCmdBufBeginCaptureCmds (see CmdBuf::CaptureRecord)
+	constexpr unsigned s_captureRecordMode = 6;
+	constexpr unsigned s_captureRecordMagic = 0x0DC0;
+
+	const char* const s_captureRecordNames[] =
+	{
+		"Split", "RawEntry", "CtrlCmd", "Start", "?", "?", "?", "?",
+	};
+
+	struct MethodInfo
+	{
+		std::string name;
+		bool isPipe;
+		bool isFloat;
+	};
+
+	struct Engine
+	{
+		std::string name;
+		uint32_t classId;
+		std::vector<MethodInfo> methods;
+
+		Engine() : classId{}, methods(s_numMethods) { }
+	};
+
+	std::vector<Engine> g_engines;
+	int g_gpfifoEngine = -1;
+	int g_3dEngine = -1;
+	int g_subchannels[s_numSubchannels];
+
+	//-----------------------------------------------------------------------------
+	// .def file parsing
+	//-----------------------------------------------------------------------------
+
+	struct Type
+	{
+		enum Kind { Plain, Float, Iova, Pipe, Array, Struct } kind;
+		unsigned count;
+		unsigned stride;
+		std::vector<std::pair<unsigned, std::pair<std::string, Type>>> members;
+		std::vector<Type> sub;
+
+		Type(Kind k = Plain) : kind{k}, count{1}, stride{1} { }
+
+		unsigned numWords() const
+		{
+			switch (kind)
+			{
+				default:     return 1;
+				case Iova:   return 2;
+				case Array:  return count * sub[0].numWords();
+				case Struct: return count * stride;
+			}
+		}
+	};
+
+	class DefParser
+	{
+		const char* m_fileName;
+		std::vector<std::string> m_tokens;
+		size_t m_pos;
+		bool m_failed;
+
+		void tokenize(const char* text)
+		{
+			for (const char* p = text; *p; )
+			{
+				if (isspace((unsigned char)*p))
+					p ++;
+				else if (p[0] == '/' && p[1] == '/')
+				{
+					while (*p && *p != '\n')
+						p ++;
+				}
+				else if (isalnum((unsigned char)*p) || *p == '_')
+				{
+					const char* start = p;
+					while (isalnum((unsigned char)*p) || *p == '_' || (p[0] == '.' && p[1] == '.'))
+						p += (*p == '.') ? 2 : 1;
+					m_tokens.emplace_back(start, p);
+				}
+				else
+					m_tokens.emplace_back(p++, 1);
+			}
+		}
+
+		const std::string& peek() const
+		{
+			static const std::string s_eof;
+			return m_pos < m_tokens.size() ? m_tokens[m_pos] : s_eof;
+		}
+
+		std::string next()
+		{
+			if (m_pos >= m_tokens.size())
+			{
+				error("unexpected end of file");
+				return {};
+			}
+			return m_tokens[m_pos++];
+		}
+
+		void expect(const char* tok)
+		{
+			std::string t = next();
+			if (t != tok)
+				error("expected '%s', got '%s'", tok, t.c_str());
+		}
+
+		unsigned number()
+		{
+			std::string t = next();
+			char* end;
+			unsigned long v = strtoul(t.c_str(), &end, 0);
+			if (t.empty() || *end)
+				error("expected number, got '%s'", t.c_str());
+			return v;
+		}
+
+		template <typename... Targs>
+		void error(const char* fmt, Targs... args)
+		{
+			if (m_failed)
+				return;
+			m_failed = true;
+			m_pos = m_tokens.size();
+			fprintf(stderr, "%s: ", m_fileName);
+			fprintf(stderr, fmt, args...);
+			fprintf(stderr, "\n");
+		}
+
+		void skipBlock()
+		{
+			// Skips a parenthesized block, which describes the contents of a register (enum values, bitfields)
+			expect("(");
+			for (unsigned depth = 1; depth && !m_failed; )
+			{
+				std::string t = next();
+				if (t == "(")
+					depth ++;
+				else if (t == ")")
+					depth --;
+			}
+		}
+
+		Type parseType()
+		{
+			const std::string& t = peek();
+			if (t == "float")     { next(); return Type{Type::Float}; }
+			if (t == "iova")      { next(); return Type{Type::Iova}; }
+			if (t == "pipe")      { next(); return Type{Type::Pipe}; }
+			if (t == "bool")      { next(); return Type{}; }
+			if (t == "enum" || t == "bits")
+			{
+				next();
+				skipBlock();
+				return Type{};
+			}
+			if (t == "array")
+			{
+				next();
+				expect("[");
+				unsigned count = number();
+				expect("]");
+
+				Type ret;
+				ret.count = count;
+				if (peek() != "(")
+				{
+					ret.kind = Type::Array;
+					ret.sub.push_back(parseType());
+					return ret;
+				}
+
+				ret.kind = Type::Struct;
+				next();
+				while (!m_failed && peek() != ")")
+				{
+					unsigned offset = number();
+					std::string name = next();
+					if (name == "next")
+						ret.stride = offset;
+					else
+						ret.members.push_back({ offset, { name, parseType() } });
+					expect(";");
+				}
+				next();
+				return ret;
+			}
+			return Type{};
+		}
+
+		void define(Engine& engine, unsigned method, std::string const& name, Type const& type)
+		{
+			auto set = [&](unsigned m, std::string n)
+			{
+				if (m >= s_numMethods)
+					return;
+				MethodInfo& info = engine.methods[m];
+				info.name = std::move(n);
+				info.isPipe = type.kind == Type::Pipe;
+				info.isFloat = type.kind == Type::Float;
+			};
+
+			switch (type.kind)
+			{
+				default:
+					set(method, name);
+					break;
+				case Type::Iova:
+					set(method+0, name + ".High");
+					set(method+1, name + ".Low");
+					break;
+				case Type::Array:
+					for (unsigned i = 0; i < type.count; i ++)
+						define(engine, method + i*type.sub[0].numWords(), name + "[" + std::to_string(i) + "]", type.sub[0]);
+					break;
+				case Type::Struct:
+					for (unsigned i = 0; i < type.count; i ++)
+						for (auto const& m : type.members)
+							define(engine, method + i*type.stride + m.first, name + "[" + std::to_string(i) + "]." + m.second.first, m.second.second);
+					break;
+			}
+		}
+
+	public:
+		DefParser(const char* fileName, const char* text) : m_fileName{fileName}, m_pos{}, m_failed{}
+		{
+			tokenize(text);
+		}
+
+		bool parse(Engine& engine)
+		{
+			while (!m_failed && m_pos < m_tokens.size())
+			{
+				if (peek() == "engine")
+				{
+					next();
+					engine.name = next();
+					if (engine.name[0] == '_')
+						engine.name.erase(0, 1);
+					engine.classId = number();
+					expect(";");
+					continue;
+				}
+
+				unsigned method = number();
+				std::string name = next();
+				Type type = parseType();
+				expect(";");
+				if (!m_failed)
+					define(engine, method, name, type);
+			}
+			return !m_failed;
+		}
+	};
+
+	bool readFile(const char* path, std::string& out)
+	{
+		FILE* f = fopen(path, "rb");
+		if (!f)
+			return false;
+		char buf[4096];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+			out.append(buf, n);
+		fclose(f);
+		return true;
+	}
+
+	bool loadEngines(const char* dir)
+	{
+		// Subchannel assignment used by deko3d (see source/maxwell/helpers.h)
+		static const struct { const char* file; const char* name; int subchannel; } s_engineFiles[] =
+		{
+			{ "engine_3d.def",      "3D",      Subchannel3D      },
+			{ "engine_compute.def", "Compute", SubchannelCompute },
+			{ "engine_inline.def",  "Inline",  SubchannelInline  },
+			{ "engine_2d.def",      "2D",      Subchannel2D      },
+			{ "engine_copy.def",    "Copy",    SubchannelCopy    },
+			{ "engine_gpfifo.def",  "Gpfifo",  SubchannelGpfifo  },
+		};
+
+		for (unsigned i = 0; i < s_numSubchannels; i ++)
+			g_subchannels[i] = -1;
+
+		for (auto const& e : s_engineFiles)
+		{
+			std::string path = std::string{dir} + "/" + e.file;
+			std::string text;
+			if (!readFile(path.c_str(), text))
+			{
+				fprintf(stderr, "cannot open %s\n", path.c_str());
+				return false;
+			}
+
+			Engine engine;
+			engine.name = e.name;
+			if (!DefParser{path.c_str(), text.c_str()}.parse(engine))
+				return false;
+
+			int id = g_engines.size();
+			g_engines.push_back(std::move(engine));
+			g_subchannels[e.subchannel] = id;
+			if (e.subchannel == SubchannelGpfifo)
+				g_gpfifoEngine = id;
+			else if (e.subchannel == Subchannel3D)
+				g_3dEngine = id;
+		}
+
+		return true;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Command stream decoding
+	//-----------------------------------------------------------------------------
+
+	struct Stats
+	{
+		uint64_t writes;
+		uint64_t words;
+		uint64_t repeats;
+	};
+
+	struct SectionStats
+	{
+		uint64_t count;
+		uint64_t words;
+		uint64_t commands;
+	};
+
+	struct Decoder
+	{
+		bool m_verbose;
+		uint64_t m_totalWords;
+		uint64_t m_totalCommands;
+		uint64_t m_totalRepeats;
+		SectionStats m_modes[8];
+		std::map<uint32_t, Stats> m_methods; // key: engine<<16 | method
+		std::map<uint32_t, uint32_t> m_lastValues;
+		std::map<std::string, SectionStats> m_calls;
+		std::vector<std::pair<std::string, SectionStats>> m_submissions;
+		int m_subchannels[s_numSubchannels];
+
+		Decoder(bool verbose) : m_verbose{verbose}, m_totalWords{}, m_totalCommands{}, m_totalRepeats{}, m_modes{}
+		{
+			resetSubchannels();
+		}
+
+		void resetSubchannels()
+		{
+			// Initial bindings match the ones established by deko3d at queue creation time
+			for (unsigned i = 0; i < s_numSubchannels; i ++)
+				m_subchannels[i] = g_subchannels[i];
+		}
+
+		int getEngine(unsigned subchannel, unsigned method) const
+		{
+			return method < s_firstEngineMethod ? g_gpfifoEngine : m_subchannels[subchannel];
+		}
+
+		std::string getMethodName(int engine, unsigned method) const
+		{
+			char buf[64];
+			if (engine == g_3dEngine && method >= s_firstMacroMethod)
+			{
+				snprintf(buf, sizeof(buf), "MmeMacro[%u]%s", (method - s_firstMacroMethod) / 2, (method & 1) ? ".Param" : "");
+				return buf;
+			}
+			if (method == 0)
+				return "BindObject";
+			if (engine >= 0 && !g_engines[engine].methods[method].name.empty())
+				return g_engines[engine].methods[method].name;
+			snprintf(buf, sizeof(buf), "Method%03X", method);
+			return buf;
+		}
+
+		static uint32_t makeKey(int engine, unsigned method)
+		{
+			return (uint32_t(engine & 0xFFFF) << 16) | method;
+		}
+
+		void write(unsigned subchannel, unsigned method, uint32_t value, bool trackRepeats, unsigned numWords, bool echo = true)
+		{
+			int engine = getEngine(subchannel, method);
+			Stats& st = m_methods[makeKey(engine, method)];
+			st.writes ++;
+			st.words += numWords;
+
+			if (m_verbose && echo)
+			{
+				bool isFloat = engine >= 0 && g_engines[engine].methods[method].isFloat;
+				std::string name = getMethodName(engine, method);
+				const char* engineName = engine >= 0 ? g_engines[engine].name.c_str() : "?";
+				if (isFloat)
+				{
+					float f;
+					memcpy(&f, &value, sizeof(f));
+					printf("           %s.%s = 0x%08X (%g)\n", engineName, name.c_str(), value, f);
+				}
+				else
+					printf("           %s.%s = 0x%08X\n", engineName, name.c_str(), value);
+			}
+
+			if (method == 0)
+			{
+				// Binding a new class to the subchannel
+				for (unsigned i = 0; i < g_engines.size(); i ++)
+					if (g_engines[i].classId == value)
+						m_subchannels[subchannel] = i;
+				return;
+			}
+
+			bool isPipe = engine >= 0 && g_engines[engine].methods[method].isPipe;
+			bool isMacro = engine == g_3dEngine && method >= s_firstMacroMethod;
+			if (trackRepeats && !isPipe && !isMacro)
+			{
+				auto it = m_lastValues.find(makeKey(engine, method));
+				if (it != m_lastValues.end() && it->second == value)
+				{
+					st.repeats ++;
+					m_totalRepeats ++;
+				}
+				m_lastValues[makeKey(engine, method)] = value;
+			}
+		}
+
+		void decode(uint32_t const* words, size_t numWords, const char* section, SectionStats& sub)
+		{
+			SectionStats& call = m_calls[section];
+			call.count ++;
+			if (m_verbose && *section)
+				printf("---- %s ----\n", section);
+
+			// Capture records hold the size of the run of commands following them, commands extending
+			// past the end of a run are completed by a raw gpfifo entry (e.g. indirect draw parameters)
+			size_t pos = 0, runEnd = numWords;
+			while (pos < numWords)
+			{
+				uint32_t header = words[pos];
+				unsigned method  = header & 0x1FFF;
+				unsigned subchan = (header >> 13) & 7;
+				unsigned arg     = (header >> 16) & 0x1FFF;
+				unsigned mode    = header >> 29;
+
+				bool isCaptureRecord = mode == s_captureRecordMode && (method & ~1U) == s_captureRecordMagic;
+				unsigned payload = 0;
+				if (mode == Increasing || mode == NonIncreasing || mode == IncreaseOnce || isCaptureRecord)
+					payload = arg;
+
+				if (isCaptureRecord && payload && pos + 2 <= numWords)
+					runEnd = std::min<size_t>(numWords, pos + 1 + payload + words[pos+1]);
+				else if (!isCaptureRecord && pos < runEnd && runEnd < numWords && pos + 1 + payload > runEnd)
+					payload = runEnd - pos - 1;
+
+				if (pos + 1 + payload > numWords)
+				{
+					fprintf(stderr, "warning: command at word %zu in '%s' is truncated (%u payload words, %zu available)\n",
+						pos, section, payload, numWords - pos - 1);
+					payload = numWords - pos - 1;
+				}
+
+				unsigned size = 1 + payload;
+				m_totalWords += size;
+				m_totalCommands ++;
+				m_modes[mode].count ++;
+				m_modes[mode].words += size;
+				call.words += size;
+				call.commands ++;
+				sub.words += size;
+				sub.commands ++;
+
+				if (m_verbose && isCaptureRecord)
+					printf("%8zu: %08X %-13s %s (%u words)\n", pos, header, "CaptureRecord", s_captureRecordNames[subchan], payload);
+				else if (m_verbose)
+				{
+					int engine = getEngine(subchan, method);
+					printf("%8zu: %08X %-13s sub%u %s.%s", pos, header, s_modeNames[mode], subchan,
+						engine >= 0 ? g_engines[engine].name.c_str() : "?", getMethodName(engine, method).c_str());
+					if (mode == Inline)
+						printf(" = 0x%X\n", arg);
+					else if (payload)
+						printf(" (%u words)\n", payload);
+					else
+						printf("\n");
+				}
+
+				uint32_t const* data = &words[pos+1];
+				switch (isCaptureRecord ? 0 : mode)
+				{
+					case Increasing:
+						for (unsigned i = 0; i < payload; i ++)
+							write(subchan, method+i, data[i], true, i ? 1 : 2);
+						break;
+					case NonIncreasing:
+						for (unsigned i = 0; i < payload; i ++)
+							write(subchan, method, data[i], false, i ? 1 : 2);
+						break;
+					case IncreaseOnce:
+						for (unsigned i = 0; i < payload; i ++)
+							write(subchan, i ? method+1 : method, data[i], i == 0, i ? 1 : 2);
+						break;
+					case Inline:
+						write(subchan, method, arg, true, 1, false);
+						break;
+					default:
+						break;
+				}
+
+				if (mode == 7)
+				{
+					// End of pushbuffer segment - the rest of the words are garbage
+					break;
+				}
+
+				pos += size;
+			}
+		}
+
+		void report(unsigned maxMethods) const
+		{
+			printf("Total: %llu words, %llu commands, %llu repeated writes\n",
+				(unsigned long long)m_totalWords, (unsigned long long)m_totalCommands, (unsigned long long)m_totalRepeats);
+
+			printf("\nPer submission:\n");
+			for (auto const& s : m_submissions)
+				printf("  %-40s %8llu words %8llu commands\n", s.first.c_str(),
+					(unsigned long long)s.second.words, (unsigned long long)s.second.commands);
+
+			printf("\nPer submission mode:\n");
+			for (unsigned i = 0; i < 8; i ++)
+				if (m_modes[i].count)
+					printf("  %-13s %8llu commands %8llu words (%5.1f%%)\n", s_modeNames[i],
+						(unsigned long long)m_modes[i].count, (unsigned long long)m_modes[i].words,
+						100.0 * m_modes[i].words / m_totalWords);
+
+			if (m_calls.size() > 1 || (m_calls.size() == 1 && !m_calls.begin()->first.empty()))
+			{
+				std::vector<std::pair<std::string, SectionStats>> calls{m_calls.begin(), m_calls.end()};
+				std::stable_sort(calls.begin(), calls.end(), [](auto const& a, auto const& b) { return a.second.words > b.second.words; });
+
+				printf("\nPer API call:\n");
+				for (auto const& c : calls)
+					printf("  %-40s %6llu calls %8llu words (%6.1f words/call)\n", c.first.empty() ? "(unlabeled)" : c.first.c_str(),
+						(unsigned long long)c.second.count, (unsigned long long)c.second.words, double(c.second.words) / c.second.count);
+			}
+
+			std::vector<std::pair<uint32_t, Stats>> methods{m_methods.begin(), m_methods.end()};
+			std::stable_sort(methods.begin(), methods.end(), [](auto const& a, auto const& b) { return a.second.words > b.second.words; });
+			if (maxMethods && methods.size() > maxMethods)
+				methods.resize(maxMethods);
+
+			printf("\nPer method (by words):\n");
+			for (auto const& m : methods)
+			{
+				int engine = int16_t(m.first >> 16);
+				std::string name = (engine >= 0 ? g_engines[engine].name : std::string{"?"}) + "." + getMethodName(engine, m.first & 0xFFFF);
+				printf("  %-48s %8llu writes %8llu words", name.c_str(), (unsigned long long)m.second.writes, (unsigned long long)m.second.words);
+				if (m.second.repeats)
+					printf(" %8llu repeated", (unsigned long long)m.second.repeats);
+				printf("\n");
+			}
+		}
+	};
+
+	//-----------------------------------------------------------------------------
+	// Input parsing
+	//-----------------------------------------------------------------------------
+
+	bool processBinary(Decoder& dec, const char* path)
+	{
+		std::string data;
+		if (!readFile(path, data))
+		{
+			fprintf(stderr, "cannot open %s\n", path);
+			return false;
+		}
+		if (data.size() & 3)
+			fprintf(stderr, "warning: %s: size is not a multiple of 4, ignoring trailing bytes\n", path);
+
+		std::vector<uint32_t> words(data.size() / 4);
+		for (size_t i = 0; i < words.size(); i ++)
+		{
+			const uint8_t* p = (const uint8_t*)&data[i*4];
+			words[i] = p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+		}
+
+		SectionStats sub{1};
+		dec.decode(words.data(), words.size(), "", sub);
+		dec.m_submissions.push_back({ path, sub });
+		return true;
+	}
+
+	bool processText(Decoder& dec, const char* path)
+	{
+		std::string data;
+		if (!readFile(path, data))
+		{
+			fprintf(stderr, "cannot open %s\n", path);
+			return false;
+		}
+
+		SectionStats sub{1};
+		std::string section;
+		std::vector<uint32_t> words;
+		auto flush = [&]()
+		{
+			if (!words.empty() || !section.empty())
+				dec.decode(words.data(), words.size(), section.c_str(), sub);
+			words.clear();
+		};
+
+		size_t lineNo = 0;
+		for (size_t pos = 0; pos < data.size(); )
+		{
+			size_t end = data.find('\n', pos);
+			if (end == std::string::npos)
+				end = data.size();
+			std::string line = data.substr(pos, end - pos);
+			pos = end + 1;
+			lineNo ++;
+
+			size_t start = line.find_first_not_of(" \t\r");
+			if (start == std::string::npos)
+				continue;
+
+			if (line[start] == '#')
+			{
+				// Section label, i.e. the name of the API call that produced the words that follow
+				flush();
+				size_t nameStart = line.find_first_not_of(" \t", start+1);
+				size_t nameEnd = line.find_last_not_of(" \t\r");
+				section = nameStart != std::string::npos ? line.substr(nameStart, nameEnd - nameStart + 1) : std::string{};
+				continue;
+			}
+
+			for (const char* p = line.c_str() + start; *p; )
+			{
+				if (isspace((unsigned char)*p) || *p == ',')
+				{
+					p ++;
+					continue;
+				}
+				char* tokEnd;
+				unsigned long v = strtoul(p, &tokEnd, 16);
+				if (tokEnd == p)
+				{
+					fprintf(stderr, "%s:%zu: invalid word\n", path, lineNo);
+					return false;
+				}
+				words.push_back(v);
+				p = tokEnd;
+			}
+		}
+		flush();
+
+		dec.m_submissions.push_back({ path, sub });
+		return true;
+	}
+
+	void usage(const char* argv0)
+	{
+		fprintf(stderr,
+			"Usage: %s [options] files...\n"
+			"Decodes Maxwell command streams and prints per-method statistics.\n"
+			"Each input file is treated as a separate submission.\n"
+			"\n"
+			"Options:\n"
+			"  -d <dir>  directory containing the engine_*.def files (default: %s)\n"
+			"  -t        input files are text: hexadecimal words separated by whitespace or commas;\n"
+			"            a line starting with '#' names the API call that emitted the words below it\n"
+			"  -v        print the decoded command listing\n"
+			"  -n <num>  maximum number of methods to list (default: 32, 0 = all)\n"
+			"\n"
+			"Binary input files contain raw little endian words, as captured with\n"
+			"dkCmdBufBeginCaptureCmds/dkCmdBufEndCaptureCmds or dumped from gpfifo entries.\n",
+			argv0, DEF_DIR);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const char* defDir = DEF_DIR;
+	bool textInput = false, verbose = false;
+	unsigned maxMethods = 32;
+
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; i ++)
+	{
+		if (!strcmp(argv[i], "-d") && i+1 < argc)
+			defDir = argv[++i];
+		else if (!strcmp(argv[i], "-n") && i+1 < argc)
+			maxMethods = strtoul(argv[++i], nullptr, 0);
+		else if (!strcmp(argv[i], "-t"))
+			textInput = true;
+		else if (!strcmp(argv[i], "-v"))
+			verbose = true;
+		else
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (i >= argc)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (!loadEngines(defDir))
+		return EXIT_FAILURE;
+
+	Decoder dec{verbose};
+	for (; i < argc; i ++)
+	{
+		if (verbose)
+			printf("==== %s ====\n", argv[i]);
+		if (!(textInput ? processText(dec, argv[i]) : processBinary(dec, argv[i])))
+			return EXIT_FAILURE;
+	}
+
+	if (verbose)
+		printf("\n");
+	dec.report(maxMethods);
+	return EXIT_SUCCESS;
+}